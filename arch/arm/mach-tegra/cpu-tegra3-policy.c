@@ -0,0 +1,127 @@
+/*
+ * arch/arm/mach-tegra/cpu-tegra3-policy.c
+ *
+ * CPU auto-hotplug decision logic for Tegra3 CPUs
+ *
+ * Copyright (c) 2011, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/sched.h>
+
+#include "cpu-tegra3-policy.h"
+
+#define NR_FSHIFT	2
+static unsigned int nr_run_thresholds[] = {
+/*      1,  2,  3,  4 - on-line cpus target */
+	5,  7, 9, UINT_MAX /* avg run threads * 4 (e.g., 9 = 2.25 threads) */
+};
+static unsigned int nr_run_hysteresis = 2;	/* 0.5 thread */
+
+/*
+ * Evaluate:
+ * - distribution of freq targets for already on-lined CPUs
+ * - average number of runnable threads
+ * - effective MIPS available within EDP frequency limits,
+ * and return:
+ * TEGRA_CPU_SPEED_BALANCED to bring one more CPU core on-line
+ * TEGRA_CPU_SPEED_BIASED to keep CPU core composition unchanged
+ * TEGRA_CPU_SPEED_SKEWED to remove CPU core off-line
+ */
+int tegra3_cpu_speed_balance(const struct tegra3_balance_params *p,
+			     const struct tegra3_balance_sample *s,
+			     unsigned int *nr_run_last)
+{
+	unsigned long highest_speed = s->highest_speed;
+	unsigned long balanced_speed = highest_speed * p->balance_level / 100;
+	unsigned long skewed_speed = balanced_speed / 2;
+	unsigned int nr_cpus = s->nr_cpus;
+	unsigned int nr_run = UINT_MAX;
+
+	if (p->nr_run) {
+		for (nr_run = 1; nr_run < ARRAY_SIZE(nr_run_thresholds);
+		     nr_run++) {
+			unsigned int nr_threshold =
+				nr_run_thresholds[nr_run - 1];
+			if (*nr_run_last <= nr_run)
+				nr_threshold += nr_run_hysteresis;
+			if (s->avg_nr_run <=
+			    (nr_threshold << (FSHIFT - NR_FSHIFT)))
+				break;
+		}
+		*nr_run_last = nr_run;
+	}
+
+	if (((p->count_slow_cpus(skewed_speed) >= 2) ||
+	     (nr_run < nr_cpus) ||
+	     p->edp_favor_down(nr_cpus, p->mp_overhead) ||
+	     (highest_speed <= p->idle_bottom_freq) ||
+	     (nr_cpus > s->max_cpus)) &&
+	    (nr_cpus > s->min_cpus))
+		return TEGRA_CPU_SPEED_SKEWED;
+
+	if (((p->count_slow_cpus(balanced_speed) >= 1) ||
+	     (nr_run <= nr_cpus) ||
+	     (!p->edp_favor_up(nr_cpus, p->mp_overhead)) ||
+	     (highest_speed <= p->idle_bottom_freq) ||
+	     (nr_cpus == s->max_cpus)) &&
+	    (nr_cpus >= s->min_cpus))
+		return TEGRA_CPU_SPEED_BIASED;
+
+	return TEGRA_CPU_SPEED_BALANCED;
+}
+
+/*
+ * mp_policy: ask for one more core once the runqueue depth has stayed at
+ * or above NwNs[2n] for TwTs[2n] ms, and for one less once it has stayed
+ * at or below NwNs[2n + 1] for TwTs[2n + 1] ms, n + 1 being the number of
+ * cores online. rq_depth is in tenths of a runnable thread.
+ */
+int tegra3_mp_decision(struct tegra3_mp_state *st, const unsigned int *nwns,
+		       const unsigned int *twts, u64 now_ms,
+		       unsigned int rq_depth, unsigned int nr_cpu_online)
+{
+	int new_state = TEGRA_HP_IDLE;
+	int index;
+
+	if (st->started)
+		st->total_time += now_ms - st->last_time;
+	st->started = true;
+
+	if (nr_cpu_online) {
+		index = (nr_cpu_online - 1) * 2;
+		if ((nr_cpu_online < 4) && (rq_depth >= nwns[index])) {
+			if (st->total_time >= twts[index])
+				new_state = TEGRA_HP_UP;
+		} else if (rq_depth <= nwns[index + 1]) {
+			if (st->total_time >= twts[index + 1])
+				new_state = TEGRA_HP_DOWN;
+		} else {
+			st->total_time = 0;
+		}
+	} else {
+		st->total_time = 0;
+	}
+
+	if (new_state != TEGRA_HP_IDLE)
+		st->total_time = 0;
+
+	st->last_time = now_ms;
+
+	return new_state;
+}
@@ -0,0 +1,72 @@
+/*
+ * arch/arm/mach-tegra/cpu-tegra3-policy.h
+ *
+ * CPU auto-hotplug decision logic for Tegra3 CPUs
+ *
+ * Copyright (c) 2011, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#ifndef __MACH_TEGRA_CPU_TEGRA3_POLICY_H
+#define __MACH_TEGRA_CPU_TEGRA3_POLICY_H
+
+#include <linux/types.h>
+
+enum {
+	TEGRA_HP_DISABLED = 0,
+	TEGRA_HP_IDLE,
+	TEGRA_HP_DOWN,
+	TEGRA_HP_UP,
+};
+
+enum {
+	TEGRA_CPU_SPEED_BALANCED,
+	TEGRA_CPU_SPEED_BIASED,
+	TEGRA_CPU_SPEED_SKEWED,
+};
+
+/*
+ * Everything below works only on its arguments, so that it can be built
+ * outside the kernel (see tools/cpuquiet) and fed recorded traces.
+ */
+struct tegra3_balance_params {
+	int balance_level;
+	int mp_overhead;
+	unsigned int idle_bottom_freq;
+	bool nr_run;		/* use the runnable thread average */
+	unsigned int (*count_slow_cpus)(unsigned long speed_limit);
+	bool (*edp_favor_up)(unsigned int n, int mp_overhead);
+	bool (*edp_favor_down)(unsigned int n, int mp_overhead);
+};
+
+struct tegra3_balance_sample {
+	unsigned long highest_speed;
+	unsigned long avg_nr_run;	/* FSHIFT fixed point */
+	unsigned int nr_cpus;
+	unsigned int min_cpus;
+	unsigned int max_cpus;
+};
+
+struct tegra3_mp_state {
+	bool started;
+	u64 total_time;			/* ms */
+	u64 last_time;			/* ms */
+};
+
+int tegra3_cpu_speed_balance(const struct tegra3_balance_params *p,
+			     const struct tegra3_balance_sample *s,
+			     unsigned int *nr_run_last);
+int tegra3_mp_decision(struct tegra3_mp_state *st, const unsigned int *nwns,
+		       const unsigned int *twts, u64 now_ms,
+		       unsigned int rq_depth, unsigned int nr_cpu_online);
+
+#endif
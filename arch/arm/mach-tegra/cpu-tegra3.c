@@ -39,6 +39,7 @@
 
 #include "pm.h"
 #include "cpu-tegra.h"
+#include "cpu-tegra3-policy.h"
 #include "clock.h"
 
 #ifdef PWR_DEVICE_TAG
@@ -161,12 +162,6 @@ static void hp_stats_update(unsigned int cpu, bool up)
 }
 
 
-enum {
-	TEGRA_HP_DISABLED = 0,
-	TEGRA_HP_IDLE,
-	TEGRA_HP_DOWN,
-	TEGRA_HP_UP,
-};
 static int hp_state;
 static int mp_state;
 static int last_state;
@@ -269,72 +264,32 @@ static struct kernel_param_ops tegra_mp_policy_ops = {
 };
 module_param_cb(mp_policy, &tegra_mp_policy_ops, &mp_policy, 0644);
 
-enum {
-	TEGRA_CPU_SPEED_BALANCED,
-	TEGRA_CPU_SPEED_BIASED,
-	TEGRA_CPU_SPEED_SKEWED,
-};
-
-#ifdef CONFIG_TEGRA_RUNNABLE_THREAD
-#define NR_FSHIFT	2
-static unsigned int nr_run_thresholds[] = {
-/*      1,  2,  3,  4 - on-line cpus target */
-	5,  7, 9, UINT_MAX /* avg run threads * 4 (e.g., 9 = 2.25 threads) */
-};
-static unsigned int nr_run_hysteresis = 2;	/* 0.5 thread */
 static unsigned int nr_run_last;
-#endif
 
 static noinline int tegra_cpu_speed_balance(void)
 {
-	unsigned long highest_speed = tegra_cpu_highest_speed();
-	unsigned long balanced_speed = highest_speed * balance_level / 100;
-	unsigned long skewed_speed = balanced_speed / 2;
-	unsigned int nr_cpus = num_online_cpus();
-	unsigned int max_cpus = pm_qos_request(PM_QOS_MAX_ONLINE_CPUS) ? : 4;
-	unsigned int min_cpus = pm_qos_request(PM_QOS_MIN_ONLINE_CPUS);
-#ifdef CONFIG_TEGRA_RUNNABLE_THREAD
-	unsigned int avg_nr_run = avg_nr_running();
-	unsigned int nr_run;
-
-	/* Evaluate:
-	 * - distribution of freq targets for already on-lined CPUs
-	 * - average number of runnable threads
-	 * - effective MIPS available within EDP frequency limits,
-	 * and return:
-	 * TEGRA_CPU_SPEED_BALANCED to bring one more CPU core on-line
-	 * TEGRA_CPU_SPEED_BIASED to keep CPU core composition unchanged
-	 * TEGRA_CPU_SPEED_SKEWED to remove CPU core off-line
-	 */
-	for (nr_run = 1; nr_run < ARRAY_SIZE(nr_run_thresholds); nr_run++) {
-		unsigned int nr_threshold = nr_run_thresholds[nr_run - 1];
-		if (nr_run_last <= nr_run)
-			nr_threshold += nr_run_hysteresis;
-		if (avg_nr_run <= (nr_threshold << (FSHIFT - NR_FSHIFT)))
-			break;
-	}
-	nr_run_last = nr_run;
-#endif
-
-	if (((tegra_count_slow_cpus(skewed_speed) >= 2) ||
+	struct tegra3_balance_params params = {
+		.balance_level = balance_level,
+		.mp_overhead = mp_overhead,
+		.idle_bottom_freq = idle_bottom_freq,
 #ifdef CONFIG_TEGRA_RUNNABLE_THREAD
-	     (nr_run < nr_cpus) ||
+		.nr_run = true,
 #endif
-	     tegra_cpu_edp_favor_down(nr_cpus, mp_overhead) ||
-	     (highest_speed <= idle_bottom_freq) || (nr_cpus > max_cpus)) &&
-	    (nr_cpus > min_cpus))
-		return TEGRA_CPU_SPEED_SKEWED;
+		.count_slow_cpus = tegra_count_slow_cpus,
+		.edp_favor_up = tegra_cpu_edp_favor_up,
+		.edp_favor_down = tegra_cpu_edp_favor_down,
+	};
+	struct tegra3_balance_sample sample = {
+		.highest_speed = tegra_cpu_highest_speed(),
+		.nr_cpus = num_online_cpus(),
+		.max_cpus = pm_qos_request(PM_QOS_MAX_ONLINE_CPUS) ? : 4,
+		.min_cpus = pm_qos_request(PM_QOS_MIN_ONLINE_CPUS),
+	};
 
-	if (((tegra_count_slow_cpus(balanced_speed) >= 1) ||
 #ifdef CONFIG_TEGRA_RUNNABLE_THREAD
-	     (nr_run <= nr_cpus) ||
+	sample.avg_nr_run = avg_nr_running();
 #endif
-	     (!tegra_cpu_edp_favor_up(nr_cpus, mp_overhead)) ||
-	     (highest_speed <= idle_bottom_freq) || (nr_cpus == max_cpus)) &&
-	    (nr_cpus >= min_cpus))
-		return TEGRA_CPU_SPEED_BIASED;
-
-	return TEGRA_CPU_SPEED_BALANCED;
+	return tegra3_cpu_speed_balance(&params, &sample, &nr_run_last);
 }
 
 
@@ -538,52 +493,15 @@ static void tegra_auto_cpuplug_work_func(struct work_struct *work)
 
 static int mp_decision(void)
 {
-	static bool first_call = true;
-	int new_state = TEGRA_HP_IDLE;
-	int nr_cpu_online;
-	int index;
+	static struct tegra3_mp_state mp_decision_state;
 	unsigned int rq_depth;
-	static cputime64_t total_time = 0;
-	static cputime64_t last_time;
-	cputime64_t current_time;
-	cputime64_t this_time = 0;
-
-	current_time = ktime_to_ms(ktime_get());
-	if (first_call) {
-		first_call = false;
-	} else {
-		this_time = current_time - last_time;
-	}
-	total_time += this_time;
 
 	rq_depth = get_rq_info();
 	CPU_DEBUG_PRINTK(CPU_DEBUG_HOTPLUG, " rq_deptch = %u", rq_depth);
-	nr_cpu_online = num_online_cpus();
-
-	if (nr_cpu_online) {
-		index = (nr_cpu_online - 1) * 2;
-		if ((nr_cpu_online < 4) && (rq_depth >= NwNs_Threshold[index])) {
-			if (total_time >= TwTs_Threshold[index]) {
-				new_state = TEGRA_HP_UP;
-			}
-		} else if (rq_depth <= NwNs_Threshold[index+1]) {
-			if (total_time >= TwTs_Threshold[index+1] ) {
-				new_state = TEGRA_HP_DOWN;
-			}
-		} else {
-			total_time = 0;
-		}
-	} else {
-		total_time = 0;
-	}
-
-	if (new_state != TEGRA_HP_IDLE) {
-		total_time = 0;
-	}
-
-	last_time = ktime_to_ms(ktime_get());
 
-	return new_state;
+	return tegra3_mp_decision(&mp_decision_state, NwNs_Threshold,
+				  TwTs_Threshold, ktime_to_ms(ktime_get()),
+				  rq_depth, num_online_cpus());
 }
 
 void gcpu_plug(unsigned int cpu_freq)
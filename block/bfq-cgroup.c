@@ -67,6 +67,19 @@ static inline void bfq_group_init_entity(struct bfqio_cgroup *bgrp,
 	entity->my_sched_data = &bfqg->sched_data;
 }
 
+/*
+ * Is @bfqq in a group whose cgroup is marked as foreground?  Reading
+ * bfqg->foreground under the queue lock is enough, as it is only an
+ * (atomically updated) hint.
+ */
+static inline int bfq_bfqq_foreground(struct bfq_queue *bfqq)
+{
+	struct bfq_group *bfqg = container_of(bfqq->entity.sched_data,
+					      struct bfq_group, sched_data);
+
+	return bfqg->foreground;
+}
+
 static inline void bfq_group_set_parent(struct bfq_group *bfqg,
 					struct bfq_group *parent)
 {
@@ -114,6 +127,7 @@ static struct bfq_group *bfq_group_chain_alloc(struct bfq_data *bfqd,
 
 		bfq_group_init_entity(bgrp, bfqg);
 		bfqg->my_entity = &bfqg->entity;
+		bfqg->foreground = bgrp->foreground;
 
 		if (leaf == NULL) {
 			leaf = bfqg;
@@ -581,6 +595,7 @@ static struct bfq_group *bfq_alloc_root_group(struct bfq_data *bfqd, int node)
 
 	bgrp = &bfqio_root_cgroup;
 	spin_lock_irq(&bgrp->lock);
+	bfqg->foreground = bgrp->foreground;
 	rcu_assign_pointer(bfqg->bfqd, bfqd);
 	hlist_add_head_rcu(&bfqg->group_node, &bgrp->group_data);
 	spin_unlock_irq(&bgrp->lock);
@@ -611,6 +626,7 @@ static u64 bfqio_cgroup_##__VAR##_read(struct cgroup *cgroup,		\
 SHOW_FUNCTION(weight);
 SHOW_FUNCTION(ioprio);
 SHOW_FUNCTION(ioprio_class);
+SHOW_FUNCTION(foreground);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__VAR, __MIN, __MAX)				\
@@ -649,6 +665,37 @@ STORE_FUNCTION(ioprio, 0, IOPRIO_BE_NR - 1);
 STORE_FUNCTION(ioprio_class, IOPRIO_CLASS_RT, IOPRIO_CLASS_IDLE);
 #undef STORE_FUNCTION
 
+/*
+ * Unlike the other attributes, the foreground flag does not change the
+ * group entities: it is looked up by each queue when it gets new requests
+ * or is dispatched, see bfq_add_rq_rb() and update_raising_data().
+ */
+static int bfqio_cgroup_foreground_write(struct cgroup *cgroup,
+					 struct cftype *cftype, u64 val)
+{
+	struct bfqio_cgroup *bgrp;
+	struct bfq_group *bfqg;
+	struct hlist_node *n;
+
+	if (val > 1)
+		return -EINVAL;
+
+	if (!cgroup_lock_live_group(cgroup))
+		return -ENODEV;
+
+	bgrp = cgroup_to_bfqio(cgroup);
+
+	spin_lock_irq(&bgrp->lock);
+	bgrp->foreground = (unsigned short)val;
+	hlist_for_each_entry(bfqg, n, &bgrp->group_data, group_node)
+		bfqg->foreground = (int)val;
+	spin_unlock_irq(&bgrp->lock);
+
+	cgroup_unlock();
+
+	return 0;
+}
+
 static struct cftype bfqio_files[] = {
 	{
 		.name = "weight",
@@ -665,6 +712,11 @@ static struct cftype bfqio_files[] = {
 		.read_u64 = bfqio_cgroup_ioprio_class_read,
 		.write_u64 = bfqio_cgroup_ioprio_class_write,
 	},
+	{
+		.name = "foreground",
+		.read_u64 = bfqio_cgroup_foreground_read,
+		.write_u64 = bfqio_cgroup_foreground_write,
+	},
 };
 
 static int bfqio_populate(struct cgroup_subsys *subsys, struct cgroup *cgroup)
@@ -791,6 +843,11 @@ static inline void bfq_init_entity(struct bfq_entity *entity,
 	entity->sched_data = &bfqg->sched_data;
 }
 
+static inline int bfq_bfqq_foreground(struct bfq_queue *bfqq)
+{
+	return 0;
+}
+
 static inline struct bfq_group *
 bfq_cic_update_cgroup(struct cfq_io_context *cic)
 {
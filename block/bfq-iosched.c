@@ -417,6 +417,22 @@ static void bfq_updated_next_req(struct bfq_data *bfqd,
 	bfq_activate_bfqq(bfqd, bfqq);
 }
 
+/*
+ * Weight-raise a queue of a foreground cgroup, (re)starting a full
+ * interactive raising period.  The period is renewed as long as the
+ * queue stays in the foreground, see update_raising_data().
+ */
+static void bfq_fg_raise(struct bfq_data *bfqd, struct bfq_queue *bfqq)
+{
+	if (!bfq_bfqq_fg_raised(bfqq))
+		bfq_log_bfqq(bfqd, bfqq, "fg wrais starting at %llu msec",
+			     bfqq->last_rais_start_finish);
+	bfq_mark_bfqq_fg_raised(bfqq);
+	bfqq->raising_coeff = bfqd->bfq_raising_coeff;
+	bfqq->raising_cur_max_time = bfqd->bfq_raising_max_time;
+	bfqq->last_rais_start_finish = jiffies;
+}
+
 static void bfq_add_rq_rb(struct request *rq)
 {
 	struct bfq_queue *bfqq = RQ_BFQQ(rq);
@@ -462,10 +478,14 @@ static void bfq_add_rq_rb(struct request *rq)
 			goto add_bfqq_busy;
 
 		/*
-		 * If the queue is not being boosted and has been idle
-		 * for enough time, start a weight-raising period
+		 * Queues of foreground cgroups are always boosted; any
+		 * other queue is if it is not being boosted yet and has
+		 * been idle for enough time.
 		 */
-		if(old_raising_coeff == 1 && (idle_for_long_time || soft_rt)) {
+		if (bfq_bfqq_foreground(bfqq))
+			bfq_fg_raise(bfqd, bfqq);
+		else if (old_raising_coeff == 1 &&
+			 (idle_for_long_time || soft_rt)) {
 			bfqq->raising_coeff = bfqd->bfq_raising_coeff;
 			bfqq->raising_cur_max_time = idle_for_long_time ?
 				bfqd->bfq_raising_max_time :
@@ -497,7 +517,11 @@ static void bfq_add_rq_rb(struct request *rq)
 add_bfqq_busy:
 		bfq_add_bfqq_busy(bfqd, bfqq);
         } else {
-                if(bfqd->low_latency && old_raising_coeff == 1 &&
+		if (bfqd->low_latency && !bfq_bfqq_fg_raised(bfqq) &&
+		    bfq_bfqq_foreground(bfqq)) {
+			bfq_fg_raise(bfqd, bfqq);
+			entity->ioprio_changed = 1;
+		} else if(bfqd->low_latency && old_raising_coeff == 1 &&
 			!rq_is_sync(rq) &&
 			bfqq->last_rais_start_finish +
                         bfqd->bfq_raising_min_inter_arr_async < jiffies) {
@@ -1516,6 +1540,8 @@ static void update_raising_data(struct bfq_data *bfqd, struct bfq_queue *bfqq)
 {
 	if (bfqq->raising_coeff > 1) { /* queue is being boosted */
 		struct bfq_entity *entity = &bfqq->entity;
+		int fg_left = bfq_bfqq_fg_raised(bfqq) &&
+			!bfq_bfqq_foreground(bfqq);
 
 		bfq_log_bfqq(bfqd, bfqq,
 			"raising period dur %u/%u msec, "
@@ -1531,16 +1557,25 @@ static void update_raising_data(struct bfq_data *bfqd, struct bfq_queue *bfqq)
 		if(entity->ioprio_changed)
 			bfq_log_bfqq(bfqd, bfqq,
 			"WARN: pending prio change");
+		/*
+		 * Foreground queues keep their raising for as long as they
+		 * stay in the foreground, and lose it as soon as they leave.
+		 */
+		if (bfq_bfqq_fg_raised(bfqq) && !fg_left)
+			bfqq->last_rais_start_finish = jiffies;
+
 		/*
 		 * If too much time has elapsed from the beginning
 		 * of this weight-raising period and process is not soft
 		 * real-time, stop it
 		 */
-		if (jiffies - bfqq->last_rais_start_finish >
+		if (fg_left || jiffies - bfqq->last_rais_start_finish >
 			bfqq->raising_cur_max_time) {
-			int soft_rt = bfqd->bfq_raising_max_softrt_rate > 0 &&
+			int soft_rt = !fg_left &&
+				bfqd->bfq_raising_max_softrt_rate > 0 &&
 				bfqq->soft_rt_next_start < jiffies;
 
+			bfq_clear_bfqq_fg_raised(bfqq);
 			bfqq->last_rais_start_finish = jiffies;
 			if (soft_rt)
 				bfqq->raising_cur_max_time =
@@ -377,6 +377,7 @@ enum bfqq_state_flags {
 	BFQ_BFQQ_FLAG_coop,		/* bfqq is shared */
 	BFQ_BFQQ_FLAG_split_coop,	/* shared bfqq will be splitted */
 	BFQ_BFQQ_FLAG_some_coop_idle,   /* some cooperator is inactive */
+	BFQ_BFQQ_FLAG_fg_raised,	/* weight-raised for being foreground */
 };
 
 #define BFQ_BFQQ_FNS(name)						\
@@ -404,6 +405,7 @@ BFQ_BFQQ_FNS(budget_new);
 BFQ_BFQQ_FNS(coop);
 BFQ_BFQQ_FNS(split_coop);
 BFQ_BFQQ_FNS(some_coop_idle);
+BFQ_BFQQ_FNS(fg_raised);
 #undef BFQ_BFQQ_FNS
 
 /* Logging facilities. */
@@ -438,6 +440,7 @@ enum bfqq_expiration {
  * @async_idle_bfqq: async queue for the idle class (ioprio is ignored).
  * @my_entity: pointer to @entity, %NULL for the toplevel group; used
  *             to avoid too many special cases during group creation/migration.
+ * @foreground: copy of the owning cgroup's foreground flag.
  *
  * Each (device, cgroup) pair has its own bfq_group, i.e., for each cgroup
  * there is a set of bfq_groups, each one collecting the lower-level
@@ -463,6 +466,8 @@ struct bfq_group {
 	struct bfq_queue *async_idle_bfqq;
 
 	struct bfq_entity *my_entity;
+
+	int foreground;
 };
 
 /**
@@ -471,16 +476,20 @@ struct bfq_group {
  * @weight: cgroup weight.
  * @ioprio: cgroup ioprio.
  * @ioprio_class: cgroup ioprio_class.
- * @lock: spinlock that protects @ioprio, @ioprio_class and @group_data.
+ * @foreground: if set, the queues of the cgroup's tasks are weight-raised
+ *              whenever they have requests (with low_latency enabled).
+ * @lock: spinlock that protects @ioprio, @ioprio_class, @foreground and
+ *        @group_data.
  * @group_data: list containing the bfq_group belonging to this cgroup.
  *
  * @group_data is accessed using RCU, with @lock protecting the updates,
- * @ioprio and @ioprio_class are protected by @lock.
+ * @ioprio, @ioprio_class and @foreground are protected by @lock.
  */
 struct bfqio_cgroup {
 	struct cgroup_subsys_state css;
 
 	unsigned short weight, ioprio, ioprio_class;
+	unsigned short foreground;
 
 	spinlock_t lock;
 	struct hlist_head group_data;
@@ -13,6 +13,7 @@
 #include <linux/init.h>
 #include <linux/compiler.h>
 #include <linux/rbtree.h>
+#include <linux/ktime.h>
 
 /*
  * See Documentation/block/deadline-iosched.txt
@@ -23,10 +24,23 @@ static const int writes_starved = 4;    /* max times reads can starve a write */
 static const int fifo_batch = 1;       /* # of sequential requests treated as one
 				     by the above parameters. For throughput. */
 
+/*
+ * Per-direction completion latency, measured from the time a request is
+ * queued to the scheduler until the driver completes it.
+ */
+struct deadline_lat_stats {
+	unsigned long nr;		/* requests completed */
+	unsigned long avg_us;		/* moving average, 1/8 weight */
+	unsigned long max_us;		/* worst seen */
+};
+
+#define RQ_ADD_TIME(rq)		((rq)->elevator_private[0])
+
 struct deadline_data {
 	/*
 	 * run time data
 	 */
+	struct request_queue *queue;
 
 	/*
 	 * requests (deadline_rq s) are present on both sort_list and fifo_list
@@ -38,17 +52,20 @@ struct deadline_data {
 	 * next in sort order. read, write or both are NULL
 	 */
 	struct request *next_rq[2];
-	unsigned int batching;		/* number of sequential requests made */
+	unsigned int batching;		/* requests or sectors batched */
 	sector_t last_sector;		/* head position */
 	unsigned int starved;		/* times reads have starved writes */
+	struct deadline_lat_stats lat[2];
 
 	/*
 	 * settings that change how the i/o scheduler behaves
 	 */
 	int fifo_expire[2];
 	int fifo_batch;
+	int fifo_batch_sectors;		/* if set, limits batches in sectors */
 	int writes_starved;
 	int front_merges;
+	int write_align_sectors;	/* erase block size for write merges */
 };
 
 static void deadline_move_request(struct deadline_data *, struct request *);
@@ -94,6 +111,11 @@ deadline_del_rq_rb(struct deadline_data *dd, struct request *rq)
 	elv_rb_del(deadline_rb_root(dd, rq), rq);
 }
 
+static inline unsigned long deadline_now_us(void)
+{
+	return (unsigned long)ktime_to_us(ktime_get());
+}
+
 /*
  * add rq to rbtree and fifo
  */
@@ -104,6 +126,7 @@ deadline_add_request(struct request_queue *q, struct request *rq)
 	const int data_dir = rq_data_dir(rq);
 
 	deadline_add_rq_rb(dd, rq);
+	RQ_ADD_TIME(rq) = (void *)deadline_now_us();
 
 	/*
 	 * set expire time and add to fifo list
@@ -153,6 +176,30 @@ out:
 	return ret;
 }
 
+/*
+ * With write_align_sectors set, writes are only merged up to erase block
+ * boundaries: a bio that would join a request exactly at a boundary is
+ * kept apart. Sequential writeback then reaches the device as requests
+ * ending on erase block boundaries, so the card can program whole blocks
+ * instead of splitting one write across two of them.
+ */
+static int deadline_allow_merge(struct request_queue *q, struct request *rq,
+				struct bio *bio)
+{
+	struct deadline_data *dd = q->elevator->elevator_data;
+	sector_t junction;
+
+	if (!dd->write_align_sectors || bio_data_dir(bio) != WRITE)
+		return 1;
+
+	if (rq_end_sector(rq) == bio->bi_sector)
+		junction = bio->bi_sector;
+	else
+		junction = blk_rq_pos(rq);
+
+	return sector_div(junction, dd->write_align_sectors) != 0;
+}
+
 static void deadline_merged_request(struct request_queue *q,
 				    struct request *req, int type)
 {
@@ -238,6 +285,20 @@ static inline int deadline_check_fifo(struct deadline_data *dd, int ddir)
 	return 0;
 }
 
+/*
+ * fifo_batch_sectors, if set, replaces fifo_batch so that a batch ends
+ * after a given amount of data rather than a number of requests. A single
+ * large write then closes its batch by itself and cannot hold off reads
+ * for fifo_batch requests of the same size.
+ */
+static inline int deadline_batch_left(struct deadline_data *dd)
+{
+	if (dd->fifo_batch_sectors)
+		return dd->batching < dd->fifo_batch_sectors;
+
+	return dd->batching < dd->fifo_batch;
+}
+
 /*
  * deadline_dispatch_requests selects the best request according to
  * read/write expire, fifo_batch, etc
@@ -258,7 +319,7 @@ static int deadline_dispatch_requests(struct request_queue *q, int force)
 	else
 		rq = dd->next_rq[READ];
 
-	if (rq && dd->batching < dd->fifo_batch)
+	if (rq && deadline_batch_left(dd))
 		/* we have a next request are still entitled to batch */
 		goto dispatch_request;
 
@@ -320,12 +381,27 @@ dispatch_request:
 	/*
 	 * rq is the selected appropriate request.
 	 */
-	dd->batching++;
+	dd->batching += dd->fifo_batch_sectors ? blk_rq_sectors(rq) : 1;
 	deadline_move_request(dd, rq);
 
 	return 1;
 }
 
+static void deadline_completed_request(struct request_queue *q,
+				       struct request *rq)
+{
+	struct deadline_data *dd = q->elevator->elevator_data;
+	struct deadline_lat_stats *lat = &dd->lat[rq_data_dir(rq)];
+	unsigned long us = deadline_now_us() - (unsigned long)RQ_ADD_TIME(rq);
+
+	if (!lat->nr++)
+		lat->avg_us = us;
+	else
+		lat->avg_us = (lat->avg_us * 7 + us) / 8;
+	if (us > lat->max_us)
+		lat->max_us = us;
+}
+
 static void deadline_exit_queue(struct elevator_queue *e)
 {
 	struct deadline_data *dd = e->elevator_data;
@@ -347,6 +423,7 @@ static void *deadline_init_queue(struct request_queue *q)
 	if (!dd)
 		return NULL;
 
+	dd->queue = q;
 	INIT_LIST_HEAD(&dd->fifo_list[READ]);
 	INIT_LIST_HEAD(&dd->fifo_list[WRITE]);
 	dd->sort_list[READ] = RB_ROOT;
@@ -356,6 +433,8 @@ static void *deadline_init_queue(struct request_queue *q)
 	dd->writes_starved = writes_starved;
 	dd->front_merges = 0;
 	dd->fifo_batch = fifo_batch;
+	dd->fifo_batch_sectors = 0;
+	dd->write_align_sectors = 0;
 	return dd;
 }
 
@@ -392,6 +471,8 @@ SHOW_FUNCTION(deadline_write_expire_show, dd->fifo_expire[WRITE], 1);
 SHOW_FUNCTION(deadline_writes_starved_show, dd->writes_starved, 0);
 SHOW_FUNCTION(deadline_front_merges_show, dd->front_merges, 0);
 SHOW_FUNCTION(deadline_fifo_batch_show, dd->fifo_batch, 0);
+SHOW_FUNCTION(deadline_fifo_batch_sectors_show, dd->fifo_batch_sectors, 0);
+SHOW_FUNCTION(deadline_write_align_sectors_show, dd->write_align_sectors, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -415,8 +496,54 @@ STORE_FUNCTION(deadline_write_expire_store, &dd->fifo_expire[WRITE], 0, INT_MAX,
 STORE_FUNCTION(deadline_writes_starved_store, &dd->writes_starved, INT_MIN, INT_MAX, 0);
 STORE_FUNCTION(deadline_front_merges_store, &dd->front_merges, 0, 1, 0);
 STORE_FUNCTION(deadline_fifo_batch_store, &dd->fifo_batch, 0, INT_MAX, 0);
+STORE_FUNCTION(deadline_fifo_batch_sectors_store, &dd->fifo_batch_sectors, 0, INT_MAX, 0);
+STORE_FUNCTION(deadline_write_align_sectors_store, &dd->write_align_sectors, 0, INT_MAX, 0);
 #undef STORE_FUNCTION
 
+/*
+ * read_lat and write_lat report "completed avg_us max_us" for their
+ * direction. Writing anything resets the counters.
+ */
+static ssize_t
+deadline_lat_show(struct elevator_queue *e, char *page, int data_dir)
+{
+	struct deadline_data *dd = e->elevator_data;
+	struct deadline_lat_stats lat;
+
+	spin_lock_irq(dd->queue->queue_lock);
+	lat = dd->lat[data_dir];
+	spin_unlock_irq(dd->queue->queue_lock);
+
+	return sprintf(page, "%lu %lu %lu\n", lat.nr, lat.avg_us, lat.max_us);
+}
+
+static ssize_t
+deadline_lat_store(struct elevator_queue *e, size_t count, int data_dir)
+{
+	struct deadline_data *dd = e->elevator_data;
+
+	spin_lock_irq(dd->queue->queue_lock);
+	memset(&dd->lat[data_dir], 0, sizeof(dd->lat[data_dir]));
+	spin_unlock_irq(dd->queue->queue_lock);
+
+	return count;
+}
+
+#define LAT_FUNCTIONS(__name, __dir)					\
+static ssize_t deadline_##__name##_show(struct elevator_queue *e,	\
+					char *page)			\
+{									\
+	return deadline_lat_show(e, page, __dir);			\
+}									\
+static ssize_t deadline_##__name##_store(struct elevator_queue *e,	\
+					 const char *page, size_t count)\
+{									\
+	return deadline_lat_store(e, count, __dir);			\
+}
+LAT_FUNCTIONS(read_lat, READ);
+LAT_FUNCTIONS(write_lat, WRITE);
+#undef LAT_FUNCTIONS
+
 #define DD_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, deadline_##name##_show, \
 				      deadline_##name##_store)
@@ -427,16 +554,22 @@ static struct elv_fs_entry deadline_attrs[] = {
 	DD_ATTR(writes_starved),
 	DD_ATTR(front_merges),
 	DD_ATTR(fifo_batch),
+	DD_ATTR(fifo_batch_sectors),
+	DD_ATTR(write_align_sectors),
+	DD_ATTR(read_lat),
+	DD_ATTR(write_lat),
 	__ATTR_NULL
 };
 
 static struct elevator_type iosched_deadline = {
 	.ops = {
 		.elevator_merge_fn = 		deadline_merge,
+		.elevator_allow_merge_fn =	deadline_allow_merge,
 		.elevator_merged_fn =		deadline_merged_request,
 		.elevator_merge_req_fn =	deadline_merged_requests,
 		.elevator_dispatch_fn =		deadline_dispatch_requests,
 		.elevator_add_req_fn =		deadline_add_request,
+		.elevator_completed_req_fn =	deadline_completed_request,
 		.elevator_former_req_fn =	elv_rb_former_request,
 		.elevator_latter_req_fn =	elv_rb_latter_request,
 		.elevator_init_fn =		deadline_init_queue,
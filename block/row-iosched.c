@@ -26,6 +26,7 @@
 #include <linux/compiler.h>
 #include <linux/blktrace_api.h>
 #include <linux/jiffies.h>
+#include <linux/ktime.h>
 
 /*
  * enum row_queue_prio - Priorities of the ROW queues
@@ -73,6 +74,18 @@ static const int queue_quantum[] = {
 #define ROW_IDLE_TIME 50	/* 5 msec */
 #define ROW_READ_FREQ 70	/* 7 msec */
 
+/*
+ * Read latency target. While the READ queues' measured latency is above it,
+ * their quanta are doubled and the WRITE queues' halved, up to
+ * ROW_MAX_READ_BOOST times, re-evaluated every ROW_ADAPT_INTERVAL msec.
+ */
+#define ROW_READ_LAT_TARGET	0	/* usec, 0 disables adaptation */
+#define ROW_MAX_READ_BOOST	4
+#define ROW_ADAPT_INTERVAL	100	/* msec */
+
+/* Completion latencies are averaged with a weight of 1/8 for new samples */
+#define ROW_LAT_EWMA_SHIFT	3
+
 /**
  * struct rowq_idling_data -  parameters for idling on the queue
  * @idle_trigger_time:	time (in jiffies). If a new request was
@@ -95,6 +108,8 @@ struct rowq_idling_data {
  *			the current dispatch cycle
  * @slice:		number of requests to dispatch in a cycle
  * @idle_data:		data for idling on queues
+ * @lat_us:		moving average of the dispatch to completion time
+ *			of this queue's requests (usec)
  *
  */
 struct row_queue {
@@ -107,6 +122,8 @@ struct row_queue {
 
 	/* used only for READ queues */
 	struct rowq_idling_data	idle_data;
+
+	unsigned long		lat_us;
 };
 
 /**
@@ -136,6 +153,10 @@ struct idling_data {
  *			scheduler, nr_reqs[1] holds the number of all WRITE
  *			requests in scheduler
  * @cycle_flags:	used for marking unserved queueus
+ * @read_lat_target:	READ queues latency target (usec), 0 if none
+ * @read_boost:		log2 of how much the READ queues quanta are
+ *			currently scaled up and the WRITE queues scaled down
+ * @next_adapt:		time (in jiffies) of the next read_boost update
  *
  */
 struct row_data {
@@ -152,9 +173,15 @@ struct row_data {
 	unsigned int			nr_reqs[2];
 
 	unsigned int			cycle_flags;
+
+	int				read_lat_target;
+	unsigned int			read_boost;
+	unsigned long			next_adapt;
 };
 
 #define RQ_ROWQ(rq) ((struct row_queue *) ((rq)->elevator_private[0]))
+/* time the request was dispatched, in usec */
+#define RQ_DISP_TIME(rq) ((rq)->elevator_private[1])
 
 #define row_log(q, fmt, args...)   \
 	blk_add_trace_msg(q, "%s():" fmt , __func__, ##args)
@@ -180,6 +207,34 @@ static inline int row_rowq_unserved(struct row_data *rd,
 	return rd->cycle_flags & (1 << qnum);
 }
 
+static inline unsigned long row_now_us(void)
+{
+	return (unsigned long)ktime_to_us(ktime_get());
+}
+
+static inline bool row_rowq_boosted(enum row_queue_prio qnum)
+{
+	return qnum == ROWQ_PRIO_HIGH_READ || qnum == ROWQ_PRIO_REG_READ;
+}
+
+/*
+ * row_rowq_quantum() - dispatch quantum of a queue, after adaptation
+ * @rd:		pointer to struct row_data
+ * @qnum:	queue to get the quantum of
+ *
+ */
+static int row_rowq_quantum(struct row_data *rd, enum row_queue_prio qnum)
+{
+	int quantum = rd->row_queues[qnum].disp_quantum;
+	unsigned int boost = rd->read_lat_target ? rd->read_boost : 0;
+
+	if (row_rowq_boosted(qnum))
+		return quantum > (INT_MAX >> boost) ? INT_MAX :
+			quantum << boost;
+
+	return quantum ? max(quantum >> boost, 1) : 0;
+}
+
 /******************** Static helper functions ***********************/
 /*
  * kick_queue() - Wake up device driver queue thread
@@ -301,6 +356,7 @@ static void row_dispatch_insert(struct row_data *rd)
 	rq = rq_entry_fifo(rd->row_queues[rd->curr_queue].rqueue.fifo.next);
 	row_remove_request(rd->dispatch_queue, rq);
 	elv_dispatch_add_tail(rd->dispatch_queue, rq);
+	RQ_DISP_TIME(rq) = (void *)row_now_us();
 	rd->row_queues[rd->curr_queue].rqueue.nr_dispatched++;
 	row_clear_rowq_unserved(rd, rd->curr_queue);
 	row_log_rowq(rd, rd->curr_queue, " Dispatched request nr_disp = %d",
@@ -373,7 +429,7 @@ static int row_dispatch_requests(struct request_queue *q, int force)
 	}
 
 	if (rd->row_queues[currq].rqueue.nr_dispatched >=
-	    rd->row_queues[currq].disp_quantum) {
+	    row_rowq_quantum(rd, currq)) {
 		rd->row_queues[currq].rqueue.nr_dispatched = 0;
 		row_log_rowq(rd, currq, "Expiring rqueue");
 		ret = row_choose_queue(rd);
@@ -460,6 +516,10 @@ static void *row_init_queue(struct request_queue *q)
 
 	rdata->nr_reqs[READ] = rdata->nr_reqs[WRITE] = 0;
 
+	rdata->read_lat_target = ROW_READ_LAT_TARGET;
+	rdata->read_boost = 0;
+	rdata->next_adapt = jiffies;
+
 	return rdata;
 }
 
@@ -495,6 +555,58 @@ static void row_merged_requests(struct request_queue *q, struct request *rq,
 	rqueue->rdata->nr_reqs[rq_data_dir(rq)]--;
 }
 
+/*
+ * row_adapt_quantum() - Move read_boost towards holding the latency target
+ * @rd:	pointer to struct row_data
+ *
+ * Boost reads while either READ queue is slower than the target, and back
+ * off again once both are comfortably (2x) below it.
+ *
+ */
+static void row_adapt_quantum(struct row_data *rd)
+{
+	unsigned long lat = max(
+		rd->row_queues[ROWQ_PRIO_HIGH_READ].rqueue.lat_us,
+		rd->row_queues[ROWQ_PRIO_REG_READ].rqueue.lat_us);
+
+	if (lat > rd->read_lat_target) {
+		if (rd->read_boost < ROW_MAX_READ_BOOST)
+			rd->read_boost++;
+	} else if (lat < rd->read_lat_target / 2) {
+		if (rd->read_boost)
+			rd->read_boost--;
+	}
+	row_log(rd->dispatch_queue, "read lat %luus boost %u",
+		lat, rd->read_boost);
+
+	rd->next_adapt = jiffies + msecs_to_jiffies(ROW_ADAPT_INTERVAL);
+}
+
+/*
+ * row_completed_request() - Called when a request has completed
+ * @q:		requests queue
+ * @rq:		request that completed
+ *
+ */
+static void row_completed_request(struct request_queue *q,
+				  struct request *rq)
+{
+	struct row_data *rd = (struct row_data *)q->elevator->elevator_data;
+	struct row_queue *rqueue = RQ_ROWQ(rq);
+	unsigned long lat = row_now_us() - (unsigned long)RQ_DISP_TIME(rq);
+
+	if (!rqueue->lat_us)
+		rqueue->lat_us = lat;
+	else
+		rqueue->lat_us = (rqueue->lat_us *
+				  ((1 << ROW_LAT_EWMA_SHIFT) - 1) + lat) >>
+				 ROW_LAT_EWMA_SHIFT;
+
+	if (rd->read_lat_target && row_rowq_boosted(rqueue->prio) &&
+	    time_after_eq(jiffies, rd->next_adapt))
+		row_adapt_quantum(rd);
+}
+
 /*
  * get_queue_type() - Get queue type for a given request
  *
@@ -578,6 +690,22 @@ SHOW_FUNCTION(row_lp_swrite_quantum_show,
 	rowd->row_queues[ROWQ_PRIO_LOW_SWRITE].disp_quantum, 0);
 SHOW_FUNCTION(row_read_idle_show, rowd->read_idle.idle_time, 1);
 SHOW_FUNCTION(row_read_idle_freq_show, rowd->read_idle.freq, 1);
+SHOW_FUNCTION(row_read_lat_target_show, rowd->read_lat_target, 0);
+SHOW_FUNCTION(row_read_boost_show, rowd->read_boost, 0);
+SHOW_FUNCTION(row_hp_read_lat_show,
+	rowd->row_queues[ROWQ_PRIO_HIGH_READ].rqueue.lat_us, 0);
+SHOW_FUNCTION(row_rp_read_lat_show,
+	rowd->row_queues[ROWQ_PRIO_REG_READ].rqueue.lat_us, 0);
+SHOW_FUNCTION(row_hp_swrite_lat_show,
+	rowd->row_queues[ROWQ_PRIO_HIGH_SWRITE].rqueue.lat_us, 0);
+SHOW_FUNCTION(row_rp_swrite_lat_show,
+	rowd->row_queues[ROWQ_PRIO_REG_SWRITE].rqueue.lat_us, 0);
+SHOW_FUNCTION(row_rp_write_lat_show,
+	rowd->row_queues[ROWQ_PRIO_REG_WRITE].rqueue.lat_us, 0);
+SHOW_FUNCTION(row_lp_read_lat_show,
+	rowd->row_queues[ROWQ_PRIO_LOW_READ].rqueue.lat_us, 0);
+SHOW_FUNCTION(row_lp_swrite_lat_show,
+	rowd->row_queues[ROWQ_PRIO_LOW_SWRITE].rqueue.lat_us, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -620,12 +748,16 @@ STORE_FUNCTION(row_lp_swrite_quantum_store,
 STORE_FUNCTION(row_read_idle_store, &rowd->read_idle.idle_time, 1, INT_MAX, 1);
 STORE_FUNCTION(row_read_idle_freq_store, &rowd->read_idle.freq,
 				1, INT_MAX, 1);
+STORE_FUNCTION(row_read_lat_target_store, &rowd->read_lat_target, 0,
+		INT_MAX, 0);
 
 #undef STORE_FUNCTION
 
 #define ROW_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, \
 				      row_##name##_store)
+#define ROW_ATTR_RO(name) \
+	__ATTR(name, S_IRUGO, row_##name##_show, NULL)
 
 static struct elv_fs_entry row_attrs[] = {
 	ROW_ATTR(hp_read_quantum),
@@ -637,6 +769,15 @@ static struct elv_fs_entry row_attrs[] = {
 	ROW_ATTR(lp_swrite_quantum),
 	ROW_ATTR(read_idle),
 	ROW_ATTR(read_idle_freq),
+	ROW_ATTR(read_lat_target),
+	ROW_ATTR_RO(read_boost),
+	ROW_ATTR_RO(hp_read_lat),
+	ROW_ATTR_RO(rp_read_lat),
+	ROW_ATTR_RO(hp_swrite_lat),
+	ROW_ATTR_RO(rp_swrite_lat),
+	ROW_ATTR_RO(rp_write_lat),
+	ROW_ATTR_RO(lp_read_lat),
+	ROW_ATTR_RO(lp_swrite_lat),
 	__ATTR_NULL
 };
 
@@ -648,6 +789,7 @@ static struct elevator_type iosched_row = {
 		.elevator_former_req_fn		= elv_rb_former_request,
 		.elevator_latter_req_fn		= elv_rb_latter_request,
 		.elevator_set_req_fn		= row_set_request,
+		.elevator_completed_req_fn	= row_completed_request,
 		.elevator_init_fn		= row_init_queue,
 		.elevator_exit_fn		= row_exit_queue,
 	},
@@ -30,6 +30,7 @@
 #include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/input.h>
+#include <linux/math64.h>
 #include <asm/cputime.h>
 #include <linux/pm_qos_params.h>
 
@@ -55,6 +56,19 @@ struct cpufreq_interactive_cpuinfo {
 	unsigned int floor_freq;
 	u64 floor_validate_time;
 	int governor_enabled;
+	/* scheduler driven sampling, see cpufreq_interactive_sched_update() */
+	spinlock_t load_lock;
+	int busy;
+	int window_evaluated;
+	u64 window_start;
+	u64 busy_since;
+	u64 busy_time;
+	/* only used in the entry of policy->cpu */
+	spinlock_t policy_lock;
+	u64 policy_eval_time;
+	/* last decision, for trace_cpufreq_interactive_latency() */
+	u64 decide_time;
+	u64 sample_us;
 };
 
 static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
@@ -124,6 +138,26 @@ static unsigned long min_sample_time;
 #define DEFAULT_TIMER_RATE 20000;
 static unsigned long timer_rate;
 
+/*
+ * Non-zero to have the scheduler push load updates (enqueue, dequeue and
+ * tick) rather than sampling busy CPUs with timer_rate timers.
+ */
+static unsigned long sched_driven;
+static DEFINE_MUTEX(sched_driven_lock);
+
+/*
+ * The minimum time between two scheduler driven evaluations of a policy.
+ */
+#define DEFAULT_SCHED_RATE_LIMIT 5000
+static unsigned long sched_rate_limit;
+
+/*
+ * Non-zero to take the load the queued tasks bring along (cpu_task_load())
+ * as the least short-term load, so that a task migrating in is run at its
+ * speed before its busy time shows on the new CPU.
+ */
+static unsigned long task_load_hint = 1;
+
 /* Defines to control mid-range frequencies */
 #define DEFAULT_MID_RANGE_GO_MAXSPEED_LOAD 95
 
@@ -253,6 +287,273 @@ static inline cputime64_t get_cpu_iowait_time(
 	return iowait_time;
 }
 
+/* Load of @cpu since its last speed change, as of pcpu->timer_run_time */
+static int cpufreq_interactive_load_since_change(unsigned int cpu,
+		struct cpufreq_interactive_cpuinfo *pcpu,
+		u64 now_idle, u64 now_iowait)
+{
+	unsigned int delta_idle;
+	unsigned int delta_iowait;
+	unsigned int delta_time;
+
+	delta_idle = (unsigned int) cputime64_sub(now_idle,
+						pcpu->freq_change_time_in_idle);
+	delta_iowait = (unsigned int) cputime64_sub(now_iowait,
+					pcpu->freq_change_time_in_iowait);
+	delta_time = (unsigned int) cputime64_sub(pcpu->timer_run_time,
+						  pcpu->freq_change_time);
+
+	if ((delta_time == 0) || (delta_idle > delta_time))
+		return 0;
+
+	if (io_is_busy && delta_idle >= delta_iowait)
+		delta_idle -= delta_iowait;
+
+	return 100 * (delta_time - delta_idle) / delta_time;
+}
+
+/*
+ * Combine short-term load (since @sample_start) and long-term load (since
+ * last frequency change) to determine the new target frequency of @cpu
+ * as of pcpu->timer_run_time, and hand a change over to the up task or
+ * the down work. Returns 0 if the decision has to be retried later.
+ *
+ * This function implements the cpufreq scaling policy
+ */
+static int cpufreq_interactive_evaluate(unsigned int cpu,
+		struct cpufreq_interactive_cpuinfo *pcpu,
+		int cpu_load, int load_since_change, u64 sample_start)
+{
+	unsigned int new_freq;
+	unsigned int index;
+	unsigned long flags;
+	unsigned long task_load;
+
+	if (task_load_hint) {
+		task_load = (cpu_task_load(cpu) * 100) >> TASK_LOAD_SHIFT;
+		if (task_load > cpu_load)
+			cpu_load = min(task_load, 100UL);
+	}
+
+	new_freq = cpufreq_interactive_get_target(cpu_load, load_since_change,
+						pcpu);
+
+	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
+					   new_freq, CPUFREQ_RELATION_H,
+					   &index)) {
+		pr_warn_once("timer %d: cpufreq_frequency_table_target error\n",
+			     (int) cpu);
+		return 0;
+	}
+
+	new_freq = pcpu->freq_table[index].frequency;
+
+	/*
+	 * Do not scale below floor_freq unless we have been at or above the
+	 * floor frequency for the minimum sample time since last validated.
+	 */
+	if (new_freq < pcpu->floor_freq) {
+		if (cputime64_sub(pcpu->timer_run_time,
+				  pcpu->floor_validate_time)
+		    < min_sample_time) {
+
+			trace_cpufreq_interactive_notyet(cpu, cpu_load,
+					pcpu->target_freq, new_freq);
+			return 0;
+		}
+	}
+
+	pcpu->floor_freq = new_freq;
+	pcpu->floor_validate_time = pcpu->timer_run_time;
+
+	if (pcpu->target_freq == new_freq) {
+		trace_cpufreq_interactive_already(cpu, cpu_load,
+				pcpu->target_freq, new_freq);
+		return 1;
+	}
+
+	trace_cpufreq_interactive_target(cpu, cpu_load, pcpu->target_freq,
+					new_freq);
+
+	pcpu->sample_us = cputime64_sub(pcpu->timer_run_time, sample_start);
+	pcpu->decide_time = pcpu->timer_run_time;
+
+	if (new_freq < pcpu->target_freq) {
+		pcpu->target_freq = new_freq;
+		spin_lock_irqsave(&down_cpumask_lock, flags);
+		cpumask_set_cpu(cpu, &down_cpumask);
+		spin_unlock_irqrestore(&down_cpumask_lock, flags);
+		queue_work(down_wq, &freq_scale_down_work);
+	} else {
+		pcpu->target_freq = new_freq;
+		spin_lock_irqsave(&up_cpumask_lock, flags);
+		cpumask_set_cpu(cpu, &up_cpumask);
+		spin_unlock_irqrestore(&up_cpumask_lock, flags);
+		wake_up_process(up_task);
+	}
+
+	return 1;
+}
+
+/*
+ * Scheduler driven mode: enqueue and dequeue account for how long each
+ * CPU had runnable tasks, and the tick evaluates all CPUs of the ticking
+ * CPU's policy, at most once every sched_rate_limit. The first enqueue
+ * after an evaluation starts a new sample, so that a burst after idle is
+ * acted upon at the first tick that sees it rather than after a whole
+ * timer_rate sample.
+ */
+static void cpufreq_interactive_sched_reset(unsigned int cpu, u64 now)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, cpu);
+	unsigned long flags;
+
+	spin_lock_irqsave(&pcpu->load_lock, flags);
+	pcpu->busy = nr_running_cpu(cpu) != 0;
+	pcpu->busy_since = pcpu->busy ? now : 0;
+	pcpu->busy_time = 0;
+	pcpu->window_start = now;
+	pcpu->window_evaluated = 0;
+	pcpu->policy_eval_time = 0;
+	spin_unlock_irqrestore(&pcpu->load_lock, flags);
+}
+
+/* Called with the runqueue of @cpu locked */
+static void cpufreq_interactive_sched_account(unsigned int cpu)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, cpu);
+	int busy = nr_running_cpu(cpu) != 0;
+	u64 now;
+
+	if (busy == pcpu->busy)
+		return;
+
+	now = ktime_to_us(ktime_get());
+	spin_lock(&pcpu->load_lock);
+	pcpu->busy = busy;
+
+	if (!busy) {
+		if (now > pcpu->busy_since)
+			pcpu->busy_time += now - pcpu->busy_since;
+		pcpu->busy_since = 0;
+	} else {
+		if (pcpu->window_evaluated) {
+			pcpu->window_start = now;
+			pcpu->busy_time = 0;
+			pcpu->window_evaluated = 0;
+		}
+		pcpu->busy_since = now;
+	}
+
+	spin_unlock(&pcpu->load_lock);
+}
+
+static void cpufreq_interactive_sched_update(unsigned int cpu)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, cpu);
+	u64 now_idle;
+	u64 now_iowait;
+	u64 now;
+	u64 window_start;
+	u64 busy;
+	unsigned long flags;
+	int cpu_load;
+
+	if (!pcpu->governor_enabled)
+		return;
+
+	now_idle = get_cpu_idle_time_us(cpu, &pcpu->timer_run_time);
+	now_iowait = get_cpu_iowait_time(cpu, NULL);
+	now = pcpu->timer_run_time;
+
+	spin_lock_irqsave(&pcpu->load_lock, flags);
+	window_start = pcpu->window_start;
+
+	/* As with the timer, a sample under 1ms is too short to judge. */
+	if (now < window_start + 1000) {
+		spin_unlock_irqrestore(&pcpu->load_lock, flags);
+		return;
+	}
+
+	busy = pcpu->busy_time;
+	if (pcpu->busy_since) {
+		if (now > pcpu->busy_since)
+			busy += now - pcpu->busy_since;
+		pcpu->busy_since = now;
+	}
+	pcpu->busy_time = 0;
+	pcpu->window_start = now;
+	pcpu->window_evaluated = 1;
+	spin_unlock_irqrestore(&pcpu->load_lock, flags);
+
+	if (busy >= now - window_start)
+		cpu_load = 100;
+	else
+		cpu_load = div64_u64(100 * busy, now - window_start);
+
+	cpufreq_interactive_evaluate(cpu, pcpu, cpu_load,
+		cpufreq_interactive_load_since_change(cpu, pcpu, now_idle,
+						      now_iowait),
+		window_start);
+}
+
+static void cpufreq_interactive_sched_eval(unsigned int cpu)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, cpu);
+	struct cpufreq_interactive_cpuinfo *ppol;
+	struct cpufreq_policy *policy;
+	unsigned long flags;
+	unsigned int j;
+	u64 now;
+
+	smp_rmb();
+
+	if (!pcpu->governor_enabled)
+		return;
+
+	policy = pcpu->policy;
+	ppol = &per_cpu(cpuinfo, policy->cpu);
+
+	/* Whichever CPU gets here first evaluates the whole policy. */
+	if (!spin_trylock_irqsave(&ppol->policy_lock, flags))
+		return;
+
+	now = ktime_to_us(ktime_get());
+	if (now - ppol->policy_eval_time >= sched_rate_limit) {
+		ppol->policy_eval_time = now;
+		for_each_cpu(j, policy->cpus)
+			cpufreq_interactive_sched_update(j);
+	}
+
+	spin_unlock_irqrestore(&ppol->policy_lock, flags);
+}
+
+static int cpufreq_interactive_sched_notifier(struct notifier_block *nb,
+					      unsigned long event,
+					      void *data)
+{
+	unsigned int cpu = (long)data;
+
+	if (!per_cpu(cpuinfo, cpu).governor_enabled)
+		return NOTIFY_DONE;
+
+	switch (event) {
+	case SCHED_LOAD_ENQUEUE:
+	case SCHED_LOAD_DEQUEUE:
+		cpufreq_interactive_sched_account(cpu);
+		break;
+	case SCHED_LOAD_TICK:
+		cpufreq_interactive_sched_eval(cpu);
+		break;
+	}
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block cpufreq_interactive_sched_nb = {
+	.notifier_call = cpufreq_interactive_sched_notifier,
+};
+
 static void cpufreq_interactive_timer(unsigned long data)
 {
 	unsigned int delta_idle;
@@ -267,15 +568,28 @@ static void cpufreq_interactive_timer(unsigned long data)
 		&per_cpu(cpuinfo, data);
 	u64 now_idle;
 	u64 now_iowait;
-	unsigned int new_freq;
-	unsigned int index;
-	unsigned long flags;
 
 	smp_rmb();
 
 	if (!pcpu->governor_enabled)
 		goto exit;
 
+	if (sched_driven) {
+		cpufreq_interactive_sched_eval(data);
+
+		/*
+		 * Busy CPUs get evaluated from the tick; keep the timer
+		 * only while this one idles above min.
+		 */
+		smp_rmb();
+		if (pcpu->idling &&
+		    pcpu->target_freq != pcpu->policy->min &&
+		    !timer_pending(&pcpu->cpu_timer))
+			mod_timer(&pcpu->cpu_timer,
+				  jiffies + usecs_to_jiffies(timer_rate));
+		goto exit;
+	}
+
 	/*
 	 * Once pcpu->timer_run_time is updated to >= pcpu->idle_exit_time,
 	 * this lets idle exit know the current idle time sample has
@@ -316,85 +630,13 @@ static void cpufreq_interactive_timer(unsigned long data)
 		cpu_load = 100 * (delta_time - delta_idle) / delta_time;
 	}
 
-	delta_idle = (unsigned int) cputime64_sub(now_idle,
-						pcpu->freq_change_time_in_idle);
-	delta_iowait = (unsigned int) cputime64_sub(now_iowait,
-					pcpu->freq_change_time_in_iowait);
-	delta_time = (unsigned int) cputime64_sub(pcpu->timer_run_time,
-						  pcpu->freq_change_time);
-
-	if ((delta_time == 0) || (delta_idle > delta_time))
-		load_since_change = 0;
-	else {
-		if (io_is_busy && delta_idle >= delta_iowait)
-			delta_idle -= delta_iowait;
-
-		load_since_change =
-			100 * (delta_time - delta_idle) / delta_time;
-	}
+	load_since_change = cpufreq_interactive_load_since_change(data, pcpu,
+						now_idle, now_iowait);
 
-	/*
-	 * Combine short-term load (since last idle timer started or timer
-	 * function re-armed itself) and long-term load (since last frequency
-	 * change) to determine new target frequency.
-	 *
-	 * This function implements the cpufreq scaling policy
-	 */
-	new_freq = cpufreq_interactive_get_target(cpu_load, load_since_change,
-						pcpu);
-
-	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
-					   new_freq, CPUFREQ_RELATION_H,
-					   &index)) {
-		pr_warn_once("timer %d: cpufreq_frequency_table_target error\n",
-			     (int) data);
+	if (!cpufreq_interactive_evaluate(data, pcpu, cpu_load,
+					  load_since_change, idle_exit_time))
 		goto rearm;
-	}
-
-	new_freq = pcpu->freq_table[index].frequency;
 
-	/*
-	 * Do not scale below floor_freq unless we have been at or above the
-	 * floor frequency for the minimum sample time since last validated.
-	 */
-	if (new_freq < pcpu->floor_freq) {
-		if (cputime64_sub(pcpu->timer_run_time,
-				  pcpu->floor_validate_time)
-		    < min_sample_time) {
-
-			trace_cpufreq_interactive_notyet(data, cpu_load,
-					pcpu->target_freq, new_freq);
-			goto rearm;
-		}
-	}
-
-	pcpu->floor_freq = new_freq;
-	pcpu->floor_validate_time = pcpu->timer_run_time;
-
-	if (pcpu->target_freq == new_freq) {
-		trace_cpufreq_interactive_already(data, cpu_load,
-				pcpu->target_freq, new_freq);
-		goto rearm_if_notmax;
-	}
-
-	trace_cpufreq_interactive_target(data, cpu_load, pcpu->target_freq,
-					new_freq);
-
-	if (new_freq < pcpu->target_freq) {
-		pcpu->target_freq = new_freq;
-		spin_lock_irqsave(&down_cpumask_lock, flags);
-		cpumask_set_cpu(data, &down_cpumask);
-		spin_unlock_irqrestore(&down_cpumask_lock, flags);
-		queue_work(down_wq, &freq_scale_down_work);
-	} else {
-		pcpu->target_freq = new_freq;
-		spin_lock_irqsave(&up_cpumask_lock, flags);
-		cpumask_set_cpu(data, &up_cpumask);
-		spin_unlock_irqrestore(&up_cpumask_lock, flags);
-		wake_up_process(up_task);
-	}
-
-rearm_if_notmax:
 	/*
 	 * Already set max speed and don't see a need to change that,
 	 * wait until next idle to re-evaluate, don't need timer.
@@ -504,7 +746,8 @@ static void cpufreq_interactive_idle_end(void)
 	 * give the timer function enough time to make a decision on this
 	 * run.)
 	 */
-	if (timer_pending(&pcpu->cpu_timer) == 0 &&
+	if (!sched_driven &&
+	    timer_pending(&pcpu->cpu_timer) == 0 &&
 	    pcpu->timer_run_time >= pcpu->idle_exit_time &&
 	    pcpu->governor_enabled) {
 		pcpu->time_in_idle =
@@ -579,6 +822,12 @@ static int cpufreq_interactive_up_task(void *data)
 						     &pcpu->freq_change_time);
 			pcpu->freq_change_time_in_iowait =
 				get_cpu_iowait_time(cpu, NULL);
+
+			trace_cpufreq_interactive_latency(cpu,
+				pcpu->target_freq, pcpu->policy->cur,
+				pcpu->sample_us,
+				cputime64_sub(pcpu->freq_change_time,
+					      pcpu->decide_time));
 		}
 	}
 
@@ -630,6 +879,11 @@ static void cpufreq_interactive_freq_down(struct work_struct *work)
 					     &pcpu->freq_change_time);
 		pcpu->freq_change_time_in_iowait =
 			get_cpu_iowait_time(cpu, NULL);
+
+		trace_cpufreq_interactive_latency(cpu, pcpu->target_freq,
+				pcpu->policy->cur, pcpu->sample_us,
+				cputime64_sub(pcpu->freq_change_time,
+					      pcpu->decide_time));
 	}
 }
 
@@ -657,6 +911,8 @@ static void cpufreq_interactive_boost(void)
 
 		pcpu->floor_freq = hispeed_freq;
 		pcpu->floor_validate_time = ktime_to_us(ktime_get());
+		pcpu->decide_time = pcpu->floor_validate_time;
+		pcpu->sample_us = 0;
 	}
 
 	spin_unlock_irqrestore(&up_cpumask_lock, flags);
@@ -1105,6 +1361,114 @@ static ssize_t store_timer_rate(struct kobject *kobj,
 static struct global_attr timer_rate_attr = __ATTR(timer_rate, 0644,
 		show_timer_rate, store_timer_rate);
 
+/*
+ * Follow the scheduler from fresh samples, or go back to timers: those
+ * of idle CPUs get armed on idle exit, those of busy ones right away.
+ */
+static void cpufreq_interactive_sched_switch(int on)
+{
+	static int registered;
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned int j;
+	u64 now;
+
+	mutex_lock(&sched_driven_lock);
+
+	if (on && !registered) {
+		now = ktime_to_us(ktime_get());
+		for_each_possible_cpu(j)
+			cpufreq_interactive_sched_reset(j, now);
+		sched_load_register(&cpufreq_interactive_sched_nb);
+	} else if (!on && registered) {
+		sched_load_unregister(&cpufreq_interactive_sched_nb);
+		for_each_online_cpu(j) {
+			pcpu = &per_cpu(cpuinfo, j);
+			if (!pcpu->governor_enabled ||
+			    timer_pending(&pcpu->cpu_timer))
+				continue;
+
+			pcpu->time_in_idle = get_cpu_idle_time_us(j,
+						&pcpu->idle_exit_time);
+			pcpu->time_in_iowait = get_cpu_iowait_time(j, NULL);
+			pcpu->timer_idlecancel = 1;
+			mod_timer(&pcpu->cpu_timer,
+				  jiffies + usecs_to_jiffies(timer_rate));
+		}
+	}
+
+	registered = on;
+	mutex_unlock(&sched_driven_lock);
+}
+
+static ssize_t show_sched_driven(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", sched_driven);
+}
+
+static ssize_t store_sched_driven(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	sched_driven = !!val;
+	smp_wmb();
+	if (atomic_read(&active_count))
+		cpufreq_interactive_sched_switch(sched_driven);
+	return count;
+}
+
+static struct global_attr sched_driven_attr = __ATTR(sched_driven, 0644,
+		show_sched_driven, store_sched_driven);
+
+static ssize_t show_sched_rate_limit(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", sched_rate_limit);
+}
+
+static ssize_t store_sched_rate_limit(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	sched_rate_limit = val;
+	return count;
+}
+
+static struct global_attr sched_rate_limit_attr = __ATTR(sched_rate_limit,
+		0644, show_sched_rate_limit, store_sched_rate_limit);
+
+static ssize_t show_task_load_hint(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", task_load_hint);
+}
+
+static ssize_t store_task_load_hint(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	task_load_hint = val;
+	return count;
+}
+
+static struct global_attr task_load_hint_attr = __ATTR(task_load_hint,
+		0644, show_task_load_hint, store_task_load_hint);
+
 static ssize_t show_input_boost(struct kobject *kobj, struct attribute *attr,
 				char *buf)
 {
@@ -1169,6 +1533,9 @@ static struct attribute *interactive_attributes[] = {
 	&above_hispeed_delay.attr,
 	&min_sample_time_attr.attr,
 	&timer_rate_attr.attr,
+	&sched_driven_attr.attr,
+	&sched_rate_limit_attr.attr,
+	&task_load_hint_attr.attr,
 	&input_boost.attr,
 	&boost.attr,
 	NULL,
@@ -1213,6 +1580,8 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			pcpu->floor_freq = pcpu->target_freq;
 			pcpu->floor_validate_time =
 				pcpu->freq_change_time;
+			cpufreq_interactive_sched_reset(j,
+				pcpu->freq_change_time);
 			pcpu->governor_enabled = 1;
 			pcpu->idle_exit_time = pcpu->freq_change_time;
 			mod_timer(&pcpu->cpu_timer,
@@ -1240,6 +1609,7 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			pr_warn("%s: failed to register input handler\n",
 				__func__);
 
+		cpufreq_interactive_sched_switch(sched_driven);
 		break;
 
 	case CPUFREQ_GOV_STOP:
@@ -1258,10 +1628,15 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			pcpu->idle_exit_time = 0;
 		}
 
+		/* Wait for scheduler callbacks still looking at the policy. */
+		if (sched_driven)
+			synchronize_rcu();
+
 		flush_work(&freq_scale_down_work);
 		if (atomic_dec_return(&active_count) > 0)
 			return 0;
 
+		cpufreq_interactive_sched_switch(0);
 		input_unregister_handler(&cpufreq_interactive_input_handler);
 		sysfs_remove_group(cpufreq_global_kobject,
 				&interactive_attr_group);
@@ -1312,6 +1687,7 @@ static int __init cpufreq_interactive_init(void)
 	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
 	above_hispeed_delay_val = DEFAULT_ABOVE_HISPEED_DELAY;
 	timer_rate = DEFAULT_TIMER_RATE;
+	sched_rate_limit = DEFAULT_SCHED_RATE_LIMIT;
 
 	/* Initalize per-cpu timers */
 	for_each_possible_cpu(i) {
@@ -1319,6 +1695,8 @@ static int __init cpufreq_interactive_init(void)
 		init_timer(&pcpu->cpu_timer);
 		pcpu->cpu_timer.function = cpufreq_interactive_timer;
 		pcpu->cpu_timer.data = i;
+		spin_lock_init(&pcpu->load_lock);
+		spin_lock_init(&pcpu->policy_lock);
 	}
 
 	up_task = kthread_create(cpufreq_interactive_up_task, NULL,
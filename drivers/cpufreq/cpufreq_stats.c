@@ -16,6 +16,8 @@
 #include <linux/sysfs.h>
 #include <linux/cpufreq.h>
 #include <linux/jiffies.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
 #include <linux/percpu.h>
 #include <linux/kobject.h>
 #include <linux/spinlock.h>
@@ -32,24 +34,64 @@ static struct freq_attr _attr_##_name = {\
 
 #define CPU_FREQ_LEVEL_NUMBER 20
 
-static cputime64_t cpu0_time_in_state[CPU_FREQ_LEVEL_NUMBER] = {0};
+/* residency is kept in ns */
+static u64 cpu0_time_in_state[CPU_FREQ_LEVEL_NUMBER] = {0};
 static unsigned int cpu0_total_trans = 0;
-static cputime64_t cpu1_time_in_state[CPU_FREQ_LEVEL_NUMBER] = {0};
+static u64 cpu1_time_in_state[CPU_FREQ_LEVEL_NUMBER] = {0};
 static unsigned int cpu1_total_trans = 0;
-static cputime64_t cpu2_time_in_state[CPU_FREQ_LEVEL_NUMBER] = {0};
+static u64 cpu2_time_in_state[CPU_FREQ_LEVEL_NUMBER] = {0};
 static unsigned int cpu2_total_trans = 0;
-static cputime64_t cpu3_time_in_state[CPU_FREQ_LEVEL_NUMBER] = {0};
+static u64 cpu3_time_in_state[CPU_FREQ_LEVEL_NUMBER] = {0};
 static unsigned int cpu3_total_trans = 0;
 
+/*
+ * Transition latency, from the driver's PRECHANGE to its POSTCHANGE
+ * notification, is counted per destination frequency in log2 buckets:
+ * bucket 0 is under 1us, bucket n is [2^(n-1), 2^n) us, and the last one
+ * takes everything from 2^(CPUFREQ_STATS_LAT_BUCKETS - 2) us up.
+ */
+#define CPUFREQ_STATS_LAT_BUCKETS	16
+
+/*
+ * Layout of a cpu's stats_bin file, native endianness: a header, then one
+ * state record per frequency in ascending frequency order. Each read at
+ * offset 0 returns the whole of it, which takes less than a page for up
+ * to 50 frequencies.
+ */
+#define CPUFREQ_STATS_BIN_MAGIC		0x43465354	/* "CFST" */
+#define CPUFREQ_STATS_BIN_VERSION	2
+
+struct cpufreq_stats_bin_header {
+	u32 magic;
+	u32 version;
+	u32 cpu;
+	u32 state_num;
+	u32 nr_buckets;
+	u32 total_trans;
+	s32 cur_index;
+	u32 reserved;
+	u64 timestamp_ns;			/* ktime_get() */
+};
+
+struct cpufreq_stats_bin_state {
+	u32 freq;
+	u32 lat_max_us;
+	u64 time_ns;
+	u32 lat_hist[CPUFREQ_STATS_LAT_BUCKETS];
+};
+
 struct cpufreq_stats {
 	unsigned int cpu;
 	unsigned int total_trans;
-	unsigned long long  last_time;
+	u64 last_time;				/* ns */
 	unsigned int max_state;
 	unsigned int state_num;
 	unsigned int last_index;
-	cputime64_t *time_in_state;
+	u64 *time_in_state;			/* ns */
 	unsigned int *freq_table;
+	ktime_t trans_start;
+	unsigned int *lat_hist;
+	unsigned int *lat_max;			/* us */
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	unsigned int *trans_table;
 #endif
@@ -62,12 +104,18 @@ struct cpufreq_stats_attribute {
 	ssize_t(*show) (struct cpufreq_stats *, char *);
 };
 
+/* ns to the USER_HZ units time_in_state has always been reported in */
+static unsigned long long cpufreq_stats_clock_t(u64 ns)
+{
+	return div_u64(ns, NSEC_PER_SEC / USER_HZ);
+}
+
 static int cpufreq_stats_update(unsigned int cpu)
 {
 	struct cpufreq_stats *stat;
-	unsigned long long cur_time;
+	u64 cur_time;
+	u64 delta;
 
-	cur_time = get_jiffies_64();
 	spin_lock(&cpufreq_stats_lock);
 	stat = per_cpu(cpufreq_stats_table, cpu);
 	if (!stat) {
@@ -75,26 +123,20 @@ static int cpufreq_stats_update(unsigned int cpu)
 		return 0;
 	}
 
+	/* read under the lock, so last_time never gets ahead of it */
+	cur_time = ktime_to_ns(ktime_get());
+
+	delta = cur_time - stat->last_time;
 	if (stat->time_in_state && stat->last_index >= 0)
-		stat->time_in_state[stat->last_index] =
-			cputime64_add(stat->time_in_state[stat->last_index],
-				      cputime_sub(cur_time, stat->last_time));
+		stat->time_in_state[stat->last_index] += delta;
 	if (cpu == 0)
-		cpu0_time_in_state[stat->last_index] =
-			cputime64_add(cpu0_time_in_state[stat->last_index],
-			cputime_sub(cur_time, stat->last_time));
-        else if (cpu == 1)
-                cpu1_time_in_state[stat->last_index] =
-                        cputime64_add(cpu1_time_in_state[stat->last_index],
-                        cputime_sub(cur_time, stat->last_time));
-        else if (cpu == 2)
-                cpu2_time_in_state[stat->last_index] =
-                        cputime64_add(cpu2_time_in_state[stat->last_index],
-                        cputime_sub(cur_time, stat->last_time));
-        else if (cpu == 3)
-                cpu3_time_in_state[stat->last_index] =
-                        cputime64_add(cpu3_time_in_state[stat->last_index],
-                        cputime_sub(cur_time, stat->last_time));
+		cpu0_time_in_state[stat->last_index] += delta;
+	else if (cpu == 1)
+		cpu1_time_in_state[stat->last_index] += delta;
+	else if (cpu == 2)
+		cpu2_time_in_state[stat->last_index] += delta;
+	else if (cpu == 3)
+		cpu3_time_in_state[stat->last_index] += delta;
 
 	stat->last_time = cur_time;
 	spin_unlock(&cpufreq_stats_lock);
@@ -129,12 +171,70 @@ static ssize_t show_time_in_state(struct cpufreq_policy *policy, char *buf)
 	cpufreq_stats_update(stat->cpu);
 	for (i = 0; i < stat->state_num; i++) {
 		len += sprintf(buf + len, "%u %llu\n", stat->freq_table[i],
-			(unsigned long long)
-			cputime64_to_clock_t(stat->time_in_state[i]));
+			cpufreq_stats_clock_t(stat->time_in_state[i]));
+	}
+	return len;
+}
+
+static ssize_t show_time_in_state_us(struct cpufreq_policy *policy,
+				     char *buf)
+{
+	ssize_t len = 0;
+	int i;
+	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
+	if (!stat)
+		return 0;
+	cpufreq_stats_update(stat->cpu);
+	for (i = 0; i < stat->state_num; i++) {
+		len += sprintf(buf + len, "%u %llu\n", stat->freq_table[i],
+			div_u64(stat->time_in_state[i], NSEC_PER_USEC));
 	}
 	return len;
 }
 
+static ssize_t show_trans_latency(struct cpufreq_policy *policy, char *buf)
+{
+	ssize_t len = 0;
+	int i, j;
+	char label[12];
+
+	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
+	if (!stat)
+		return 0;
+	len += snprintf(buf + len, PAGE_SIZE - len, "   To  us:");
+	for (j = 0; j < CPUFREQ_STATS_LAT_BUCKETS; j++) {
+		if (j < CPUFREQ_STATS_LAT_BUCKETS - 1)
+			snprintf(label, sizeof(label), "<%u", 1U << j);
+		else
+			snprintf(label, sizeof(label), ">=%u", 1U << (j - 1));
+		len += snprintf(buf + len, PAGE_SIZE - len, " %8s", label);
+	}
+	len += snprintf(buf + len, PAGE_SIZE - len, " %8s\n", "max");
+
+	for (i = 0; i < stat->state_num; i++) {
+		if (len >= PAGE_SIZE)
+			break;
+
+		len += snprintf(buf + len, PAGE_SIZE - len, "%9u:",
+				stat->freq_table[i]);
+
+		for (j = 0; j < CPUFREQ_STATS_LAT_BUCKETS; j++) {
+			if (len >= PAGE_SIZE)
+				break;
+			len += snprintf(buf + len, PAGE_SIZE - len, " %8u",
+				stat->lat_hist[i * CPUFREQ_STATS_LAT_BUCKETS +
+					       j]);
+		}
+		if (len >= PAGE_SIZE)
+			break;
+		len += snprintf(buf + len, PAGE_SIZE - len, " %8u\n",
+				stat->lat_max[i]);
+	}
+	if (len >= PAGE_SIZE)
+		return PAGE_SIZE;
+	return len;
+}
+
 static ssize_t show_overall_time_in_state(struct kobject *kobj,
 					struct attribute *attr, char *buf)
 {
@@ -150,19 +250,19 @@ static ssize_t show_overall_time_in_state(struct kobject *kobj,
 		return 0;
 
 	for (i = 0; i < stat->state_num; i++) {
-		cputime = cputime64_to_clock_t(cpu0_time_in_state[i]);
+		cputime = cpufreq_stats_clock_t(cpu0_time_in_state[i]);
 		len += sprintf(buf + len, "%u %llu\n", stat->freq_table[i], cputime);
 	}
 	for (i = 0; i < stat->state_num; i++) {
-		cputime = cputime64_to_clock_t(cpu1_time_in_state[i]);
+		cputime = cpufreq_stats_clock_t(cpu1_time_in_state[i]);
 		len += sprintf(buf + len, "%u %llu\n", stat->freq_table[i], cputime);
 	}
 	for (i = 0; i < stat->state_num; i++) {
-		cputime = cputime64_to_clock_t(cpu2_time_in_state[i]);
+		cputime = cpufreq_stats_clock_t(cpu2_time_in_state[i]);
 		len += sprintf(buf + len, "%u %llu\n", stat->freq_table[i], cputime);
 	}
 	for (i = 0; i < stat->state_num; i++) {
-		cputime = cputime64_to_clock_t(cpu3_time_in_state[i]);
+		cputime = cpufreq_stats_clock_t(cpu3_time_in_state[i]);
 		len += sprintf(buf + len, "%u %llu\n", stat->freq_table[i], cputime);
 	}
 
@@ -219,6 +319,8 @@ CPUFREQ_STATDEVICE_ATTR(trans_table, 0444, show_trans_table);
 
 CPUFREQ_STATDEVICE_ATTR(total_trans, 0444, show_total_trans);
 CPUFREQ_STATDEVICE_ATTR(time_in_state, 0444, show_time_in_state);
+CPUFREQ_STATDEVICE_ATTR(time_in_state_us, 0444, show_time_in_state_us);
+CPUFREQ_STATDEVICE_ATTR(trans_latency, 0444, show_trans_latency);
 
 CPUFREQ_STATDEVICE_ATTR(overall_time_in_state, 0444, show_overall_time_in_state);
 CPUFREQ_STATDEVICE_ATTR(overall_total_trans, 0444, show_overall_total_trans);
@@ -226,6 +328,8 @@ CPUFREQ_STATDEVICE_ATTR(overall_total_trans, 0444, show_overall_total_trans);
 static struct attribute *default_attrs[] = {
 	&_attr_total_trans.attr,
 	&_attr_time_in_state.attr,
+	&_attr_time_in_state_us.attr,
+	&_attr_trans_latency.attr,
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	&_attr_trans_table.attr,
 #endif
@@ -248,6 +352,81 @@ static struct attribute_group overall_stats_attr_group = {
         .name = "overall_stats"
 };
 
+static size_t cpufreq_stats_bin_size(struct cpufreq_stats *stat)
+{
+	return sizeof(struct cpufreq_stats_bin_header) +
+		stat->state_num * sizeof(struct cpufreq_stats_bin_state);
+}
+
+/* Called with cpufreq_stats_lock held, @image being large enough */
+static void cpufreq_stats_bin_fill(struct cpufreq_stats *stat, char *image)
+{
+	struct cpufreq_stats_bin_header *hdr = (void *)image;
+	struct cpufreq_stats_bin_state *st;
+	int i;
+
+	hdr->magic = CPUFREQ_STATS_BIN_MAGIC;
+	hdr->version = CPUFREQ_STATS_BIN_VERSION;
+	hdr->cpu = stat->cpu;
+	hdr->state_num = stat->state_num;
+	hdr->nr_buckets = CPUFREQ_STATS_LAT_BUCKETS;
+	hdr->total_trans = stat->total_trans;
+	hdr->cur_index = stat->last_index;
+	hdr->reserved = 0;
+	hdr->timestamp_ns = ktime_to_ns(ktime_get());
+	image += sizeof(*hdr);
+
+	for (i = 0; i < stat->state_num; i++) {
+		st = (void *)image;
+		st->freq = stat->freq_table[i];
+		st->lat_max_us = stat->lat_max[i];
+		st->time_ns = stat->time_in_state[i];
+		/* add the time in the current state up to now */
+		if (i == stat->last_index)
+			st->time_ns += hdr->timestamp_ns - stat->last_time;
+		memcpy(st->lat_hist,
+		       &stat->lat_hist[i * CPUFREQ_STATS_LAT_BUCKETS],
+		       sizeof(st->lat_hist));
+		image += sizeof(*st);
+	}
+}
+
+/*
+ * sysfs hands out at most a page per call, so rather than rebuilding the
+ * image for every chunk, a read at offset 0 gets a complete snapshot or
+ * nothing, and any later offset is end of file.
+ */
+static ssize_t read_stats_bin(struct file *filp, struct kobject *kobj,
+			      struct bin_attribute *attr, char *buf,
+			      loff_t off, size_t count)
+{
+	struct cpufreq_policy *policy =
+		container_of(kobj, struct cpufreq_policy, kobj);
+	struct cpufreq_stats *stat;
+	ssize_t len = 0;
+
+	if (off)
+		return 0;
+
+	spin_lock(&cpufreq_stats_lock);
+	stat = per_cpu(cpufreq_stats_table, policy->cpu);
+	if (stat) {
+		len = cpufreq_stats_bin_size(stat);
+		if (len <= count)
+			cpufreq_stats_bin_fill(stat, buf);
+		else
+			len = -EFBIG;
+	}
+	spin_unlock(&cpufreq_stats_lock);
+
+	return len;
+}
+
+static struct bin_attribute stats_bin_attr = {
+	.attr = { .name = "stats_bin", .mode = 0444 },
+	.read = read_stats_bin,
+};
+
 static int freq_table_get_index(struct cpufreq_stats *stat, unsigned int freq)
 {
 	int index;
@@ -282,8 +461,10 @@ static void cpufreq_stats_free_table(unsigned int cpu)
 static void cpufreq_stats_free_sysfs(unsigned int cpu)
 {
 	struct cpufreq_policy *policy = cpufreq_cpu_get(cpu);
-	if (policy && policy->cpu == cpu)
+	if (policy && policy->cpu == cpu) {
+		sysfs_remove_bin_file(&policy->kobj, &stats_bin_attr);
 		sysfs_remove_group(&policy->kobj, &stats_attr_group);
+	}
 	if (policy)
 		cpufreq_cpu_put(policy);
 }
@@ -312,6 +493,12 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 	if (ret)
 		goto error_out;
 
+	ret = sysfs_create_bin_file(&data->kobj, &stats_bin_attr);
+	if (ret) {
+		sysfs_remove_group(&data->kobj, &stats_attr_group);
+		goto error_out;
+	}
+
 	stat->cpu = cpu;
 	per_cpu(cpufreq_stats_table, cpu) = stat;
 
@@ -322,7 +509,9 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 		count++;
 	}
 
-	alloc_size = count * sizeof(int) + count * sizeof(cputime64_t);
+	alloc_size = count * sizeof(int) + count * sizeof(u64);
+	alloc_size += count * CPUFREQ_STATS_LAT_BUCKETS * sizeof(int);
+	alloc_size += count * sizeof(int);
 
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	alloc_size += count * count * sizeof(int);
@@ -334,9 +523,11 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 		goto error_out;
 	}
 	stat->freq_table = (unsigned int *)(stat->time_in_state + count);
+	stat->lat_hist = stat->freq_table + count;
+	stat->lat_max = stat->lat_hist + count * CPUFREQ_STATS_LAT_BUCKETS;
 
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
-	stat->trans_table = stat->freq_table + count;
+	stat->trans_table = stat->lat_max + count;
 #endif
 	j = 0;
 	for (i = 0; table[i].frequency != CPUFREQ_TABLE_END; i++) {
@@ -356,7 +547,7 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 	}
 	stat->state_num = j;
 	spin_lock(&cpufreq_stats_lock);
-	stat->last_time = get_jiffies_64();
+	stat->last_time = ktime_to_ns(ktime_get());
 	stat->last_index = freq_table_get_index(stat, policy->cur);
 	spin_unlock(&cpufreq_stats_lock);
 	cpufreq_cpu_put(data);
@@ -393,6 +584,18 @@ static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
 	struct cpufreq_freqs *freq = data;
 	struct cpufreq_stats *stat;
 	int old_index, new_index;
+	ktime_t now = ktime_get();
+	unsigned int lat_us;
+	int bucket;
+
+	if (val == CPUFREQ_PRECHANGE) {
+		spin_lock(&cpufreq_stats_lock);
+		stat = per_cpu(cpufreq_stats_table, freq->cpu);
+		if (stat)
+			stat->trans_start = now;
+		spin_unlock(&cpufreq_stats_lock);
+		return 0;
+	}
 
 	if (val != CPUFREQ_POSTCHANGE)
 		return 0;
@@ -409,6 +612,16 @@ static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
 	old_index = stat->last_index;
 	new_index = freq_table_get_index(stat, freq->new);
 
+	if (new_index >= 0 && stat->trans_start.tv64) {
+		lat_us = ktime_us_delta(now, stat->trans_start);
+		bucket = min(fls(lat_us), CPUFREQ_STATS_LAT_BUCKETS - 1);
+		stat->lat_hist[new_index * CPUFREQ_STATS_LAT_BUCKETS +
+			       bucket]++;
+		if (lat_us > stat->lat_max[new_index])
+			stat->lat_max[new_index] = lat_us;
+	}
+	stat->trans_start.tv64 = 0;
+
 	if (old_index == new_index) {
 		spin_unlock(&cpufreq_stats_lock);
 		return 0;
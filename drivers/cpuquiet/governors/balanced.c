@@ -29,19 +29,9 @@
 #include <linux/tick.h>
 #include <asm/cputime.h>
 
-#define CPUNAMELEN 8
-
-typedef enum {
-	CPU_SPEED_BALANCED,
-	CPU_SPEED_BIASED,
-	CPU_SPEED_SKEWED,
-} CPU_SPEED_BALANCE;
+#include "balanced_policy.h"
 
-typedef enum {
-	IDLE,
-	DOWN,
-	UP,
-} BALANCED_STATE;
+#define CPUNAMELEN 8
 
 struct idle_info {
 	u64 idle_last;
@@ -70,6 +60,9 @@ static struct workqueue_struct *balanced_wq;
 static struct delayed_work balanced_work;
 static BALANCED_STATE balanced_state;
 static struct kobject *balanced_kobject;
+#ifdef CONFIG_TEGRA_RUNNABLE_THREAD
+static unsigned int nr_run_last;
+#endif
 
 static void calculate_load_timer(unsigned long data)
 {
@@ -174,76 +167,29 @@ static unsigned int count_slow_cpus(unsigned int limit)
 
 	return cnt;
 }
-#ifdef CONFIG_TEGRA_RUNNABLE_THREAD
-#define NR_FSHIFT	2
-static unsigned int nr_run_thresholds[] = {
-/*      1,  2,  3,  4 - on-line cpus target */
-	5,  7,  9, UINT_MAX /* avg run threads * 4 (e.g., 9 = 2.25 threads) */
-};
-static unsigned int nr_run_hysteresis = 2;	/* 0.5 thread */
-static unsigned int nr_run_last;
-#endif
-
-static CPU_SPEED_BALANCE balanced_speed_balance(void)
-{
-	unsigned long highest_speed = cpu_highest_speed();
-	unsigned long balanced_speed = highest_speed * balance_level / 100;
-	unsigned long skewed_speed = balanced_speed / 2;
-	unsigned int nr_cpus = num_online_cpus();
-	unsigned int max_cpus = pm_qos_request(PM_QOS_MAX_ONLINE_CPUS) ? : 4;
-#ifdef CONFIG_TEGRA_RUNNABLE_THREAD
-	unsigned int avg_nr_run = avg_nr_running();
-	unsigned int nr_run;
-#endif
-
-	/* balanced: freq targets for all CPUs are above 50% of highest speed
-	   biased: freq target for at least one CPU is below 50% threshold
-	   skewed: freq targets for at least 2 CPUs are below 25% threshold */
-#ifdef CONFIG_TEGRA_RUNNABLE_THREAD
-	for (nr_run = 1; nr_run < ARRAY_SIZE(nr_run_thresholds); nr_run++) {
-		unsigned int nr_threshold = nr_run_thresholds[nr_run - 1];
-		if (nr_run_last <= nr_run)
-			nr_threshold += nr_run_hysteresis;
-		if (avg_nr_run <= (nr_threshold << (FSHIFT - NR_FSHIFT)))
-			break;
-	}
-	nr_run_last = nr_run;
-
-	if (count_slow_cpus(skewed_speed) >= 2 || nr_cpus > max_cpus ||
-		nr_run < nr_cpus)
-#else
-	if (count_slow_cpus(skewed_speed) >= 2 || nr_cpus > max_cpus)
-#endif
-		return CPU_SPEED_SKEWED;
-
-#ifdef CONFIG_TEGRA_RUNNABLE_THREAD
-	if (count_slow_cpus(balanced_speed) >= 1 || nr_cpus == max_cpus ||
-		nr_run <= nr_cpus)
-#else
-	if (count_slow_cpus(balanced_speed) >= 1 || nr_cpus == max_cpus)
-#endif
-		return CPU_SPEED_BIASED;
-
-	return CPU_SPEED_BALANCED;
-}
-
 static void balanced_work_func(struct work_struct *work)
 {
-	bool up = false;
-	unsigned int cpu = nr_cpu_ids;
+	struct balanced_params params = {
+		.balance_level = balance_level,
+		.down_delay = down_delay,
 #ifdef CONFIG_TEGRA_RUNNABLE_THREAD
-	unsigned long now = jiffies;
+		.nr_run = true,
 #endif
-
-	CPU_SPEED_BALANCE balance;
+		.count_slow_cpus = count_slow_cpus,
+	};
+	struct balanced_sample sample = {
+		.nr_cpus = num_online_cpus(),
+		.max_cpus = pm_qos_request(PM_QOS_MAX_ONLINE_CPUS) ? : 4,
+		.now = jiffies,
+	};
+	unsigned int cpu = nr_cpu_ids;
+	int change = 0;
 
 	switch (balanced_state) {
 	case IDLE:
 		break;
 	case DOWN:
-		cpu = get_slowest_cpu_n();
-		if (cpu < nr_cpu_ids) {
-			up = false;
+		if (get_slowest_cpu_n() < nr_cpu_ids) {
 			queue_delayed_work(balanced_wq,
 #ifdef CONFIG_TEGRA_RUNNABLE_THREAD
 						 &balanced_work, up_delay);
@@ -254,44 +200,35 @@ static void balanced_work_func(struct work_struct *work)
 			stop_load_timer();
 		break;
 	case UP:
-		balance = balanced_speed_balance();
-		switch (balance) {
-
-		/* cpu speed is up and balanced - one more on-line */
-		case CPU_SPEED_BALANCED:
-			cpu = cpumask_next_zero(0, cpu_online_mask);
-			if (cpu < nr_cpu_ids)
-				up = true;
-			break;
-		/* cpu speed is up, but skewed - remove one core */
-		case CPU_SPEED_SKEWED:
-			cpu = get_slowest_cpu_n();
-			if (cpu < nr_cpu_ids)
-				up = false;
-			break;
-		/* cpu speed is up, but under-utilized - do nothing */
-		case CPU_SPEED_BIASED:
-		default:
-			break;
-		}
 		queue_delayed_work(
 			balanced_wq, &balanced_work, up_delay);
 		break;
 	default:
 		pr_err("%s: invalid cpuquiet balanced governor state %d\n",
 		       __func__, balanced_state);
+		return;
 	}
 
+	sample.highest_load = cpu_highest_speed();
 #ifdef CONFIG_TEGRA_RUNNABLE_THREAD
-	if (!up && ((now - last_change_time) < down_delay))
-		cpu = nr_cpu_ids;
+	sample.avg_nr_run = avg_nr_running();
+	sample.last_change_time = last_change_time;
+	change = balanced_decision(&params, balanced_state, &sample,
+				   &nr_run_last);
+#else
+	change = balanced_decision(&params, balanced_state, &sample, NULL);
 #endif
 
+	if (change > 0)
+		cpu = cpumask_next_zero(0, cpu_online_mask);
+	else if (change < 0)
+		cpu = get_slowest_cpu_n();
+
 	if (cpu < nr_cpu_ids) {
 #ifdef CONFIG_TEGRA_RUNNABLE_THREAD
-		last_change_time = now;
+		last_change_time = sample.now;
 #endif
-		if (up)
+		if (change > 0)
 			cpuquiet_wake_cpu(cpu);
 		else
 			cpuquiet_quiesence_cpu(cpu);
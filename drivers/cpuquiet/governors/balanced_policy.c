@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2012 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/sched.h>
+
+#include "balanced_policy.h"
+
+#define NR_FSHIFT	2
+static unsigned int nr_run_thresholds[] = {
+/*      1,  2,  3,  4 - on-line cpus target */
+	5,  7,  9, UINT_MAX /* avg run threads * 4 (e.g., 9 = 2.25 threads) */
+};
+static unsigned int nr_run_hysteresis = 2;	/* 0.5 thread */
+
+CPU_SPEED_BALANCE balanced_speed_balance(const struct balanced_params *p,
+					 const struct balanced_sample *s,
+					 unsigned int *nr_run_last)
+{
+	unsigned long highest_speed = s->highest_load;
+	unsigned long balanced_speed = highest_speed * p->balance_level / 100;
+	unsigned long skewed_speed = balanced_speed / 2;
+	unsigned int nr_cpus = s->nr_cpus;
+	unsigned int nr_run = UINT_MAX;
+
+	if (p->nr_run) {
+		for (nr_run = 1; nr_run < ARRAY_SIZE(nr_run_thresholds);
+		     nr_run++) {
+			unsigned int nr_threshold =
+				nr_run_thresholds[nr_run - 1];
+			if (*nr_run_last <= nr_run)
+				nr_threshold += nr_run_hysteresis;
+			if (s->avg_nr_run <=
+			    (nr_threshold << (FSHIFT - NR_FSHIFT)))
+				break;
+		}
+		*nr_run_last = nr_run;
+	}
+
+	/* balanced: freq targets for all CPUs are above 50% of highest speed
+	   biased: freq target for at least one CPU is below 50% threshold
+	   skewed: freq targets for at least 2 CPUs are below 25% threshold */
+	if (p->count_slow_cpus(skewed_speed) >= 2 || nr_cpus > s->max_cpus ||
+		nr_run < nr_cpus)
+		return CPU_SPEED_SKEWED;
+
+	if (p->count_slow_cpus(balanced_speed) >= 1 ||
+		nr_cpus == s->max_cpus || nr_run <= nr_cpus)
+		return CPU_SPEED_BIASED;
+
+	return CPU_SPEED_BALANCED;
+}
+
+/*
+ * What the balanced work should do in the given state: 1 to bring one
+ * more core online, -1 to take one offline, 0 to leave things alone.
+ */
+int balanced_decision(const struct balanced_params *p, BALANCED_STATE state,
+		      const struct balanced_sample *s,
+		      unsigned int *nr_run_last)
+{
+	int change = 0;
+
+	switch (state) {
+	case DOWN:
+		change = -1;
+		break;
+	case UP:
+		switch (balanced_speed_balance(p, s, nr_run_last)) {
+		/* cpu speed is up and balanced - one more on-line */
+		case CPU_SPEED_BALANCED:
+			change = 1;
+			break;
+		/* cpu speed is up, but skewed - remove one core */
+		case CPU_SPEED_SKEWED:
+			change = -1;
+			break;
+		/* cpu speed is up, but under-utilized - do nothing */
+		case CPU_SPEED_BIASED:
+		default:
+			break;
+		}
+		break;
+	case IDLE:
+	default:
+		break;
+	}
+
+	if (p->nr_run && change < 0 &&
+	    (s->now - s->last_change_time) < p->down_delay)
+		change = 0;
+
+	return change;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2012 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __CPUQUIET_BALANCED_POLICY_H
+#define __CPUQUIET_BALANCED_POLICY_H
+
+#include <linux/types.h>
+
+typedef enum {
+	CPU_SPEED_BALANCED,
+	CPU_SPEED_BIASED,
+	CPU_SPEED_SKEWED,
+} CPU_SPEED_BALANCE;
+
+typedef enum {
+	IDLE,
+	DOWN,
+	UP,
+} BALANCED_STATE;
+
+/*
+ * The decision logic of the balanced governor works only on its
+ * arguments, so that it can be built outside the kernel (see
+ * tools/cpuquiet) and fed recorded traces.
+ */
+struct balanced_params {
+	unsigned int balance_level;
+	unsigned long down_delay;	/* jiffies */
+	bool nr_run;			/* use the runnable thread average */
+	unsigned int (*count_slow_cpus)(unsigned int limit);
+};
+
+struct balanced_sample {
+	unsigned int highest_load;	/* busiest online cpu, percent */
+	unsigned long avg_nr_run;	/* FSHIFT fixed point */
+	unsigned int nr_cpus;
+	unsigned int max_cpus;
+	unsigned long now;		/* jiffies */
+	unsigned long last_change_time;	/* jiffies */
+};
+
+CPU_SPEED_BALANCE balanced_speed_balance(const struct balanced_params *p,
+					 const struct balanced_sample *s,
+					 unsigned int *nr_run_last);
+int balanced_decision(const struct balanced_params *p, BALANCED_STATE state,
+		      const struct balanced_sample *s,
+		      unsigned int *nr_run_last);
+
+#endif
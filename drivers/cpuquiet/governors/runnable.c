@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2012 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * The runnable governor sizes the set of online cores from the number of
+ * runnable threads alone. The averages are maintained by the scheduler
+ * on every enqueue and dequeue (avg_cpu_nr_running()), and the decision
+ * is taken from the scheduler tick, so no load timer is polled and a
+ * burst is acted upon at the first tick that sees it. The tick only
+ * computes the target; cores are woken and quiesced from a workqueue.
+ */
+
+#include <linux/kernel.h>
+#include <linux/cpuquiet.h>
+#include <linux/cpumask.h>
+#include <linux/module.h>
+#include <linux/notifier.h>
+#include <linux/pm_qos_params.h>
+#include <linux/jiffies.h>
+#include <linux/slab.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/workqueue.h>
+
+#define NR_FSHIFT	2
+
+static unsigned int nr_run_thresholds[] = {
+/*      1,  2,  3,  4 - on-line cpus target */
+	5,  7,  9, UINT_MAX /* avg run threads * 4 (e.g., 9 = 2.25 threads) */
+};
+
+/* configurable parameters */
+static unsigned int  nr_run_hysteresis = 2;	/* 0.5 thread */
+static unsigned long up_delay;
+static unsigned long down_delay;
+
+static unsigned int nr_run_last;
+static unsigned int nr_run_target;
+static unsigned long last_eval_time;
+static unsigned long last_change_time;
+static bool runnable_active;
+
+static struct workqueue_struct *runnable_wq;
+static struct work_struct runnable_work;
+static struct kobject *runnable_kobject;
+
+/*
+ * Number of cores the current runnable average calls for. Moving up a
+ * step needs nr_run_hysteresis more than moving back down does.
+ */
+static unsigned int runnable_nr_cpus(void)
+{
+	unsigned long avg_nr_run = avg_nr_running();
+	unsigned int nr_run;
+
+	for (nr_run = 1; nr_run < ARRAY_SIZE(nr_run_thresholds); nr_run++) {
+		unsigned int nr_threshold = nr_run_thresholds[nr_run - 1];
+
+		if (nr_run_last <= nr_run)
+			nr_threshold += nr_run_hysteresis;
+		if (avg_nr_run <= (nr_threshold << (FSHIFT - NR_FSHIFT)))
+			break;
+	}
+	nr_run_last = nr_run;
+
+	return nr_run;
+}
+
+/* Keep target within the PM QoS online cpu limits, and at least 1 */
+static unsigned int runnable_clamp(unsigned int target)
+{
+	unsigned int max_cpus = pm_qos_request(PM_QOS_MAX_ONLINE_CPUS) ? : 4;
+	unsigned int min_cpus = pm_qos_request(PM_QOS_MIN_ONLINE_CPUS);
+
+	return clamp(target, max(min_cpus, 1U), max_cpus);
+}
+
+/* The online core, other than cpu0, with the fewest runnable threads */
+static unsigned int get_lightest_cpu_n(void)
+{
+	unsigned int cpu = nr_cpu_ids;
+	unsigned int minload = UINT_MAX;
+	int i;
+
+	for_each_online_cpu(i) {
+		unsigned int load = avg_cpu_nr_running(i);
+
+		if ((i > 0) && (minload > load)) {
+			cpu = i;
+			minload = load;
+		}
+	}
+
+	return cpu;
+}
+
+static void runnable_work_func(struct work_struct *work)
+{
+	unsigned int nr_cpus = num_online_cpus();
+	unsigned int cpu = nr_cpu_ids;
+	bool up = false;
+	unsigned int target;
+
+	/* the limits may have changed since the tick queued us */
+	target = runnable_clamp(ACCESS_ONCE(nr_run_target));
+
+	if (target > nr_cpus) {
+		cpu = cpumask_next_zero(0, cpu_online_mask);
+		up = true;
+	} else if (target < nr_cpus) {
+		cpu = get_lightest_cpu_n();
+	}
+
+	if (cpu < nr_cpu_ids) {
+		last_change_time = jiffies;
+		if (up)
+			cpuquiet_wake_cpu(cpu);
+		else
+			cpuquiet_quiesence_cpu(cpu);
+	}
+}
+
+static int runnable_tick(struct notifier_block *nb, unsigned long event,
+			 void *data)
+{
+	unsigned long now = jiffies;
+	unsigned long last = last_eval_time;
+	unsigned int nr_cpus, target;
+
+	if (event != SCHED_LOAD_TICK || !runnable_active)
+		return NOTIFY_DONE;
+
+	/* evaluate once per jiffy, on whichever cpu ticks first */
+	if (last == now || cmpxchg(&last_eval_time, last, now) != last)
+		return NOTIFY_DONE;
+
+	target = runnable_clamp(runnable_nr_cpus());
+	ACCESS_ONCE(nr_run_target) = target;
+
+	nr_cpus = num_online_cpus();
+	if (target > nr_cpus) {
+		if (time_before(now, last_change_time + up_delay))
+			return NOTIFY_DONE;
+	} else if (target < nr_cpus) {
+		if (time_before(now, last_change_time + down_delay))
+			return NOTIFY_DONE;
+	} else {
+		return NOTIFY_DONE;
+	}
+
+	queue_work(runnable_wq, &runnable_work);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block runnable_sched_nb = {
+	.notifier_call = runnable_tick,
+};
+
+static void delay_callback(struct cpuquiet_attribute *attr)
+{
+	unsigned long val;
+
+	if (attr) {
+		val = (*((unsigned long *)(attr->param)));
+		(*((unsigned long *)(attr->param))) = msecs_to_jiffies(val);
+	}
+}
+
+CPQ_BASIC_ATTRIBUTE(nr_run_hysteresis, 0644, uint);
+CPQ_ATTRIBUTE(up_delay, 0644, ulong, delay_callback);
+CPQ_ATTRIBUTE(down_delay, 0644, ulong, delay_callback);
+
+static struct attribute *runnable_attributes[] = {
+	&nr_run_hysteresis_attr.attr,
+	&up_delay_attr.attr,
+	&down_delay_attr.attr,
+	NULL,
+};
+
+static const struct sysfs_ops runnable_sysfs_ops = {
+	.show = cpuquiet_auto_sysfs_show,
+	.store = cpuquiet_auto_sysfs_store,
+};
+
+static struct kobj_type ktype_runnable = {
+	.sysfs_ops = &runnable_sysfs_ops,
+	.default_attrs = runnable_attributes,
+};
+
+static int runnable_sysfs(void)
+{
+	int err;
+
+	runnable_kobject = kzalloc(sizeof(*runnable_kobject),
+				GFP_KERNEL);
+
+	if (!runnable_kobject)
+		return -ENOMEM;
+
+	err = cpuquiet_kobject_init(runnable_kobject, &ktype_runnable,
+				"runnable");
+
+	if (err)
+		kfree(runnable_kobject);
+
+	return err;
+}
+
+static void runnable_stop(void)
+{
+	/*
+	   first unregister the scheduler callback. This ensures no new
+	   work can be queued behind our back
+	*/
+	runnable_active = false;
+	sched_load_unregister(&runnable_sched_nb);
+
+	cancel_work_sync(&runnable_work);
+	destroy_workqueue(runnable_wq);
+
+	kobject_put(runnable_kobject);
+}
+
+static int runnable_start(void)
+{
+	int err;
+
+	err = runnable_sysfs();
+	if (err)
+		return err;
+
+	runnable_wq = alloc_workqueue("cpuquiet-runnable",
+			WQ_UNBOUND | WQ_RESCUER | WQ_FREEZABLE, 1);
+	if (!runnable_wq) {
+		kobject_put(runnable_kobject);
+		return -ENOMEM;
+	}
+
+	INIT_WORK(&runnable_work, runnable_work_func);
+
+	up_delay = msecs_to_jiffies(0);
+	down_delay = msecs_to_jiffies(500);
+
+	nr_run_last = num_online_cpus();
+	last_change_time = jiffies;
+	runnable_active = true;
+
+	sched_load_register(&runnable_sched_nb);
+
+	return 0;
+}
+
+struct cpuquiet_governor runnable_governor = {
+	.name		= "runnable",
+	.start		= runnable_start,
+	.stop		= runnable_stop,
+	.owner		= THIS_MODULE,
+};
+
+static int __init init_runnable(void)
+{
+	return cpuquiet_register_governor(&runnable_governor);
+}
+
+static void __exit exit_runnable(void)
+{
+	cpuquiet_unregister_governor(&runnable_governor);
+}
+
+MODULE_LICENSE("GPL");
+module_init(init_runnable);
+module_exit(exit_runnable);
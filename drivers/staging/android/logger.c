@@ -20,9 +20,12 @@
 #include <linux/sched.h>
 #include <linux/module.h>
 #include <linux/fs.h>
+#include <linux/linkage.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
+#include <linux/seqlock.h>
 #include <linux/slab.h>
 #include <linux/time.h>
 #include "logger.h"
@@ -33,17 +36,26 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * There is no lock. Positions in the log only ever grow and are reduced to
+ * buffer offsets with logger_offset(). A writer claims space for its entry by
+ * advancing 'w_reserve' with cmpxchg, reclaims the oldest entries by moving
+ * 'head' past them the same way, copies the entry in and then publishes it by
+ * moving 'w_commit' over it. Entries are committed in the order they were
+ * reserved, and everything between reserve and commit runs with preemption
+ * disabled, so a writer only ever waits a few microseconds for another one.
+ * Readers never hold up writers: they read up to 'w_commit' and afterwards
+ * check that 'head' did not pass what they read, retrying if it did.
  */
 struct logger_log {
 	unsigned char		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	unsigned long		w_reserve; /* end of the space claimed so far */
+	unsigned long		w_commit; /* end of what readers may read */
+	unsigned long		head;	/* oldest entry still in the log */
+	seqcount_t		seq;	/* bumped twice by every commit */
 	size_t			size;	/* size of the log */
 };
 
@@ -51,17 +63,35 @@ struct logger_log {
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by the mutex 'mutex'.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* serializes reads through this file */
+	unsigned long		r_pos;	/* current read position */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+/*
+ * logger_before - is position 'a' before position 'b'?
+ *
+ * Only for positions less than LONG_MAX bytes apart, such as head and
+ * w_commit. A reader left alone can fall arbitrarily far behind (2 GiB
+ * overruns the sign on 32-bit), so readers use logger_lapped() instead.
+ */
+#define logger_before(a, b)	((long)((a) - (b)) < 0)
+
+/*
+ * logger_lapped - is reader position 'r' outside the valid window
+ * [head, commit]? Works however far head has overrun it.
+ */
+#define logger_lapped(r, head, commit)	((commit) - (r) > (commit) - (head))
+
+/* Payloads up to this size are gathered on the stack rather than kmalloc'd */
+#define LOGGER_STACK_PAYLOAD	256
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -89,7 +119,7 @@ static inline struct logger_log *file_get_log(struct file *file)
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Only meaningful for an entry before w_commit that has not been reclaimed.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
@@ -108,15 +138,11 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
- *
- * Caller must hold log->mutex.
+ * do_read_log_to_user - reads exactly 'count' bytes from offset 'off' of 'log'
+ * into the user-space buffer 'buf'. Returns 'count' on success.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static ssize_t do_read_log_to_user(struct logger_log *log, size_t off,
+				   char __user *buf, size_t count)
 {
 	size_t len;
 
@@ -125,8 +151,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the current read head offset up to 'count' bytes or to the end of
 	 * the log, whichever comes first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	len = min(count, log->size - off);
+	if (copy_to_user(buf, log->buffer + off, len))
 		return -EFAULT;
 
 	/*
@@ -137,11 +163,82 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off + count);
-
 	return count;
 }
 
+/*
+ * reader_catch_up - moves a reader that writers lapped up to the oldest entry
+ * still in the log, and returns the position it may read up to.
+ *
+ * Caller must hold reader->mutex.
+ */
+static unsigned long reader_catch_up(struct logger_log *log,
+				     struct logger_reader *reader)
+{
+	unsigned long head = ACCESS_ONCE(log->head);
+	unsigned long commit;
+
+	/* head never passes w_commit, so read it first */
+	smp_rmb();
+	commit = ACCESS_ONCE(log->w_commit);
+	if (logger_lapped(reader->r_pos, head, commit))
+		reader->r_pos = head;
+	smp_rmb();
+
+	return commit;
+}
+
+/*
+ * reader_lapped - did a writer reclaim the entry at the reader's position
+ * while we were looking at it? If so, whatever was read of it is garbage.
+ *
+ * Caller must hold reader->mutex.
+ */
+static int reader_lapped(struct logger_log *log, struct logger_reader *reader)
+{
+	unsigned long head, commit;
+
+	smp_rmb();
+	head = ACCESS_ONCE(log->head);
+	/* head never passes w_commit, so read it first */
+	smp_rmb();
+	commit = ACCESS_ONCE(log->w_commit);
+
+	return logger_lapped(reader->r_pos, head, commit);
+}
+
+/*
+ * logger_read_entry - copies the next entry out to 'buf', returning its size,
+ * or 0 if there turned out to be nothing to read.
+ *
+ * Caller must hold reader->mutex.
+ */
+static ssize_t logger_read_entry(struct logger_log *log,
+				 struct logger_reader *reader,
+				 char __user *buf, size_t count)
+{
+	ssize_t ret;
+
+	do {
+		if (reader_catch_up(log, reader) == reader->r_pos)
+			return 0;
+
+		/* get the size of the next entry */
+		ret = get_entry_len(log, logger_offset(reader->r_pos));
+		if (count < ret)
+			ret = -EINVAL;
+		else
+			/* get exactly one entry from the log */
+			ret = do_read_log_to_user(log,
+				logger_offset(reader->r_pos), buf, ret);
+	} while (reader_lapped(log, reader));
+
+	if (ret > 0)
+		reader->r_pos += ret;
+
+	return ret;
+}
+
 /*
  * logger_read - our log's read() method
  *
@@ -166,9 +263,7 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		ret = (ACCESS_ONCE(log->w_commit) == reader->r_pos);
 		if (!ret)
 			break;
 
@@ -189,145 +284,99 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->mutex);
+	ret = logger_read_entry(log, reader, buf, count);
+	mutex_unlock(&reader->mutex);
 
-	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	/* did another read() through this file get there first? */
+	if (unlikely(!ret))
 		goto start;
-	}
-
-	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
-	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
-	}
-
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
-
-out:
-	mutex_unlock(&log->mutex);
 
 	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * logger_reserve - claims 'len' bytes for one entry at the write head and
+ * reclaims as many of the oldest entries as that overwrites. Returns the
+ * position of the claimed space.
  *
- * Caller must hold log->mutex.
+ * Called with preemption disabled.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static unsigned long logger_reserve(struct logger_log *log, size_t len)
 {
-	size_t count = 0;
+	unsigned long pos, head;
 
 	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
-}
-
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
+		pos = ACCESS_ONCE(log->w_reserve);
+	} while (cmpxchg(&log->w_reserve, pos, pos + len) != pos);
+
+	while (pos + len - (head = ACCESS_ONCE(log->head)) > log->size) {
+		/*
+		 * The oldest entry may still be being written by whoever
+		 * reserved it; wait for its length to be there.
+		 */
+		while (!logger_before(head, ACCESS_ONCE(log->w_commit)))
+			cpu_relax();
+		smp_rmb();
+		/* whoever wins the race moves head on; readers see it first */
+		cmpxchg(&log->head, head,
+			head + get_entry_len(log, logger_offset(head)));
 	}
 
-	return 0;
+	return pos;
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * logger_commit - makes the entry of 'len' bytes at 'pos' visible to readers,
+ * once all entries reserved before it are.
  *
- * The caller needs to hold log->mutex.
+ * Called with preemption disabled.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void logger_commit(struct logger_log *log, unsigned long pos,
+			  size_t len)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
-
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
-
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	while (ACCESS_ONCE(log->w_commit) != pos)
+		cpu_relax();
+	/* orders the entry itself before w_commit too */
+	write_seqcount_begin(&log->seq);
+	log->w_commit = pos + len;
+	write_seqcount_end(&log->seq);
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
- *
- * The caller needs to hold log->mutex.
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at position 'pos',
+ * which the caller reserved
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void do_write_log(struct logger_log *log, unsigned long pos,
+			 const void *buf, size_t count)
 {
+	size_t off = logger_offset(pos);
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log->w_off + count);
-
-}
-
-/*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
- */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
-{
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
-
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
-
-	log->w_off = logger_offset(log->w_off + count);
-
-	return count;
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The payload is gathered before any space is reserved, so that nothing
+ * between reserve and commit can fault.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	unsigned char stack_payload[LOGGER_STACK_PAYLOAD];
+	unsigned char *payload = stack_payload;
 	struct logger_entry header;
 	struct timespec now;
+	unsigned long pos;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -337,47 +386,49 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	header.sec = now.tv_sec;
 	header.nsec = now.tv_nsec;
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	header.__pad = 0;
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	if (header.len > sizeof(stack_payload)) {
+		payload = kmalloc(header.len, GFP_KERNEL);
+		if (!payload)
+			return -ENOMEM;
+	}
 
 	while (nr_segs-- > 0) {
 		size_t len;
-		ssize_t nr;
 
 		/* figure out how much of this vector we can keep */
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		if (unlikely(copy_from_user(payload + ret, iov->iov_base,
+					    len))) {
+			ret = -EFAULT;
+			goto out;
 		}
 
 		iov++;
-		ret += nr;
+		ret += len;
 	}
 
-	mutex_unlock(&log->mutex);
+	preempt_disable();
+	pos = logger_reserve(log, sizeof(struct logger_entry) + header.len);
+	do_write_log(log, pos, &header, sizeof(struct logger_entry));
+	do_write_log(log, pos + sizeof(struct logger_entry), payload,
+		     header.len);
+	logger_commit(log, pos, sizeof(struct logger_entry) + header.len);
+	preempt_enable();
 
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
 
+out:
+	if (payload != stack_payload)
+		kfree(payload);
+
 	return ret;
 }
 
@@ -409,12 +460,8 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		mutex_init(&reader->mutex);
+		reader->r_pos = ACCESS_ONCE(log->head);
 
 		file->private_data = reader;
 	} else
@@ -432,11 +479,7 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		struct logger_log *log = reader->log;
-		mutex_lock(&log->mutex);
-		list_del(&reader->list);
 		kfree(reader);
-		mutex_unlock(&log->mutex);
 	}
 
 	return 0;
@@ -465,22 +508,76 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	if (ACCESS_ONCE(log->w_commit) != reader->r_pos)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
 
 	return ret;
 }
 
+/*
+ * logger_get_position - fills in 'pos' for LOGGER_GET_POSITION, and moves the
+ * reader past everything it reports, so that poll() only wakes it up for new
+ * entries.
+ *
+ * Caller must hold reader->mutex.
+ */
+static void logger_get_position(struct logger_log *log,
+				struct logger_reader *reader,
+				struct logger_position *pos)
+{
+	unsigned long head, commit;
+	unsigned seq;
+
+	do {
+		seq = read_seqcount_begin(&log->seq);
+		head = ACCESS_ONCE(log->head);
+		/* head never passes w_commit, so read it first */
+		smp_rmb();
+		commit = ACCESS_ONCE(log->w_commit);
+	} while (read_seqcount_retry(&log->seq, seq));
+
+	pos->head = head;
+	pos->commit = commit;
+	pos->seq = seq / 2;
+	pos->size = log->size;
+
+	reader->r_pos = commit;
+}
+
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the ring buffer itself read-only, for readers that would rather parse
+ * entries in place than read() them one at a time. See logger_position.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EACCES;
+
+	if (vma->vm_pgoff || size > log->size)
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_pfn_range(vma, vma->vm_start,
+			       virt_to_phys(log->buffer) >> PAGE_SHIFT,
+			       size, vma->vm_page_prot);
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
+	struct logger_position pos;
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	unsigned long head, commit;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
-
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
@@ -491,10 +588,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		mutex_lock(&reader->mutex);
+		ret = reader_catch_up(log, reader) - reader->r_pos;
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -502,25 +598,44 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
-		else
-			ret = 0;
+		mutex_lock(&reader->mutex);
+		do {
+			if (reader_catch_up(log, reader) != reader->r_pos)
+				ret = get_entry_len(log,
+					logger_offset(reader->r_pos));
+			else
+				ret = 0;
+		} while (reader_lapped(log, reader));
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		/* readers catch up with head by themselves */
+		do {
+			head = ACCESS_ONCE(log->head);
+			commit = ACCESS_ONCE(log->w_commit);
+		} while (logger_before(head, commit) &&
+			 cmpxchg(&log->head, head, commit) != head);
+		ret = 0;
+		break;
+	case LOGGER_GET_POSITION:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+		logger_get_position(log, reader, &pos);
+		mutex_unlock(&reader->mutex);
 		ret = 0;
+		if (copy_to_user((void __user *)arg, &pos, sizeof(pos)))
+			ret = -EFAULT;
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
-
 	return ret;
 }
 
@@ -529,6 +644,7 @@ static const struct file_operations logger_fops = {
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -538,10 +654,11 @@ static const struct file_operations logger_fops = {
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
  * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * LONG_MAX minus LOGGER_ENTRY_MAX_LEN. The buffer is page aligned so that it
+ * can be mapped by readers.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __page_aligned_bss; \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -551,10 +668,10 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
-	.w_off = 0, \
+	.w_reserve = 0, \
+	.w_commit = 0, \
 	.head = 0, \
+	.seq = SEQCNT_ZERO, \
 	.size = SIZE, \
 };
 
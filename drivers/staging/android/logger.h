@@ -35,6 +35,24 @@ struct logger_entry {
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
 #define LOGGER_LOG_MAIN		"log_main"	/* everything else */
 
+/*
+ * struct logger_position - where things are in a log, for readers that
+ * mmap() it instead of read()ing it
+ *
+ * Positions only ever grow, wrapping at 2^32; an entry at position 'pos'
+ * starts at byte (pos & (size - 1)) of the mapping and may wrap around its
+ * end. Entries from 'head' up to 'commit' are complete, but writers keep
+ * reclaiming the oldest ones, so whatever was read from the mapping before
+ * a position that a later LOGGER_GET_POSITION reports as behind 'head' may
+ * have been overwritten and must be thrown away.
+ */
+struct logger_position {
+	__u32		head;	/* oldest entry still in the log */
+	__u32		commit;	/* end of the newest complete entry */
+	__u32		seq;	/* entries ever written up to 'commit' */
+	__u32		size;	/* size of the log, a power of two */
+};
+
 #define LOGGER_ENTRY_MAX_LEN		(4*1024)
 #define LOGGER_ENTRY_MAX_PAYLOAD	\
 	(LOGGER_ENTRY_MAX_LEN - sizeof(struct logger_entry))
@@ -45,5 +63,7 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_GET_POSITION		_IOR(__LOGGERIO, 5, \
+					     struct logger_position)
 
 #endif /* _LINUX_LOGGER_H */
@@ -16,6 +16,20 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * To refine this, the driver also watches how well page reclaim is doing.
+ * For every window of pages scanned it computes the share that could not
+ * be reclaimed and reports a "low", "medium" or "critical" pressure level
+ * (see the pressure_medium and pressure_critical parameters).  While that
+ * level is low, reclaim keeps up and only the first minfree threshold can
+ * trigger a kill.  From medium up, free memory is judged by what will be
+ * left pressure_lookahead_ms from now at the current net allocation rate.
+ * Set pressure_aware to 0 to go back to plain thresholds.
+ *
+ * Pressure levels are also reported through /dev/lowmem_pressure.  Writing
+ * a level to it selects the events that file gets; poll() then signals a
+ * new event and read() returns its level.  Writing "<eventfd> <level>"
+ * additionally signals the eventfd on each such event.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,7 +49,21 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/rcupdate.h>
+#include <linux/rculist_nulls.h>
 #include <linux/notifier.h>
+#include <linux/ktime.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+#include <linux/workqueue.h>
+#include <linux/miscdevice.h>
+#include <linux/eventfd.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/ctype.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/lowmemorykiller.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -71,6 +99,7 @@ static size_t fork_boost_adj[6] = {
 	12
 };
 
+static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 static unsigned long lowmem_fork_boost_timeout;
 static uint32_t lowmem_fork_boost = 1;
@@ -82,6 +111,301 @@ static int last_min_adj = OOM_ADJUST_MAX + 1;;
 			printk(x);			\
 	} while (0)
 
+/*
+ * Reclaim efficiency, estimated like vmpressure: for every window of
+ * pages scanned by page reclaim, the percentage that was not reclaimed.
+ * lowmem_vmpressure() only accumulates, the work item below evaluates
+ * each full window outside reclaim.
+ */
+enum {
+	LOWMEM_PRESSURE_NONE = -1,	/* no recent reclaim activity */
+	LOWMEM_PRESSURE_LOW,
+	LOWMEM_PRESSURE_MEDIUM,
+	LOWMEM_PRESSURE_CRITICAL,
+	LOWMEM_PRESSURE_LEVELS,
+};
+
+static const char * const lowmem_pressure_names[LOWMEM_PRESSURE_LEVELS] = {
+	"low",
+	"medium",
+	"critical",
+};
+
+#define LOWMEM_PRESSURE_WINDOW	(SWAP_CLUSTER_MAX * 16)
+
+static uint32_t lowmem_pressure_aware = 1;
+static uint32_t lowmem_pressure_medium = 60;
+static uint32_t lowmem_pressure_critical = 95;
+static uint32_t lowmem_pressure_lookahead_ms = 250;
+
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static unsigned long lowmem_pressure_scanned;
+static unsigned long lowmem_pressure_reclaimed;
+
+static int lowmem_pressure_level = LOWMEM_PRESSURE_NONE;
+static unsigned long lowmem_pressure_stamp;
+static unsigned long lowmem_alloc_rate;	/* net pages allocated per second */
+
+static unsigned long lowmem_vm_events[NR_VM_EVENT_ITEMS];
+static unsigned long lowmem_last_alloc, lowmem_last_free;
+static unsigned long lowmem_last_events_stamp;
+
+/* /dev/lowmem_pressure listeners */
+struct lowmem_pressure_listener {
+	struct list_head list;
+	struct eventfd_ctx *eventfd;
+	int level;		/* lowest level reported */
+	int last_level;		/* level of the latest event */
+	bool pending;		/* event not read yet */
+};
+
+static LIST_HEAD(lowmem_pressure_listeners);
+static DEFINE_MUTEX(lowmem_pressure_mutex);
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_pressure_wait);
+
+static void lowmem_pressure_work_fn(struct work_struct *work);
+static DECLARE_WORK(lowmem_pressure_work, lowmem_pressure_work_fn);
+
+void lowmem_vmpressure(gfp_t gfp_mask, unsigned long scanned,
+		       unsigned long reclaimed)
+{
+	/* only allocations for user pages tell about pressure on apps */
+	if (!(gfp_mask & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS)))
+		return;
+	if (!scanned)
+		return;
+
+	spin_lock(&lowmem_pressure_lock);
+	lowmem_pressure_scanned += scanned;
+	lowmem_pressure_reclaimed += reclaimed;
+	scanned = lowmem_pressure_scanned;
+	spin_unlock(&lowmem_pressure_lock);
+
+	if (scanned >= LOWMEM_PRESSURE_WINDOW)
+		schedule_work(&lowmem_pressure_work);
+}
+
+/* Net page allocation rate since the previous window, in pages/s */
+static void lowmem_update_alloc_rate(void)
+{
+	unsigned long alloc = 0, free, now = jiffies;
+	long delta;
+	int i;
+
+	all_vm_events(lowmem_vm_events);
+	for (i = PGALLOC_NORMAL - ZONE_NORMAL; i <= PGALLOC_MOVABLE; i++)
+		alloc += lowmem_vm_events[i];
+	free = lowmem_vm_events[PGFREE];
+
+	if (lowmem_last_events_stamp && now != lowmem_last_events_stamp) {
+		delta = (alloc - lowmem_last_alloc) - (free - lowmem_last_free);
+		if (delta > 0)
+			lowmem_alloc_rate = div_u64((u64)delta * HZ,
+					now - lowmem_last_events_stamp);
+		else
+			lowmem_alloc_rate = 0;
+	}
+	lowmem_last_alloc = alloc;
+	lowmem_last_free = free;
+	lowmem_last_events_stamp = now;
+}
+
+static void lowmem_pressure_work_fn(struct work_struct *work)
+{
+	struct lowmem_pressure_listener *listener;
+	unsigned long scanned, reclaimed, pressure = 0;
+	int level;
+
+	spin_lock(&lowmem_pressure_lock);
+	scanned = lowmem_pressure_scanned;
+	reclaimed = lowmem_pressure_reclaimed;
+	lowmem_pressure_scanned = 0;
+	lowmem_pressure_reclaimed = 0;
+	spin_unlock(&lowmem_pressure_lock);
+
+	if (!scanned)
+		return;
+	if (reclaimed < scanned)
+		pressure = (scanned - reclaimed) * 100 / scanned;
+
+	if (pressure >= lowmem_pressure_critical)
+		level = LOWMEM_PRESSURE_CRITICAL;
+	else if (pressure >= lowmem_pressure_medium)
+		level = LOWMEM_PRESSURE_MEDIUM;
+	else
+		level = LOWMEM_PRESSURE_LOW;
+
+	lowmem_update_alloc_rate();
+	lowmem_pressure_level = level;
+	lowmem_pressure_stamp = jiffies;
+	trace_lowmem_pressure(level, pressure, scanned, reclaimed,
+			      lowmem_alloc_rate);
+
+	mutex_lock(&lowmem_pressure_mutex);
+	list_for_each_entry(listener, &lowmem_pressure_listeners, list) {
+		if (level < listener->level)
+			continue;
+		listener->last_level = level;
+		listener->pending = true;
+		if (listener->eventfd)
+			eventfd_signal(listener->eventfd, 1);
+	}
+	mutex_unlock(&lowmem_pressure_mutex);
+	wake_up_interruptible(&lowmem_pressure_wait);
+}
+
+/* The pressure level to base kill decisions on */
+static int lowmem_pressure_get(void)
+{
+	if (!lowmem_pressure_aware ||
+	    time_after(jiffies, lowmem_pressure_stamp + HZ))
+		return LOWMEM_PRESSURE_NONE;
+	return lowmem_pressure_level;
+}
+
+/* Pages expected to be allocated within the lookahead interval */
+static int lowmem_pressure_lookahead(void)
+{
+	return min_t(unsigned long, INT_MAX / 2,
+		     lowmem_alloc_rate * lowmem_pressure_lookahead_ms / 1000);
+}
+
+static int lowmem_pressure_parse(const char *buf)
+{
+	int level;
+
+	for (level = 0; level < LOWMEM_PRESSURE_LEVELS; level++)
+		if (!strcmp(buf, lowmem_pressure_names[level]))
+			return level;
+	return -EINVAL;
+}
+
+static int lowmem_pressure_open(struct inode *inode, struct file *file)
+{
+	struct lowmem_pressure_listener *listener;
+
+	listener = kzalloc(sizeof(*listener), GFP_KERNEL);
+	if (!listener)
+		return -ENOMEM;
+	listener->level = LOWMEM_PRESSURE_LOW;
+	listener->last_level = LOWMEM_PRESSURE_NONE;
+
+	mutex_lock(&lowmem_pressure_mutex);
+	list_add_tail(&listener->list, &lowmem_pressure_listeners);
+	mutex_unlock(&lowmem_pressure_mutex);
+
+	file->private_data = listener;
+	return nonseekable_open(inode, file);
+}
+
+static int lowmem_pressure_release(struct inode *inode, struct file *file)
+{
+	struct lowmem_pressure_listener *listener = file->private_data;
+
+	mutex_lock(&lowmem_pressure_mutex);
+	list_del(&listener->list);
+	mutex_unlock(&lowmem_pressure_mutex);
+
+	if (listener->eventfd)
+		eventfd_ctx_put(listener->eventfd);
+	kfree(listener);
+	return 0;
+}
+
+/* Returns the level of the latest unread event, "none" if there is none */
+static ssize_t lowmem_pressure_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *pos)
+{
+	struct lowmem_pressure_listener *listener = file->private_data;
+	char kbuf[16];
+	int len;
+
+	mutex_lock(&lowmem_pressure_mutex);
+	len = snprintf(kbuf, sizeof(kbuf), "%s\n", listener->pending ?
+		       lowmem_pressure_names[listener->last_level] : "none");
+	listener->pending = false;
+	mutex_unlock(&lowmem_pressure_mutex);
+
+	if (count < len)
+		return -EINVAL;
+	if (copy_to_user(buf, kbuf, len))
+		return -EFAULT;
+	return len;
+}
+
+/* Accepts "<level>" or "<eventfd> <level>" */
+static ssize_t lowmem_pressure_write(struct file *file,
+				     const char __user *buf,
+				     size_t count, loff_t *pos)
+{
+	struct lowmem_pressure_listener *listener = file->private_data;
+	struct eventfd_ctx *eventfd = NULL;
+	char kbuf[32], *p;
+	int level;
+
+	if (count >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, buf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+	p = strim(kbuf);
+
+	if (isdigit(*p)) {
+		eventfd = eventfd_ctx_fdget(simple_strtoul(p, &p, 10));
+		if (IS_ERR(eventfd))
+			return PTR_ERR(eventfd);
+		p = skip_spaces(p);
+	}
+	level = lowmem_pressure_parse(p);
+	if (level < 0) {
+		if (eventfd)
+			eventfd_ctx_put(eventfd);
+		return level;
+	}
+
+	mutex_lock(&lowmem_pressure_mutex);
+	listener->level = level;
+	if (eventfd)
+		swap(listener->eventfd, eventfd);
+	mutex_unlock(&lowmem_pressure_mutex);
+
+	/* the eventfd that got replaced, if any */
+	if (eventfd)
+		eventfd_ctx_put(eventfd);
+	return count;
+}
+
+static unsigned int lowmem_pressure_poll(struct file *file, poll_table *wait)
+{
+	struct lowmem_pressure_listener *listener = file->private_data;
+	unsigned int ret = 0;
+
+	poll_wait(file, &lowmem_pressure_wait, wait);
+
+	mutex_lock(&lowmem_pressure_mutex);
+	if (listener->pending)
+		ret = POLLIN | POLLRDNORM;
+	mutex_unlock(&lowmem_pressure_mutex);
+
+	return ret;
+}
+
+static const struct file_operations lowmem_pressure_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_pressure_open,
+	.release = lowmem_pressure_release,
+	.read = lowmem_pressure_read,
+	.write = lowmem_pressure_write,
+	.poll = lowmem_pressure_poll,
+	.llseek = no_llseek,
+};
+
+static struct miscdevice lowmem_pressure_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "lowmem_pressure",
+	.fops = &lowmem_pressure_fops,
+};
+
 
 static void show_meminfo(void)
 {
@@ -134,6 +458,110 @@ static void dump_tasks(void)
 	}
 }
 
+/*
+ * Processes are kept in buckets by oom_adj so that a victim can be found
+ * without walking the whole task list.  A process is linked here for as
+ * long as it is on the task list, see copy_process(), de_thread() and
+ * __unhash_process(), and moves whenever its oom_adj is written.
+ *
+ * Updates are made under lowmem_adj_lock with tasklist_lock held, while
+ * lowmem_shrink() walks the buckets under RCU only.  A reader may follow
+ * a moving task into another bucket; the nulls value ending every chain
+ * tells it so and it restarts the bucket.
+ */
+#define LOWMEM_ADJ_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+static struct hlist_nulls_head lowmem_adj_buckets[LOWMEM_ADJ_BUCKETS];
+static bool lowmem_adj_buckets_ready;
+static DEFINE_SPINLOCK(lowmem_adj_lock);
+
+static int lowmem_adj_index(int oom_adj)
+{
+	return clamp(oom_adj, OOM_DISABLE, OOM_ADJUST_MAX) - OOM_DISABLE;
+}
+
+/*
+ * The first processes are forked long before lowmem_init(), so the
+ * buckets are set up by whoever needs them first.  Called with
+ * lowmem_adj_lock held.
+ */
+static void lowmem_adj_init_buckets(void)
+{
+	int i;
+
+	if (likely(lowmem_adj_buckets_ready))
+		return;
+	for (i = 0; i < LOWMEM_ADJ_BUCKETS; i++)
+		INIT_HLIST_NULLS_HEAD(&lowmem_adj_buckets[i], i);
+	lowmem_adj_buckets_ready = true;
+}
+
+/* Called with lowmem_adj_lock held */
+static void lowmem_adj_link(struct task_struct *p)
+{
+	lowmem_adj_init_buckets();
+	hlist_nulls_add_head_rcu(&p->lowmem_adj_node,
+		&lowmem_adj_buckets[lowmem_adj_index(p->signal->oom_adj)]);
+}
+
+/* The following three are called with tasklist_lock write-locked */
+void lowmem_adj_add(struct task_struct *p)
+{
+	spin_lock(&lowmem_adj_lock);
+	lowmem_adj_link(p);
+	spin_unlock(&lowmem_adj_lock);
+}
+
+void lowmem_adj_del(struct task_struct *p)
+{
+	spin_lock(&lowmem_adj_lock);
+	hlist_nulls_del_init_rcu(&p->lowmem_adj_node);
+	spin_unlock(&lowmem_adj_lock);
+}
+
+/* 'p' has exec'ed and takes over as thread group leader from 'old' */
+void lowmem_adj_replace(struct task_struct *old, struct task_struct *p)
+{
+	spin_lock(&lowmem_adj_lock);
+	hlist_nulls_del_init_rcu(&old->lowmem_adj_node);
+	lowmem_adj_link(p);
+	spin_unlock(&lowmem_adj_lock);
+}
+
+/* Move the process of 'task' to the bucket of its current oom_adj */
+void lowmem_adj_update(struct task_struct *task)
+{
+	struct task_struct *p;
+
+	read_lock(&tasklist_lock);
+	p = task->group_leader;
+	spin_lock(&lowmem_adj_lock);
+	if (!hlist_nulls_unhashed(&p->lowmem_adj_node)) {
+		hlist_nulls_del_rcu(&p->lowmem_adj_node);
+		lowmem_adj_link(p);
+	}
+	spin_unlock(&lowmem_adj_lock);
+	read_unlock(&tasklist_lock);
+}
+
+static int
+task_notify_func(struct notifier_block *self, unsigned long val, void *data);
+
+static struct notifier_block task_nb = {
+	.notifier_call	= task_notify_func,
+};
+
+static int
+task_notify_func(struct notifier_block *self, unsigned long val, void *data)
+{
+	struct task_struct *task = data;
+
+	if (task == lowmem_deathpending)
+		lowmem_deathpending = NULL;
+
+	return NOTIFY_OK;
+}
+
 static int
 task_fork_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -153,9 +581,13 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 {
 	struct task_struct *tsk;
 	struct task_struct *selected = NULL;
+	struct hlist_nulls_node *pos;
 	int rem = 0;
 	int tasksize;
 	int i;
+	int adj;
+	int scanned = 0;
+	ktime_t start;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
@@ -167,6 +599,8 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	int fork_boost = 0;
 	int *adj_array;
 	size_t *min_array;
+	int pressure = lowmem_pressure_get();
+	int lookahead = 0;
 
 	if (lowmem_fork_boost &&
 	    time_before_eq(jiffies, lowmem_fork_boost_timeout)) {
@@ -185,18 +619,24 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
+	if (pressure >= LOWMEM_PRESSURE_MEDIUM)
+		lookahead = lowmem_pressure_lookahead();
 	for (i = 0; i < array_size; i++) {
-		if (other_free < min_array[i] &&
+		if (other_free - lookahead < (int)min_array[i] &&
 		    (other_file < min_array[i])) {
+			/* reclaim keeps up, only kill to save the last level */
+			if (i > 0 && pressure == LOWMEM_PRESSURE_LOW)
+				break;
 			min_adj = adj_array[i];
 			fork_boost = lowmem_fork_boost_minfree[i];
 			break;
 		}
 	}
 	if (nr_to_scan > 0)
-		lowmem_print(3, "lowmem_shrink %d, %x, ofree %d %d, ma %d\n",
+		lowmem_print(3, "lowmem_shrink %d, %x, ofree %d %d, ma %d, "
+			     "pressure %d, lookahead %d\n",
 			     nr_to_scan, gfp_mask, other_free,
-				other_file, min_adj);
+				other_file, min_adj, pressure, lookahead);
 	rem = global_page_state(NR_ACTIVE_ANON) +
 		global_page_state(NR_ACTIVE_FILE) +
 		global_page_state(NR_INACTIVE_ANON) +
@@ -206,49 +646,71 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 			     nr_to_scan, gfp_mask, rem);
 		return rem;
 	}
+	/*
+	 * A task we already killed may sit in a bucket that is not walked
+	 * below, so remember it rather than relying on TIF_MEMDIE alone.
+	 */
+	if (lowmem_deathpending &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout))
+		return 0;
+
 	selected_oom_adj = min_adj;
+	start = ktime_get();
 
 	rcu_read_lock();
-	for_each_process(tsk) {
-		struct task_struct *p;
-		int oom_adj;
-
-		if (tsk->flags & PF_KTHREAD)
-			continue;
+	for (adj = OOM_ADJUST_MAX;
+	     adj >= max(min_adj, OOM_DISABLE) && !selected; adj--) {
+		i = lowmem_adj_index(adj);
+restart:
+		hlist_nulls_for_each_entry_rcu(tsk, pos,
+				&lowmem_adj_buckets[i], lowmem_adj_node) {
+			struct task_struct *p;
+			int oom_adj;
+
+			scanned++;
+			if (tsk->flags & PF_KTHREAD)
+				continue;
 
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
+			p = find_lock_task_mm(tsk);
+			if (!p)
+				continue;
 
-		if (test_tsk_thread_flag(p, TIF_MEMDIE) &&
-		    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-			task_unlock(p);
-			rcu_read_unlock();
-			return 0;
-		}
-		oom_adj = p->signal->oom_adj;
-		if (oom_adj < min_adj) {
+			if (test_tsk_thread_flag(p, TIF_MEMDIE) &&
+			    time_before_eq(jiffies,
+					   lowmem_deathpending_timeout)) {
+				task_unlock(p);
+				rcu_read_unlock();
+				return 0;
+			}
+			oom_adj = p->signal->oom_adj;
+			if (oom_adj < min_adj) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(p->mm);
 			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+			if (tasksize <= 0)
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			if (selected && tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n", p->pid, p->comm, oom_adj,
+				     tasksize);
+		}
+		/* followed a task that moved to another bucket */
+		if (get_nulls_value(pos) != i) {
+			selected = NULL;
+			goto restart;
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
 
+	trace_lowmem_select(min_adj, scanned, selected ? selected->pid : 0,
+			    selected_oom_adj, selected_tasksize,
+			    ktime_to_ns(ktime_sub(ktime_get(), start)));
+
 	if (selected) {
 		if (last_min_adj > selected_oom_adj &&
 			(selected_oom_adj == 12 || selected_oom_adj == 9 || selected_oom_adj == 7)) {
@@ -263,6 +725,7 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 			     current->comm, selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize << 2, min_adj,
 			     other_free << 2, other_file << 2, fork_boost << 2);
+		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
 		if (selected_oom_adj < 7)
 		{
@@ -286,15 +749,25 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	spin_lock(&lowmem_adj_lock);
+	lowmem_adj_init_buckets();
+	spin_unlock(&lowmem_adj_lock);
+
+	task_free_register(&task_nb);
 	task_fork_register(&task_fork_nb);
 	register_shrinker(&lowmem_shrinker);
+	if (misc_register(&lowmem_pressure_misc))
+		pr_err("lowmemorykiller: failed to register pressure device\n");
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	misc_deregister(&lowmem_pressure_misc);
 	unregister_shrinker(&lowmem_shrinker);
+	cancel_work_sync(&lowmem_pressure_work);
 	task_fork_unregister(&task_fork_nb);
+	task_free_unregister(&task_nb);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -304,6 +777,14 @@ module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
 module_param_named(fork_boost, lowmem_fork_boost, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_aware, lowmem_pressure_aware, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_medium, lowmem_pressure_medium, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_critical, lowmem_pressure_critical, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_lookahead_ms, lowmem_pressure_lookahead_ms, uint,
+		   S_IRUGO | S_IWUSR);
 module_param_array_named(fork_boost_minfree, lowmem_fork_boost_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 
@@ -27,6 +27,9 @@
 #include <linux/list.h>
 #include <linux/spinlock.h>
 #include <linux/atomic.h>
+#include <linux/err.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
 
 #include "tmem.h"
 
@@ -66,13 +69,23 @@ void tmem_register_pamops(struct tmem_pamops *m)
  * So an rb_tree is an ideal data structure to manage tmem_objs.  But because
  * of the potentially huge number of tmem_objs, each pool manages a hashtable
  * of rb_trees to reduce search, insert, delete, and rebalancing time.
- * Each hashbucket also has a lock to manage concurrent access.
+ * Each hashbucket also has a lock serializing inserts and deletes, which
+ * are bracketed by its seqcount.  Everything else, in particular the hot
+ * get/put/flush of a single page, finds its object without the hashbucket
+ * lock and then only takes the object's own lock.
  *
- * The following routines manage tmem_objs.  When any tmem_obj is accessed,
- * the hashbucket lock must be held.
+ * Lock order is hashbucket lock, then object lock.
  */
 
-/* searches for object==oid in pool, returns locked object if found */
+/*
+ * A lockless walk racing with a rebalance may be led astray.  It is always
+ * retried, but bound its length so that it can't chase a transient cycle.
+ */
+#define TMEM_OBJ_FIND_MAX_DEPTH	128
+/* lockless walks to attempt before falling back to the hashbucket lock */
+#define TMEM_OBJ_FIND_TRIES	4
+
+/* searches for object==oid in pool, caller holds the hashbucket lock */
 static struct tmem_obj *tmem_obj_find(struct tmem_hashbucket *hb,
 					struct tmem_oid *oidp)
 {
@@ -99,9 +112,84 @@ out:
 	return obj;
 }
 
+/*
+ * Lockless variant of tmem_obj_find, called under rcu_read_lock.  The
+ * result is only a hint: it may be an object being freed, or NULL or
+ * ERR_PTR(-EAGAIN) although the object exists.
+ */
+static struct tmem_obj *__tmem_obj_find_rcu(struct tmem_hashbucket *hb,
+					struct tmem_oid *oidp)
+{
+	struct rb_node *rbnode;
+	struct tmem_obj *obj;
+	int depth = 0;
+
+	rbnode = rcu_dereference_raw(hb->obj_rb_root.rb_node);
+	while (rbnode) {
+		if (++depth > TMEM_OBJ_FIND_MAX_DEPTH)
+			return ERR_PTR(-EAGAIN);
+		obj = rb_entry(rbnode, struct tmem_obj, rb_tree_node);
+		switch (tmem_oid_compare(oidp, &obj->oid)) {
+		case 0: /* equal */
+			return obj;
+		case -1:
+			rbnode = rcu_dereference_raw(rbnode->rb_left);
+			break;
+		case 1:
+			rbnode = rcu_dereference_raw(rbnode->rb_right);
+			break;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * searches for object==oid in pool, returns the object with its lock
+ * held if found.  The hashbucket lock is only taken if lockless walks
+ * keep racing with writers.  A freed object has its oid invalidated under
+ * its lock, so holding that lock with the oid still matching proves the
+ * object live.
+ */
+static struct tmem_obj *tmem_obj_find_lock(struct tmem_hashbucket *hb,
+					struct tmem_oid *oidp)
+{
+	struct tmem_obj *obj;
+	unsigned seq;
+	int tries;
+
+	rcu_read_lock();
+	for (tries = 0; tries < TMEM_OBJ_FIND_TRIES; tries++) {
+		seq = read_seqcount_begin(&hb->seq);
+		obj = __tmem_obj_find_rcu(hb, oidp);
+		if (obj == NULL) {
+			if (!read_seqcount_retry(&hb->seq, seq))
+				goto out;
+			continue;
+		}
+		if (IS_ERR(obj))
+			continue;
+		spin_lock(&obj->obj_spinlock);
+		if (tmem_oid_compare(&obj->oid, oidp) == 0)
+			goto out;
+		spin_unlock(&obj->obj_spinlock);
+	}
+	spin_lock(&hb->lock);
+	obj = tmem_obj_find(hb, oidp);
+	if (obj != NULL)
+		spin_lock(&obj->obj_spinlock);
+	spin_unlock(&hb->lock);
+out:
+	rcu_read_unlock();
+	return obj;
+}
+
 static void tmem_pampd_destroy_all_in_obj(struct tmem_obj *);
 
-/* free an object that has no more pampds in it */
+/*
+ * free an object that has no more pampds in it, called with both the
+ * hashbucket and object locks held.  The memory is handed back to the host
+ * by tmem_obj_release, which must be called after dropping the object lock.
+ */
 static void tmem_obj_free(struct tmem_obj *obj, struct tmem_hashbucket *hb)
 {
 	struct tmem_pool *pool;
@@ -118,13 +206,58 @@ static void tmem_obj_free(struct tmem_obj *obj, struct tmem_hashbucket *hb)
 	atomic_dec(&pool->obj_count);
 	BUG_ON(atomic_read(&pool->obj_count) < 0);
 	INVERT_SENTINEL(obj, OBJ);
-	obj->pool = NULL;
 	tmem_oid_set_invalid(&obj->oid);
+	write_seqcount_begin(&hb->seq);
 	rb_erase(&obj->rb_tree_node, &hb->obj_rb_root);
+	write_seqcount_end(&hb->seq);
+}
+
+static void tmem_obj_free_rcu(struct rcu_head *head)
+{
+	struct tmem_obj *obj = container_of(head, struct tmem_obj, rcu);
+
+	(*tmem_hostops.obj_free)(obj, obj->pool);
+}
+
+/* lockless lookups may still be looking at obj, defer the real free */
+static void tmem_obj_release(struct tmem_obj *obj)
+{
+	call_rcu(&obj->rcu, tmem_obj_free_rcu);
+}
+
+/*
+ * Drop the lock of an object that may have lost its last pampd, freeing
+ * it if so.  The hashbucket lock ranks first, so the object has to be
+ * unlocked and rechecked: a concurrent put may have refilled it, or a
+ * concurrent flush freed it already.
+ */
+static void tmem_obj_unlock_and_trim(struct tmem_obj *obj,
+					struct tmem_hashbucket *hb)
+{
+	bool freed = false;
+
+	if (obj->pampd_count > 0) {
+		spin_unlock(&obj->obj_spinlock);
+		return;
+	}
+	rcu_read_lock();
+	spin_unlock(&obj->obj_spinlock);
+	spin_lock(&hb->lock);
+	spin_lock(&obj->obj_spinlock);
+	if (tmem_oid_valid(&obj->oid) && obj->pampd_count == 0) {
+		tmem_obj_free(obj, hb);
+		freed = true;
+	}
+	spin_unlock(&obj->obj_spinlock);
+	spin_unlock(&hb->lock);
+	rcu_read_unlock();
+	if (freed)
+		tmem_obj_release(obj);
 }
 
 /*
- * initialize, and insert an tmem_object_root (called only if find failed)
+ * initialize, and insert an tmem_object_root (called only if find failed,
+ * with the hashbucket lock held)
  */
 static void tmem_obj_init(struct tmem_obj *obj, struct tmem_hashbucket *hb,
 					struct tmem_pool *pool,
@@ -142,7 +275,10 @@ static void tmem_obj_init(struct tmem_obj *obj, struct tmem_hashbucket *hb,
 	obj->oid = *oidp;
 	obj->objnode_count = 0;
 	obj->pampd_count = 0;
+	spin_lock_init(&obj->obj_spinlock);
 	SET_SENTINEL(obj, OBJ);
+	/* also orders the above before the object becomes reachable */
+	write_seqcount_begin(&hb->seq);
 	while (*new) {
 		BUG_ON(RB_EMPTY_NODE(*new));
 		this = rb_entry(*new, struct tmem_obj, rb_tree_node);
@@ -161,6 +297,7 @@ static void tmem_obj_init(struct tmem_obj *obj, struct tmem_hashbucket *hb,
 	}
 	rb_link_node(&obj->rb_tree_node, parent, new);
 	rb_insert_color(&obj->rb_tree_node, root);
+	write_seqcount_end(&hb->seq);
 }
 
 /*
@@ -186,9 +323,11 @@ static void tmem_pool_flush(struct tmem_pool *pool, bool destroy)
 		while (rbnode != NULL) {
 			obj = rb_entry(rbnode, struct tmem_obj, rb_tree_node);
 			rbnode = rb_next(rbnode);
+			spin_lock(&obj->obj_spinlock);
 			tmem_pampd_destroy_all_in_obj(obj);
 			tmem_obj_free(obj, hb);
-			(*tmem_hostops.obj_free)(obj, pool);
+			spin_unlock(&obj->obj_spinlock);
+			tmem_obj_release(obj);
 		}
 		spin_unlock(&hb->lock);
 	}
@@ -505,59 +644,48 @@ static void tmem_pampd_destroy_all_in_obj(struct tmem_obj *obj)
 int tmem_put(struct tmem_pool *pool, struct tmem_oid *oidp, uint32_t index,
 		struct page *page)
 {
-	struct tmem_obj *obj = NULL, *objfound = NULL, *objnew = NULL;
-	void *pampd = NULL, *pampd_del = NULL;
+	struct tmem_obj *obj;
+	void *pampd, *pampd_del;
 	int ret = -ENOMEM;
-	bool ephemeral;
 	struct tmem_hashbucket *hb;
 
-	ephemeral = is_ephemeral(pool);
 	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
-	spin_lock(&hb->lock);
-	obj = objfound = tmem_obj_find(hb, oidp);
-	if (obj != NULL) {
-		pampd = tmem_pampd_lookup_in_obj(objfound, index);
-		if (pampd != NULL) {
-			/* if found, is a dup put, flush the old one */
-			pampd_del = tmem_pampd_delete_from_obj(obj, index);
-			BUG_ON(pampd_del != pampd);
-			(*tmem_pamops.free)(pampd, pool);
-			if (obj->pampd_count == 0) {
-				objnew = obj;
-				objfound = NULL;
+	obj = tmem_obj_find_lock(hb, oidp);
+	if (obj == NULL) {
+		spin_lock(&hb->lock);
+		/* another put may have created it in the meantime */
+		obj = tmem_obj_find(hb, oidp);
+		if (obj == NULL) {
+			obj = (*tmem_hostops.obj_alloc)(pool);
+			if (unlikely(obj == NULL)) {
+				spin_unlock(&hb->lock);
+				goto out;
 			}
-			pampd = NULL;
-		}
-	} else {
-		obj = objnew = (*tmem_hostops.obj_alloc)(pool);
-		if (unlikely(obj == NULL)) {
-			ret = -ENOMEM;
-			goto out;
+			tmem_obj_init(obj, hb, pool, oidp);
 		}
-		tmem_obj_init(obj, hb, pool, oidp);
+		spin_lock(&obj->obj_spinlock);
+		spin_unlock(&hb->lock);
+	}
+	pampd = tmem_pampd_lookup_in_obj(obj, index);
+	if (pampd != NULL) {
+		/* if found, is a dup put, flush the old one */
+		pampd_del = tmem_pampd_delete_from_obj(obj, index);
+		BUG_ON(pampd_del != pampd);
+		(*tmem_pamops.free)(pampd, pool);
 	}
-	BUG_ON(obj == NULL);
-	BUG_ON(((objnew != obj) && (objfound != obj)) || (objnew == objfound));
 	pampd = (*tmem_pamops.create)(obj->pool, &obj->oid, index, page);
 	if (unlikely(pampd == NULL))
-		goto free;
+		goto unlock;
 	ret = tmem_pampd_add_to_obj(obj, index, pampd);
-	if (unlikely(ret == -ENOMEM))
+	if (unlikely(ret == -ENOMEM)) {
 		/* may have partially built objnode tree ("stump") */
-		goto delete_and_free;
-	goto out;
-
-delete_and_free:
-	(void)tmem_pampd_delete_from_obj(obj, index);
-free:
-	if (pampd)
+		(void)tmem_pampd_delete_from_obj(obj, index);
 		(*tmem_pamops.free)(pampd, pool);
-	if (objnew) {
-		tmem_obj_free(objnew, hb);
-		(*tmem_hostops.obj_free)(objnew, pool);
 	}
+unlock:
+	/* frees the object again if it was created for a failed put */
+	tmem_obj_unlock_and_trim(obj, hb);
 out:
-	spin_unlock(&hb->lock);
 	return ret;
 }
 
@@ -579,35 +707,28 @@ int tmem_get(struct tmem_pool *pool, struct tmem_oid *oidp,
 	struct tmem_obj *obj;
 	void *pampd;
 	bool ephemeral = is_ephemeral(pool);
-	uint32_t ret = -1;
+	int ret = -1;
 	struct tmem_hashbucket *hb;
 
 	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
-	spin_lock(&hb->lock);
-	obj = tmem_obj_find(hb, oidp);
+	obj = tmem_obj_find_lock(hb, oidp);
 	if (obj == NULL)
 		goto out;
-	ephemeral = is_ephemeral(pool);
 	if (ephemeral)
 		pampd = tmem_pampd_delete_from_obj(obj, index);
 	else
 		pampd = tmem_pampd_lookup_in_obj(obj, index);
 	if (pampd == NULL)
-		goto out;
+		goto unlock;
 	ret = (*tmem_pamops.get_data)(page, pampd, pool);
 	if (ret < 0)
-		goto out;
-	if (ephemeral) {
+		goto unlock;
+	if (ephemeral)
 		(*tmem_pamops.free)(pampd, pool);
-		if (obj->pampd_count == 0) {
-			tmem_obj_free(obj, hb);
-			(*tmem_hostops.obj_free)(obj, pool);
-			obj = NULL;
-		}
-	}
 	ret = 0;
+unlock:
+	tmem_obj_unlock_and_trim(obj, hb);
 out:
-	spin_unlock(&hb->lock);
 	return ret;
 }
 
@@ -625,22 +746,18 @@ int tmem_flush_page(struct tmem_pool *pool,
 	struct tmem_hashbucket *hb;
 
 	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
-	spin_lock(&hb->lock);
-	obj = tmem_obj_find(hb, oidp);
+	obj = tmem_obj_find_lock(hb, oidp);
 	if (obj == NULL)
 		goto out;
 	pampd = tmem_pampd_delete_from_obj(obj, index);
 	if (pampd == NULL)
-		goto out;
+		goto unlock;
 	(*tmem_pamops.free)(pampd, pool);
-	if (obj->pampd_count == 0) {
-		tmem_obj_free(obj, hb);
-		(*tmem_hostops.obj_free)(obj, pool);
-	}
 	ret = 0;
 
+unlock:
+	tmem_obj_unlock_and_trim(obj, hb);
 out:
-	spin_unlock(&hb->lock);
 	return ret;
 }
 
@@ -658,19 +775,24 @@ int tmem_flush_object(struct tmem_pool *pool, struct tmem_oid *oidp)
 	obj = tmem_obj_find(hb, oidp);
 	if (obj == NULL)
 		goto out;
+	spin_lock(&obj->obj_spinlock);
 	tmem_pampd_destroy_all_in_obj(obj);
 	tmem_obj_free(obj, hb);
-	(*tmem_hostops.obj_free)(obj, pool);
+	spin_unlock(&obj->obj_spinlock);
 	ret = 0;
 
 out:
 	spin_unlock(&hb->lock);
+	if (obj != NULL)
+		tmem_obj_release(obj);
 	return ret;
 }
 
 /*
  * "Flush" all pages (and tmem_objs) from this tmem_pool and disable
- * all subsequent access to this tmem_pool.
+ * all subsequent access to this tmem_pool.  The objects reach the host's
+ * obj_free only after an RCU grace period, so the host must rcu_barrier()
+ * before freeing the pool itself.
  */
 int tmem_destroy_pool(struct tmem_pool *pool)
 {
@@ -700,6 +822,7 @@ void tmem_new_pool(struct tmem_pool *pool, uint32_t flags)
 	for (i = 0; i < TMEM_HASH_BUCKETS; i++, hb++) {
 		hb->obj_rb_root = RB_ROOT;
 		spin_lock_init(&hb->lock);
+		seqcount_init(&hb->seq);
 	}
 	INIT_LIST_HEAD(&pool->pool_list);
 	atomic_set(&pool->obj_count, 0);
@@ -13,6 +13,9 @@
 #include <linux/highmem.h>
 #include <linux/hash.h>
 #include <linux/atomic.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock.h>
 
 /*
  * These are pre-defined by the Xen<->Linux ABI
@@ -54,7 +57,9 @@
  * usually corresponds to a large independent set of pages such as
  * a filesystem.  Each pool has an id, and certain attributes and counters.
  * It also contains a set of hash buckets, each of which contains an rbtree
- * of objects and a lock to manage concurrency within the pool.
+ * of objects.  The bucket lock serializes changes to the rbtree only;
+ * lookups walk it locklessly and use the sequence count to detect that
+ * they raced with a rebalance.
  */
 
 #define TMEM_HASH_BUCKET_BITS	8
@@ -63,6 +68,7 @@
 struct tmem_hashbucket {
 	struct rb_root obj_rb_root;
 	spinlock_t lock;
+	seqcount_t seq;
 };
 
 struct tmem_pool {
@@ -134,7 +140,10 @@ static inline unsigned tmem_oid_hash(struct tmem_oid *oidp)
  * A tmem_obj contains an identifier (oid), pointers to the parent
  * pool and the rb_tree to which it belongs, counters, and an ordered
  * set of pampds, structured in a radix-tree-like tree.  The intermediate
- * nodes of the tree are called tmem_objnodes.
+ * nodes of the tree are called tmem_objnodes.  The tree and counters are
+ * protected by the object's own lock, taken after the hashbucket lock
+ * when both are needed.  Objects are freed after an RCU grace period so
+ * that lockless lookups never see freed memory.
  */
 
 struct tmem_objnode;
@@ -147,6 +156,8 @@ struct tmem_obj {
 	unsigned int objnode_tree_height;
 	unsigned long objnode_count;
 	long pampd_count;
+	spinlock_t obj_spinlock;
+	struct rcu_head rcu;
 	DECL_SENTINEL
 };
 
@@ -64,6 +64,12 @@
  * (3) one of PAGE_SIZE/64 "unbuddied" lists indexed by how many chunks
  * the one unbuddied zbud uses.  The data inside a zbpg cannot be
  * read or written unless the zbpg's lock is held.
+ *
+ * Every zbpg holding at least one zbud is also on the zbud LRU list,
+ * ordered by the time a zbud was last placed in it.  Ephemeral gets are
+ * exclusive, so a zbud is never accessed twice and the time since its
+ * put is all there is to know about its value; since a zbpg can only be
+ * reclaimed as a whole, it is aged by its youngest zbud.
  */
 
 #define ZBH_SENTINEL  0x43214321
@@ -76,11 +82,13 @@ struct zbud_hdr {
 	struct tmem_oid oid;
 	uint32_t index;
 	uint16_t size; /* compressed size in bytes, zero means unused */
+	unsigned long put_jiffies;
 	DECL_SENTINEL
 };
 
 struct zbud_page {
 	struct list_head bud_list;
+	struct list_head lru;
 	spinlock_t lock;
 	struct zbud_hdr buddy[ZBUD_MAX_BUDS];
 	DECL_SENTINEL
@@ -105,7 +113,9 @@ static unsigned long zbud_cumul_chunk_counts[NCHUNKS];
 struct list_head zbud_buddied_list;
 static unsigned long zcache_zbud_buddied_count;
 
-/* protects the buddied list and all unbuddied lists */
+static LIST_HEAD(zbud_lru_list);
+
+/* protects the buddied list, all unbuddied lists and the lru list */
 static DEFINE_SPINLOCK(zbud_budlists_spinlock);
 
 static LIST_HEAD(zbpg_unused_list);
@@ -121,6 +131,15 @@ static unsigned long zcache_zbud_cumul_zpages;
 static unsigned long zcache_zbud_cumul_zbytes;
 static unsigned long zcache_compress_poor;
 
+/*
+ * Age of a zbud when it left zcache, either through a get (a hit) or
+ * through eviction.  Bucket N covers ages below 4^N seconds, the last
+ * bucket everything older.
+ */
+#define ZBUD_AGE_BUCKETS 6
+static unsigned long zbud_age_hits[ZBUD_AGE_BUCKETS];
+static unsigned long zbud_age_evictions[ZBUD_AGE_BUCKETS];
+
 /* forward references */
 static void *zcache_get_free_page(void);
 static void zcache_free_page(void *p);
@@ -176,6 +195,17 @@ static char *zbud_data(struct zbud_hdr *zh, unsigned size)
 	return p;
 }
 
+static int zbud_age_bucket(struct zbud_hdr *zh)
+{
+	unsigned long age = jiffies - zh->put_jiffies;
+	int i;
+
+	for (i = 0; i < ZBUD_AGE_BUCKETS - 1; i++)
+		if (age < ((unsigned long)HZ << (2 * i)))
+			break;
+	return i;
+}
+
 /*
  * zbud raw page management
  */
@@ -201,6 +231,7 @@ static struct zbud_page *zbud_alloc_raw_page(void)
 		zbpg = zcache_get_free_page();
 	if (likely(zbpg != NULL)) {
 		INIT_LIST_HEAD(&zbpg->bud_list);
+		INIT_LIST_HEAD(&zbpg->lru);
 		zh0 = &zbpg->buddy[0]; zh1 = &zbpg->buddy[1];
 		spin_lock_init(&zbpg->lock);
 		if (recycled) {
@@ -226,6 +257,7 @@ static void zbud_free_raw_page(struct zbud_page *zbpg)
 
 	ASSERT_SENTINEL(zbpg, ZBPG);
 	BUG_ON(!list_empty(&zbpg->bud_list));
+	BUG_ON(!list_empty(&zbpg->lru));
 	ASSERT_SPINLOCK(&zbpg->lock);
 	BUG_ON(zh0->size != 0 || tmem_oid_valid(&zh0->oid));
 	BUG_ON(zh1->size != 0 || tmem_oid_valid(&zh1->oid));
@@ -280,6 +312,7 @@ static void zbud_free_and_delist(struct zbud_hdr *zh)
 		BUG_ON(list_empty(&zbud_unbuddied[chunks].list));
 		list_del_init(&zbpg->bud_list);
 		zbud_unbuddied[chunks].count--;
+		list_del_init(&zbpg->lru);
 		spin_unlock(&zbud_budlists_spinlock);
 		zbud_free_raw_page(zbpg);
 	} else { /* was buddied: move remaining buddy to unbuddied list */
@@ -327,6 +360,7 @@ static struct zbud_hdr *zbud_create(uint32_t pool_id, struct tmem_oid *oid,
 	spin_lock(&zbud_budlists_spinlock);
 	list_add_tail(&zbpg->bud_list, &zbud_unbuddied[nchunks].list);
 	zbud_unbuddied[nchunks].count++;
+	list_add_tail(&zbpg->lru, &zbud_lru_list);
 	zh = &zbpg->buddy[0];
 	goto init_zh;
 
@@ -346,6 +380,7 @@ found_unbuddied:
 	zbud_unbuddied[found_good_buddy].count--;
 	list_add_tail(&zbpg->bud_list, &zbud_buddied_list);
 	zcache_zbud_buddied_count++;
+	list_move_tail(&zbpg->lru, &zbud_lru_list);
 
 init_zh:
 	SET_SENTINEL(zh, ZBH);
@@ -353,6 +388,7 @@ init_zh:
 	zh->index = index;
 	zh->oid = *oid;
 	zh->pool_id = pool_id;
+	zh->put_jiffies = jiffies;
 	/* can wait to copy the data until the list locks are dropped */
 	spin_unlock(&zbud_budlists_spinlock);
 
@@ -393,6 +429,7 @@ static int zbud_decompress(struct page *page, struct zbud_hdr *zh)
 	BUG_ON(ret != LZO_E_OK);
 	BUG_ON(out_len != PAGE_SIZE);
 	kunmap_atomic(to_va, KM_USER0);
+	zbud_age_hits[zbud_age_bucket(zh)]++;
 out:
 	spin_unlock(&zbpg->lock);
 	return ret;
@@ -400,7 +437,7 @@ out:
 
 /*
  * The following routines handle shrinking of ephemeral pages by evicting
- * pages "least valuable" first.
+ * pages "least valuable", i.e. least recently filled, first.
  */
 
 static unsigned long zcache_evicted_raw_pages;
@@ -430,6 +467,7 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 			oid[j] = zh->oid;
 			index[j] = zh->index;
 			j++;
+			zbud_age_evictions[zbud_age_bucket(zh)]++;
 			zbud_free(zh);
 		}
 	}
@@ -446,6 +484,29 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 	zbud_free_raw_page(zbpg);
 }
 
+/*
+ * Take a locked zbpg chosen for eviction off its buddied or unbuddied
+ * list and the lru list, which turns it into a zombie that gets and
+ * flushes will ignore.
+ */
+static void zbud_unlist_zbpg(struct zbud_page *zbpg)
+{
+	struct zbud_hdr *zh0 = &zbpg->buddy[0], *zh1 = &zbpg->buddy[1];
+
+	ASSERT_SPINLOCK(&zbpg->lock);
+	ASSERT_SPINLOCK(&zbud_budlists_spinlock);
+	list_del_init(&zbpg->bud_list);
+	list_del_init(&zbpg->lru);
+	if (zh0->size != 0 && zh1->size != 0) {
+		zcache_zbud_buddied_count--;
+		zcache_evicted_buddied_pages++;
+	} else {
+		zbud_unbuddied[zbud_size_to_chunks(zh0->size ?
+					zh0->size : zh1->size)].count--;
+		zcache_evicted_unbuddied_pages++;
+	}
+}
+
 /*
  * Free nr pages.  This code is funky because we want to hold the locks
  * protecting various lists for as short a time as possible, and in some
@@ -457,7 +518,6 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 static void zbud_evict_pages(int nr)
 {
 	struct zbud_page *zbpg;
-	int i;
 
 	/* first try freeing any pages on unused list */
 retry_unused_list:
@@ -478,51 +538,20 @@ retry_unused_list:
 	}
 	spin_unlock_bh(&zbpg_unused_list_spinlock);
 
-	/* now try freeing unbuddied pages, starting with least space avail */
-	for (i = 0; i < MAX_CHUNK; i++) {
-retry_unbud_list_i:
-		spin_lock_bh(&zbud_budlists_spinlock);
-		if (list_empty(&zbud_unbuddied[i].list)) {
-			spin_unlock_bh(&zbud_budlists_spinlock);
-			continue;
-		}
-		list_for_each_entry(zbpg, &zbud_unbuddied[i].list, bud_list) {
-			if (unlikely(!spin_trylock(&zbpg->lock)))
-				continue;
-			list_del_init(&zbpg->bud_list);
-			zbud_unbuddied[i].count--;
-			spin_unlock(&zbud_budlists_spinlock);
-			zcache_evicted_unbuddied_pages++;
-			/* want budlists unlocked when doing zbpg eviction */
-			zbud_evict_zbpg(zbpg);
-			local_bh_enable();
-			if (--nr <= 0)
-				goto out;
-			goto retry_unbud_list_i;
-		}
-		spin_unlock_bh(&zbud_budlists_spinlock);
-	}
-
-	/* as a last resort, free buddied pages */
-retry_bud_list:
+	/* now free the least recently filled pages */
+retry_lru_list:
 	spin_lock_bh(&zbud_budlists_spinlock);
-	if (list_empty(&zbud_buddied_list)) {
-		spin_unlock_bh(&zbud_budlists_spinlock);
-		goto out;
-	}
-	list_for_each_entry(zbpg, &zbud_buddied_list, bud_list) {
+	list_for_each_entry(zbpg, &zbud_lru_list, lru) {
 		if (unlikely(!spin_trylock(&zbpg->lock)))
 			continue;
-		list_del_init(&zbpg->bud_list);
-		zcache_zbud_buddied_count--;
+		zbud_unlist_zbpg(zbpg);
 		spin_unlock(&zbud_budlists_spinlock);
-		zcache_evicted_buddied_pages++;
 		/* want budlists unlocked when doing zbpg eviction */
 		zbud_evict_zbpg(zbpg);
 		local_bh_enable();
 		if (--nr <= 0)
 			goto out;
-		goto retry_bud_list;
+		goto retry_lru_list;
 	}
 	spin_unlock_bh(&zbud_budlists_spinlock);
 out:
@@ -582,6 +611,44 @@ static int zbud_show_cumul_chunk_counts(char *buf)
 		chunks == 0 ? 0 : sum_total_chunks / chunks);
 	return p - buf;
 }
+
+/*
+ * Hits, evictions and the resulting hit ratio (in percent) for each
+ * age bucket, youngest first.  Bucket N is labelled with its upper
+ * bound of 4^N seconds.
+ */
+static int zbud_show_age_counts(char *buf, unsigned long *counts)
+{
+	int i;
+	char *p = buf;
+
+	for (i = 0; i < ZBUD_AGE_BUCKETS - 1; i++)
+		p += sprintf(p, "<%us:%lu ", 1U << (2 * i), counts[i]);
+	p += sprintf(p, "older:%lu\n", counts[i]);
+	return p - buf;
+}
+
+static int zbud_show_age_hits(char *buf)
+{
+	return zbud_show_age_counts(buf, zbud_age_hits);
+}
+
+static int zbud_show_age_evictions(char *buf)
+{
+	return zbud_show_age_counts(buf, zbud_age_evictions);
+}
+
+static int zbud_show_age_hit_ratio(char *buf)
+{
+	unsigned long hit_ratio[ZBUD_AGE_BUCKETS], total;
+	int i;
+
+	for (i = 0; i < ZBUD_AGE_BUCKETS; i++) {
+		total = zbud_age_hits[i] + zbud_age_evictions[i];
+		hit_ratio[i] = total == 0 ? 0 : zbud_age_hits[i] * 100 / total;
+	}
+	return zbud_show_age_counts(buf, hit_ratio);
+}
 #endif
 
 /**********
@@ -1130,6 +1197,9 @@ ZCACHE_SYSFS_RO_CUSTOM(zbud_unbuddied_list_counts,
 			zbud_show_unbuddied_list_counts);
 ZCACHE_SYSFS_RO_CUSTOM(zbud_cumul_chunk_counts,
 			zbud_show_cumul_chunk_counts);
+ZCACHE_SYSFS_RO_CUSTOM(zbud_age_hits, zbud_show_age_hits);
+ZCACHE_SYSFS_RO_CUSTOM(zbud_age_evictions, zbud_show_age_evictions);
+ZCACHE_SYSFS_RO_CUSTOM(zbud_age_hit_ratio, zbud_show_age_hit_ratio);
 
 static struct attribute *zcache_attrs[] = {
 	&zcache_curr_obj_count_attr.attr,
@@ -1160,6 +1230,9 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_aborted_shrink_attr.attr,
 	&zcache_zbud_unbuddied_list_counts_attr.attr,
 	&zcache_zbud_cumul_chunk_counts_attr.attr,
+	&zcache_zbud_age_hits_attr.attr,
+	&zcache_zbud_age_evictions_attr.attr,
+	&zcache_zbud_age_hit_ratio_attr.attr,
 	NULL,
 };
 
@@ -1180,6 +1253,7 @@ static bool zcache_freeze;
 
 /*
  * zcache shrinker interface (only useful for ephemeral pages, so zbud only)
+ * Pages are given back in zbud LRU order, see zbud_evict_pages().
  */
 static int shrink_zcache_memory(struct shrinker *shrink, int nr, gfp_t gfp_mask)
 {
@@ -1316,6 +1390,8 @@ static int zcache_destroy_pool(int pool_id)
 	local_bh_disable();
 	ret = tmem_destroy_pool(pool);
 	local_bh_enable();
+	/* objects are freed through RCU and still point to the pool */
+	rcu_barrier();
 	kfree(pool);
 	pr_info("zcache: destroyed pool id=%d\n", pool_id);
 out:
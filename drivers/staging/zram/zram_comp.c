@@ -0,0 +1,191 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com/
+ */
+
+#include <linux/kernel.h>
+#include <linux/crypto.h>
+#include <linux/err.h>
+#include <linux/lzo.h>
+#include <linux/lz4.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zram_drv.h"
+
+/* LZO: fast compression, the historical default */
+static void *zram_lzo_create(void)
+{
+	return kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+}
+
+static void zram_lzo_destroy(void *private)
+{
+	kfree(private);
+}
+
+static int zram_lzo_compress(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *private)
+{
+	return lzo1x_1_compress(src, PAGE_SIZE, dst, dst_len, private);
+}
+
+static int zram_lzo_decompress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, void *private)
+{
+	size_t dst_len = PAGE_SIZE;
+
+	return lzo1x_decompress_safe(src, src_len, dst, &dst_len);
+}
+
+static const struct zram_compressor zram_lzo = {
+	.name = "lzo",
+	.create = zram_lzo_create,
+	.destroy = zram_lzo_destroy,
+	.compress = zram_lzo_compress,
+	.decompress = zram_lzo_decompress,
+};
+
+#ifdef CONFIG_ZRAM_LZ4
+/* LZ4: similar ratio to LZO with much faster decompression */
+static void *zram_lz4_create(void)
+{
+	return kzalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
+}
+
+static void zram_lz4_destroy(void *private)
+{
+	kfree(private);
+}
+
+static int zram_lz4_compress(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *private)
+{
+	return lz4_compress(src, PAGE_SIZE, dst, dst_len, private);
+}
+
+static int zram_lz4_decompress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, void *private)
+{
+	size_t dst_len = PAGE_SIZE;
+
+	return lz4_decompress_unknownoutputsize(src, src_len, dst, &dst_len);
+}
+
+static const struct zram_compressor zram_lz4 = {
+	.name = "lz4",
+	.create = zram_lz4_create,
+	.destroy = zram_lz4_destroy,
+	.compress = zram_lz4_compress,
+	.decompress = zram_lz4_decompress,
+};
+#endif
+
+#ifdef CONFIG_ZRAM_DEFLATE
+/*
+ * Deflate through the crypto API: best ratio, slowest. The transform
+ * keeps zlib stream state, so decompression needs a stream too.
+ */
+static void *zram_deflate_create(void)
+{
+	struct crypto_comp *tfm;
+
+	tfm = crypto_alloc_comp("deflate", 0, 0);
+	if (IS_ERR(tfm))
+		return NULL;
+
+	return tfm;
+}
+
+static void zram_deflate_destroy(void *private)
+{
+	crypto_free_comp(private);
+}
+
+static int zram_deflate_compress(const unsigned char *src,
+			unsigned char *dst, size_t *dst_len, void *private)
+{
+	int ret;
+	unsigned int dlen = 2 * PAGE_SIZE;
+
+	ret = crypto_comp_compress(private, src, PAGE_SIZE, dst, &dlen);
+	*dst_len = dlen;
+
+	return ret;
+}
+
+static int zram_deflate_decompress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, void *private)
+{
+	unsigned int dlen = PAGE_SIZE;
+
+	return crypto_comp_decompress(private, src, src_len, dst, &dlen);
+}
+
+static const struct zram_compressor zram_deflate = {
+	.name = "deflate",
+	.create = zram_deflate_create,
+	.destroy = zram_deflate_destroy,
+	.compress = zram_deflate_compress,
+	.decompress = zram_deflate_decompress,
+	.decompress_needs_strm = 1,
+};
+#endif
+
+static const struct zram_compressor *zram_compressors[] = {
+	&zram_lzo,
+#ifdef CONFIG_ZRAM_LZ4
+	&zram_lz4,
+#endif
+#ifdef CONFIG_ZRAM_DEFLATE
+	&zram_deflate,
+#endif
+	NULL
+};
+
+const struct zram_compressor *zram_comp_default(void)
+{
+	return zram_compressors[0];
+}
+
+const struct zram_compressor *zram_comp_find(const char *name)
+{
+	int i;
+
+	for (i = 0; zram_compressors[i]; i++) {
+		if (sysfs_streq(name, zram_compressors[i]->name))
+			return zram_compressors[i];
+	}
+
+	return NULL;
+}
+
+/* List all backends, with the one in use in brackets */
+ssize_t zram_comp_available_show(const struct zram_compressor *cur,
+			char *buf)
+{
+	int i;
+	ssize_t sz = 0;
+
+	for (i = 0; zram_compressors[i]; i++) {
+		if (zram_compressors[i] == cur)
+			sz += sprintf(buf + sz, "[%s] ",
+					zram_compressors[i]->name);
+		else
+			sz += sprintf(buf + sz, "%s ",
+					zram_compressors[i]->name);
+	}
+	sz += sprintf(buf + sz, "\n");
+
+	return sz;
+}
@@ -0,0 +1,189 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com/
+ */
+
+/*
+ * Same-page deduplication. Every stored object is described by a
+ * zram_entry which may be shared by several table slots. While dedup
+ * is enabled, entries are also indexed by a checksum of their stored
+ * bytes in a hash of rbtrees. Since all compressors are deterministic,
+ * two pages are identical exactly when their compressed forms are, so
+ * candidates are confirmed by comparing stored bytes directly and never
+ * need to be decompressed.
+ */
+
+#include <linux/kernel.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/rbtree.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/* Disk pages per hash bucket */
+#define ZRAM_HASH_PAGES_PER_BUCKET	16
+
+u32 zram_dedup_checksum(const unsigned char *mem, size_t len)
+{
+	return jhash(mem, len, 0);
+}
+
+static struct zram_hash *zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->hash[checksum & (zram->hash_size - 1)];
+}
+
+/*
+ * Drop a reference to an entry, unhashing it with the last one.
+ * Returns the number of references left.
+ */
+unsigned long zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	struct zram_hash *hash;
+	unsigned long refcount;
+
+	if (RB_EMPTY_NODE(&entry->rb_node))
+		return --entry->refcount;
+
+	hash = zram_dedup_bucket(zram, entry->checksum);
+	spin_lock(&hash->lock);
+	refcount = --entry->refcount;
+	if (!refcount)
+		rb_erase(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+
+	return refcount;
+}
+
+static int zram_dedup_match(struct zram *zram, struct zram_entry *entry,
+			const unsigned char *mem, size_t len)
+{
+	int match;
+	unsigned char *cmem;
+
+	if (entry->len != len)
+		return 0;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	match = !memcmp(cmem, mem, len);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return match;
+}
+
+/*
+ * Look for an already stored object holding exactly 'len' bytes of
+ * 'mem'. On success the entry is returned with an extra reference.
+ */
+struct zram_entry *zram_dedup_find(struct zram *zram,
+			const unsigned char *mem, size_t len, u32 checksum)
+{
+	struct rb_node *rb_node;
+	struct zram_entry *entry = NULL;
+	struct zram_hash *hash = zram_dedup_bucket(zram, checksum);
+
+	spin_lock(&hash->lock);
+	rb_node = hash->rb_root.rb_node;
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (checksum == entry->checksum)
+			break;
+		rb_node = checksum < entry->checksum ?
+				rb_node->rb_left : rb_node->rb_right;
+	}
+
+	if (!rb_node) {
+		spin_unlock(&hash->lock);
+		return NULL;
+	}
+
+	/* Equal checksums may sit on either side; rewind to the first */
+	while ((rb_node = rb_prev(&entry->rb_node))) {
+		struct zram_entry *prev;
+
+		prev = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (prev->checksum != checksum)
+			break;
+		entry = prev;
+	}
+
+	for (rb_node = &entry->rb_node; rb_node; rb_node = rb_next(rb_node)) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (entry->checksum != checksum)
+			break;
+		if (zram_dedup_match(zram, entry, mem, len)) {
+			entry->refcount++;
+			spin_unlock(&hash->lock);
+			return entry;
+		}
+	}
+	spin_unlock(&hash->lock);
+
+	return NULL;
+}
+
+/* Make a freshly written entry visible to zram_dedup_find() */
+void zram_dedup_insert(struct zram *zram, struct zram_entry *entry,
+			u32 checksum)
+{
+	struct rb_node **rb_node, *parent = NULL;
+	struct zram_hash *hash = zram_dedup_bucket(zram, checksum);
+
+	entry->checksum = checksum;
+
+	spin_lock(&hash->lock);
+	rb_node = &hash->rb_root.rb_node;
+	while (*rb_node) {
+		struct zram_entry *cur;
+
+		parent = *rb_node;
+		cur = rb_entry(parent, struct zram_entry, rb_node);
+		if (checksum < cur->checksum)
+			rb_node = &parent->rb_left;
+		else
+			rb_node = &parent->rb_right;
+	}
+
+	rb_link_node(&entry->rb_node, parent, rb_node);
+	rb_insert_color(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	size_t i;
+
+	zram->hash_size = num_pages / ZRAM_HASH_PAGES_PER_BUCKET;
+	zram->hash_size = zram->hash_size ?
+			rounddown_pow_of_two(zram->hash_size) : 1;
+
+	zram->hash = vzalloc(zram->hash_size * sizeof(*zram->hash));
+	if (!zram->hash)
+		return -ENOMEM;
+
+	for (i = 0; i < zram->hash_size; i++) {
+		spin_lock_init(&zram->hash[i].lock);
+		zram->hash[i].rb_root = RB_ROOT;
+	}
+
+	return 0;
+}
+
+void zram_dedup_fini(struct zram *zram)
+{
+	vfree(zram->hash);
+	zram->hash = NULL;
+	zram->hash_size = 0;
+}
@@ -29,9 +29,12 @@
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
@@ -42,14 +45,14 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
+static void zram_stat_inc(atomic_t *v)
 {
-	*v = *v + 1;
+	atomic_inc(v);
 }
 
-static void zram_stat_dec(u32 *v)
+static void zram_stat_dec(atomic_t *v)
 {
-	*v = *v - 1;
+	atomic_dec(v);
 }
 
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
@@ -133,15 +136,322 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
-static void zram_free_page(struct zram *zram, size_t index)
+/*
+ * Grab the compression stream of the CPU we are running on. We may
+ * be migrated while holding it, in which case another writer on that
+ * CPU simply waits on the stream mutex.
+ */
+static struct zram_comp_strm *zram_comp_strm_get(struct zram *zram)
+{
+	struct zram_comp_strm *zstrm;
+
+	zstrm = per_cpu_ptr(zram->comp_strm, raw_smp_processor_id());
+	mutex_lock(&zstrm->lock);
+
+	return zstrm;
+}
+
+static void zram_comp_strm_put(struct zram_comp_strm *zstrm)
+{
+	mutex_unlock(&zstrm->lock);
+}
+
+static void zram_comp_strm_destroy(struct zram *zram)
+{
+	int cpu;
+
+	if (!zram->comp_strm)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_strm *zstrm;
+
+		zstrm = per_cpu_ptr(zram->comp_strm, cpu);
+		if (zstrm->private)
+			zram->comp->destroy(zstrm->private);
+		free_pages((unsigned long)zstrm->buffer, 1);
+	}
+
+	free_percpu(zram->comp_strm);
+	zram->comp_strm = NULL;
+}
+
+static int zram_comp_strm_create(struct zram *zram)
+{
+	int cpu;
+
+	zram->comp_strm = alloc_percpu(struct zram_comp_strm);
+	if (!zram->comp_strm)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_strm *zstrm;
+
+		zstrm = per_cpu_ptr(zram->comp_strm, cpu);
+		mutex_init(&zstrm->lock);
+
+		zstrm->private = zram->comp->create();
+		if (!zstrm->private) {
+			pr_err("Error allocating %s compressor state "
+				"for cpu %d\n", zram->comp->name, cpu);
+			goto fail;
+		}
+
+		/* output may exceed PAGE_SIZE for incompressible data */
+		zstrm->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!zstrm->buffer) {
+			pr_err("Error allocating compressor buffer space "
+				"for cpu %d\n", cpu);
+			goto fail;
+		}
+	}
+
+	return 0;
+
+fail:
+	zram_comp_strm_destroy(zram);
+	return -ENOMEM;
+}
+
+/*
+ * Allocate a new, unshared entry with room for 'len' bytes. It only
+ * becomes visible to deduplication once passed to zram_dedup_insert().
+ */
+static struct zram_entry *zram_entry_alloc(struct zram *zram, size_t len)
+{
+	struct zram_entry *entry;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = zs_malloc(zram->mem_pool, len);
+	if (!entry->handle) {
+		kfree(entry);
+		return NULL;
+	}
+
+	RB_CLEAR_NODE(&entry->rb_node);
+	entry->len = len;
+	entry->refcount = 1;
+	zram_stat64_add(zram, &zram->stats.compr_size, len);
+
+	return entry;
+}
+
+/* Drop a table slot's reference, freeing the object with the last one */
+static void zram_entry_put(struct zram *zram, struct zram_entry *entry)
+{
+	if (zram_dedup_put(zram, entry)) {
+		zram_stat64_sub(zram, &zram->stats.dup_data_size, entry->len);
+		return;
+	}
+
+	zs_free(zram->mem_pool, entry->handle);
+	zram_stat64_sub(zram, &zram->stats.compr_size, entry->len);
+	kfree(entry);
+}
+
+/*
+ * Backing device support. Pages written back by zram_writeback() occupy
+ * one PAGE_SIZE block each, tracked in zram->bitmap. Block 0 is never
+ * handed out so that a non-zero table value is always a valid block.
+ */
+void zram_reset_backing_dev(struct zram *zram)
+{
+	if (!zram->backing_dev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	filp_close(zram->backing_dev, NULL);
+	vfree(zram->bitmap);
+
+	zram->backing_dev = NULL;
+	zram->bdev = NULL;
+	zram->bitmap = NULL;
+	zram->nr_bdev_blocks = 0;
+}
+
+/* Called with zram->init_lock held, before the device is initialized */
+int zram_set_backing_dev(struct zram *zram, const char *file_name)
+{
+	int ret;
+	struct file *backing_dev;
+	struct inode *inode;
+	struct block_device *bdev;
+	unsigned long nr_blocks, *bitmap;
+
+	backing_dev = filp_open(file_name, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(backing_dev))
+		return PTR_ERR(backing_dev);
+
+	inode = backing_dev->f_mapping->host;
+	if (!S_ISBLK(inode->i_mode)) {
+		ret = -ENOTBLK;
+		goto out_close;
+	}
+
+	nr_blocks = i_size_read(inode) >> PAGE_SHIFT;
+	if (nr_blocks < 2) {
+		ret = -EINVAL;
+		goto out_close;
+	}
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (!bitmap) {
+		ret = -ENOMEM;
+		goto out_close;
+	}
+	set_bit(0, bitmap);
+
+	/* blkdev_get() drops the reference on failure */
+	bdev = bdgrab(I_BDEV(inode));
+	ret = blkdev_get(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+	if (ret) {
+		vfree(bitmap);
+		goto out_close;
+	}
+
+	zram_reset_backing_dev(zram);
+	zram->backing_dev = backing_dev;
+	zram->bdev = bdev;
+	zram->bitmap = bitmap;
+	zram->nr_bdev_blocks = nr_blocks;
+
+	return 0;
+
+out_close:
+	filp_close(backing_dev, NULL);
+	return ret;
+}
+
+static unsigned long zram_bdev_alloc_block(struct zram *zram)
 {
-	u32 clen;
-	void *obj;
+	unsigned long blk = 1;
+
+	do {
+		blk = find_next_zero_bit(zram->bitmap,
+					zram->nr_bdev_blocks, blk);
+		if (blk >= zram->nr_bdev_blocks)
+			return 0;
+	} while (test_and_set_bit(blk, zram->bitmap));
+
+	return blk;
+}
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+static void zram_bdev_free_block(struct zram *zram, unsigned long blk)
+{
+	WARN_ON_ONCE(!test_and_clear_bit(blk, zram->bitmap));
+}
 
-	if (unlikely(!page)) {
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/* Synchronously transfer one page to or from backing device block 'blk' */
+static int zram_bdev_rw(struct zram *zram, struct page *page,
+			unsigned long blk, int rw)
+{
+	int ret = 0;
+	struct bio *bio;
+	ktime_t start;
+	u64 delta;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_sector = blk * (PAGE_SIZE >> SECTOR_SHIFT);
+	bio->bi_bdev = zram->bdev;
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &done;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	start = ktime_get();
+	submit_bio(rw | REQ_SYNC, bio);
+	wait_for_completion(&done);
+	delta = ktime_us_delta(ktime_get(), start);
+
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		ret = -EIO;
+	bio_put(bio);
+
+	if (rw == READ) {
+		zram_stat64_inc(zram, &zram->stats.bd_reads);
+		zram_stat64_add(zram, &zram->stats.bd_read_time, delta);
+	} else {
+		zram_stat64_inc(zram, &zram->stats.bd_writes);
+		zram_stat64_add(zram, &zram->stats.bd_write_time, delta);
+	}
+
+	return ret;
+}
+
+struct zram_bdev_read_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk;
+	int ret;
+};
+
+static void zram_bdev_read_worker(struct work_struct *work)
+{
+	struct zram_bdev_read_work *rw;
+
+	rw = container_of(work, struct zram_bdev_read_work, work);
+	rw->ret = zram_bdev_rw(rw->zram, rw->page, rw->blk, READ);
+}
+
+/*
+ * Reads arrive from within generic_make_request(), which only queues
+ * bios submitted from there until we return. Waiting on our own bio
+ * would deadlock, so have a worker submit it instead.
+ */
+static int zram_bdev_read(struct zram *zram, struct page *page,
+			unsigned long blk)
+{
+	struct zram_bdev_read_work rw;
+
+	rw.zram = zram;
+	rw.page = page;
+	rw.blk = blk;
+
+	INIT_WORK_ONSTACK(&rw.work, zram_bdev_read_worker);
+	queue_work(system_unbound_wq, &rw.work);
+	flush_work(&rw.work);
+	destroy_work_on_stack(&rw.work);
+
+	return rw.ret;
+}
+
+/*
+ * Release the memory backing a table entry. Called with
+ * zram->tb_lock held for writing.
+ */
+static void zram_free_page(struct zram *zram, size_t index)
+{
+	struct zram_entry *entry = zram->table[index].entry;
+
+	/* Also tells a pending writeback that this slot changed */
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		zram_bdev_free_block(zram, zram->table[index].bdev_block);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		atomic_dec(&zram->stats.pages_wb);
+		zram_stat_dec(&zram->stats.pages_stored);
+		zram->table[index].bdev_block = 0;
+		return;
+	}
+
+	if (unlikely(!entry)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -154,27 +464,16 @@ static void zram_free_page(struct zram *zram, size_t index)
 	}
 
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
-		goto out;
-	}
-
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
+	} else if (entry->len <= PAGE_SIZE / 2) {
 		zram_stat_dec(&zram->stats.good_compress);
+	}
 
-out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
+	zram_entry_put(zram, entry);
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram->table[index].entry = NULL;
 }
 
 static void handle_zero_page(struct page *page)
@@ -192,14 +491,14 @@ static void handle_uncompressed_page(struct zram *zram,
 				struct page *page, u32 index)
 {
 	unsigned char *user_mem, *cmem;
+	unsigned long handle = zram->table[index].entry->handle;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
+	zs_unmap_object(zram->mem_pool, handle);
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
 
 	flush_dcache_page(page);
 }
@@ -210,27 +509,59 @@ static void zram_read(struct zram *zram, struct bio *bio)
 	int i;
 	u32 index;
 	struct bio_vec *bvec;
+	struct zram_comp_strm *zstrm = NULL;
 
 	zram_stat64_inc(zram, &zram->stats.num_reads);
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
+	if (zram->comp->decompress_needs_strm)
+		zstrm = zram_comp_strm_get(zram);
+
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		size_t clen;
 		struct page *page;
-		struct zobj_header *zheader;
+		struct zram_entry *entry;
 		unsigned char *user_mem, *cmem;
 
 		page = bvec->bv_page;
 
+		read_lock(&zram->tb_lock);
+		entry = zram->table[index].entry;
+
+		/*
+		 * Everything else that changes the flags holds tb_lock for
+		 * writing, so readers racing here can only store the same
+		 * value. Test first to keep reads from dirtying the table.
+		 */
+		if (zram_test_flag(zram, index, ZRAM_IDLE))
+			zram_clear_flag(zram, index, ZRAM_IDLE);
+
+		if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+			unsigned long blk = zram->table[index].bdev_block;
+
+			read_unlock(&zram->tb_lock);
+			if (zram_bdev_read(zram, page, blk)) {
+				pr_err("Backing device read failed! "
+					"page=%u\n", index);
+				zram_stat64_inc(zram,
+					&zram->stats.failed_reads);
+				goto out;
+			}
+			flush_dcache_page(page);
+			index++;
+			continue;
+		}
+
 		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+			read_unlock(&zram->tb_lock);
 			handle_zero_page(page);
 			index++;
 			continue;
 		}
 
 		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
+		if (unlikely(!entry)) {
+			read_unlock(&zram->tb_lock);
 			pr_debug("Read before write: sector=%lu, size=%u",
 				(ulong)(bio->bi_sector), bio->bi_size);
 			handle_zero_page(page);
@@ -241,26 +572,24 @@ static void zram_read(struct zram *zram, struct bio *bio)
 		/* Page is stored uncompressed since it's incompressible */
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 			handle_uncompressed_page(zram, page, index);
+			read_unlock(&zram->tb_lock);
 			index++;
 			continue;
 		}
 
 		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+		ret = zram->comp->decompress(cmem, entry->len,
+			user_mem, zstrm ? zstrm->private : NULL);
 
+		zs_unmap_object(zram->mem_pool, entry->handle);
 		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+		read_unlock(&zram->tb_lock);
 
 		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
+		if (unlikely(ret)) {
 			pr_err("Decompression failed! err=%d, page=%u\n",
 				ret, index);
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
@@ -271,14 +600,137 @@ static void zram_read(struct zram *zram, struct bio *bio)
 		index++;
 	}
 
+	if (zstrm)
+		zram_comp_strm_put(zstrm);
+
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return;
 
 out:
+	if (zstrm)
+		zram_comp_strm_put(zstrm);
+
 	bio_io_error(bio);
 }
 
+/* Compress and store one page of a write bio at table slot 'index' */
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
+{
+	int ret;
+	size_t clen;
+	u32 checksum = 0;
+	int incompressible = 0;
+	int dedup = zram->dedup_enable;
+	struct zram_entry *entry;
+	struct zram_comp_strm *zstrm;
+	unsigned char *user_mem, *cmem, *src;
+
+	zstrm = zram_comp_strm_get(zram);
+	src = zstrm->buffer;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(user_mem)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		zram_comp_strm_put(zstrm);
+
+		write_lock(&zram->tb_lock);
+		zram_free_page(zram, index);
+		zram_stat_inc(&zram->stats.pages_zero);
+		zram_set_flag(zram, index, ZRAM_ZERO);
+		write_unlock(&zram->tb_lock);
+		return 0;
+	}
+
+	ret = zram->comp->compress(user_mem, src, &clen,
+				zstrm->private);
+
+	kunmap_atomic(user_mem, KM_USER0);
+
+	if (unlikely(ret)) {
+		zram_comp_strm_put(zstrm);
+		pr_err("Compression failed! err=%d\n", ret);
+		zram_stat64_inc(zram, &zram->stats.failed_writes);
+		return ret;
+	}
+
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size)) {
+		clen = PAGE_SIZE;
+		incompressible = 1;
+	}
+
+	if (unlikely(incompressible))
+		src = kmap_atomic(page, KM_USER0);
+
+	entry = NULL;
+	if (dedup) {
+		checksum = zram_dedup_checksum(src, clen);
+		entry = zram_dedup_find(zram, src, clen, checksum);
+	}
+
+	if (unlikely(incompressible))
+		kunmap_atomic(src, KM_USER0);
+
+	if (entry) {
+		zram_stat64_add(zram, &zram->stats.dup_data_size, clen);
+		zram_stat64_inc(zram, &zram->stats.dedup_hits);
+		goto found_dup;
+	}
+
+	entry = zram_entry_alloc(zram, clen);
+	if (!entry) {
+		zram_comp_strm_put(zstrm);
+		pr_info("Error allocating memory for compressed "
+			"page: %u, size=%zu\n", index, clen);
+		zram_stat64_inc(zram, &zram->stats.failed_writes);
+		return -ENOMEM;
+	}
+
+	if (unlikely(incompressible))
+		src = kmap_atomic(page, KM_USER0);
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_WO);
+
+	memcpy(cmem, src, clen);
+
+	zs_unmap_object(zram->mem_pool, entry->handle);
+	if (unlikely(incompressible))
+		kunmap_atomic(src, KM_USER0);
+
+	if (dedup)
+		zram_dedup_insert(zram, entry, checksum);
+
+found_dup:
+	zram_comp_strm_put(zstrm);
+
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	write_lock(&zram->tb_lock);
+	if (zram->table[index].entry ||
+			zram_test_flag(zram, index, ZRAM_ZERO))
+		zram_free_page(zram, index);
+
+	zram->table[index].entry = entry;
+	if (unlikely(incompressible)) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+	}
+
+	/* Update stats */
+	zram_stat_inc(&zram->stats.pages_stored);
+	if (clen <= PAGE_SIZE / 2)
+		zram_stat_inc(&zram->stats.good_compress);
+	write_unlock(&zram->tb_lock);
+
+	return 0;
+}
+
 static void zram_write(struct zram *zram, struct bio *bio)
 {
 	int i;
@@ -289,120 +741,329 @@ static void zram_write(struct zram *zram, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+		if (zram_write_page(zram, bvec->bv_page, index))
+			goto out;
+		index++;
+	}
 
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+	return;
 
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
+out:
+	bio_io_error(bio);
+}
 
-		mutex_lock(&zram->lock);
+/*
+ * Asynchronous writes. A large write bio is cut into at most one run
+ * of consecutive segments per online CPU. The submitter compresses the
+ * first run itself while workers of the device workqueue handle the
+ * others, and whichever finishes last completes the bio.
+ */
+struct zram_write_chunk {
+	struct work_struct work;
+	struct zram_write_batch *batch;
+	unsigned short first, last;	/* bio_vec indices, last excluded */
+	u32 index;			/* table slot of 'first' */
+};
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
-			continue;
+struct zram_write_batch {
+	struct zram *zram;
+	struct bio *bio;
+	atomic_t pending;		/* chunks not yet done */
+	int error;
+	struct zram_write_chunk chunks[0];
+};
+
+static void zram_write_worker(struct work_struct *work)
+{
+	int i;
+	struct zram_write_chunk *chunk;
+	struct zram_write_batch *batch;
+	struct bio *bio;
+	u32 index;
+
+	chunk = container_of(work, struct zram_write_chunk, work);
+	batch = chunk->batch;
+	bio = batch->bio;
+	index = chunk->index;
+
+	for (i = chunk->first; i < chunk->last; i++, index++) {
+		if (zram_write_page(batch->zram,
+				bio_iovec_idx(bio, i)->bv_page, index)) {
+			batch->error = 1;
+			break;
 		}
+	}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+	if (!atomic_dec_and_test(&batch->pending))
+		return;
 
-		kunmap_atomic(user_mem, KM_USER0);
+	if (batch->error) {
+		bio_io_error(bio);
+	} else {
+		set_bit(BIO_UPTODATE, &bio->bi_flags);
+		bio_endio(bio, 0);
+	}
+	kfree(batch);
+}
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+/*
+ * Smaller write bios are queued per device. A writer keeps taking bios
+ * off the queue until it is empty, and a new one is started whenever
+ * bios are waiting for more writers than are active, up to one writer
+ * per online CPU.
+ */
+static void zram_writer_func(struct work_struct *work)
+{
+	struct zram_writer *writer;
+	struct zram *zram;
+	struct bio *bio;
+
+	writer = container_of(work, struct zram_writer, work);
+	zram = writer->zram;
+
+	for (;;) {
+		spin_lock(&zram->wr_lock);
+		bio = bio_list_pop(&zram->wr_bios);
+		if (!bio) {
+			zram->wr_nr_active--;
+			spin_unlock(&zram->wr_lock);
+			return;
 		}
+		zram->wr_nr_bios--;
+		spin_unlock(&zram->wr_lock);
+
+		zram_write(zram, bio);
+	}
+}
 
+static void zram_write_queue(struct zram *zram, struct bio *bio)
+{
+	unsigned int max_active = num_online_cpus();
+	struct zram_writer *writer;
+
+	zram_stat64_inc(zram, &zram->stats.async_writes);
+
+	spin_lock(&zram->wr_lock);
+	bio_list_add(&zram->wr_bios, bio);
+	zram->wr_nr_bios++;
+	if (zram->wr_nr_active < min(zram->wr_nr_bios, max_active)) {
 		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
+		 * The slot may still belong to a writer that is about to
+		 * return: requeueing it while it runs is fine, and if it
+		 * has not started yet it will see this bio anyway.
 		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
+		writer = &zram->writers[zram->wr_nr_active];
+		if (queue_work(zram->wq, &writer->work))
+			zram->wr_nr_active++;
+	}
+	spin_unlock(&zram->wr_lock);
+}
 
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
-		}
+/*
+ * Returns 0 if the bio was taken over, else it is left to the caller
+ * to write synchronously.
+ */
+static int zram_write_async(struct zram *zram, struct bio *bio)
+{
+	int i, first, nr_chunks;
+	int nr_segs = bio_segments(bio);
+	u32 index;
+	struct zram_write_batch *batch;
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+	if (!zram->async_min_pages || num_online_cpus() < 2)
+		return -EINVAL;
 
-memstore:
-		zram->table[index].offset = offset;
+	if (nr_segs < zram->async_min_pages) {
+		zram_write_queue(zram, bio);
+		return 0;
+	}
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	nr_chunks = min_t(int, nr_segs, num_online_cpus());
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
-#endif
+	batch = kmalloc(sizeof(*batch) + nr_chunks * sizeof(batch->chunks[0]),
+			GFP_NOIO);
+	if (!batch)
+		return -ENOMEM;
 
-		memcpy(cmem, src, clen);
+	batch->zram = zram;
+	batch->bio = bio;
+	batch->error = 0;
+	atomic_set(&batch->pending, nr_chunks);
+
+	zram_stat64_inc(zram, &zram->stats.num_writes);
+	zram_stat64_inc(zram, &zram->stats.async_writes);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	first = bio->bi_idx;
+	for (i = 0; i < nr_chunks; i++) {
+		struct zram_write_chunk *chunk = &batch->chunks[i];
+		int n = nr_segs / nr_chunks + (i < nr_segs % nr_chunks);
+
+		INIT_WORK(&chunk->work, zram_write_worker);
+		chunk->batch = batch;
+		chunk->first = first;
+		chunk->last = first + n;
+		chunk->index = index;
+		first += n;
+		index += n;
+	}
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+	/* The batch may be freed as soon as the last chunk is started */
+	for (i = nr_chunks - 1; i > 0; i--)
+		queue_work(zram->wq, &batch->chunks[i].work);
+	zram_write_worker(&batch->chunks[0].work);
 
-		mutex_unlock(&zram->lock);
-		index++;
+	return 0;
+}
+
+/* Mark every stored page idle; reads and rewrites clear the mark */
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index;
+
+	write_lock(&zram->tb_lock);
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		if (zram->table[index].entry &&
+				!zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
 	}
+	write_unlock(&zram->tb_lock);
+}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return;
+/*
+ * Decompress the slot at 'index' into 'page'. Called with tb_lock held,
+ * so it must not sleep; 'zstrm' is only needed by some backends.
+ */
+static int zram_decompress_page(struct zram *zram, struct page *page,
+			u32 index, struct zram_comp_strm *zstrm)
+{
+	int ret;
+	unsigned char *user_mem, *cmem;
+	struct zram_entry *entry = zram->table[index].entry;
 
-out:
-	bio_io_error(bio);
+	if (zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+		handle_uncompressed_page(zram, page, index);
+		return 0;
+	}
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	ret = zram->comp->decompress(cmem, entry->len,
+		user_mem, zstrm ? zstrm->private : NULL);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	return ret;
+}
+
+static int zram_wb_candidate(struct zram *zram, u32 index,
+			enum zram_wb_mode mode)
+{
+	if (!zram->table[index].entry ||
+			zram_test_flag(zram, index, ZRAM_WB))
+		return 0;
+
+	if (mode == ZRAM_WB_HUGE)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	return zram_test_flag(zram, index, ZRAM_IDLE);
+}
+
+/*
+ * Move pages selected by 'mode' to the backing device, freeing their
+ * memory. Each page is staged under tb_lock and written out without
+ * it; ZRAM_UNDER_WB is cleared by any rewrite or discard meanwhile,
+ * in which case the new block is dropped instead. Called with
+ * zram->init_lock held. Returns the number of pages written back.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	int ret, count = 0;
+	u32 index;
+	unsigned long blk = 0;
+	struct page *page;
+	struct zram_entry *entry;
+	struct zram_comp_strm *zstrm = NULL;
+
+	if (!zram->backing_dev)
+		return -ENODEV;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		cond_resched();
+
+		if (zram->comp->decompress_needs_strm)
+			zstrm = zram_comp_strm_get(zram);
+
+		write_lock(&zram->tb_lock);
+		if (!zram_wb_candidate(zram, index, mode)) {
+			write_unlock(&zram->tb_lock);
+			if (zstrm)
+				zram_comp_strm_put(zstrm);
+			continue;
+		}
+
+		/* Left over from a raced or skipped page otherwise */
+		if (!blk)
+			blk = zram_bdev_alloc_block(zram);
+		if (!blk) {
+			write_unlock(&zram->tb_lock);
+			if (zstrm)
+				zram_comp_strm_put(zstrm);
+			pr_info("Backing device is full\n");
+			break;
+		}
+
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		ret = zram_decompress_page(zram, page, index, zstrm);
+		write_unlock(&zram->tb_lock);
+		if (zstrm)
+			zram_comp_strm_put(zstrm);
+
+		if (!ret)
+			ret = zram_bdev_rw(zram, page, blk, WRITE);
+
+		write_lock(&zram->tb_lock);
+		if (ret || !zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			write_unlock(&zram->tb_lock);
+			if (ret) {
+				pr_err("Writeback failed! err=%d, page=%u\n",
+					ret, index);
+				break;
+			}
+			continue;
+		}
+
+		entry = zram->table[index].entry;
+		if (zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+			zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
+			zram_stat_dec(&zram->stats.pages_expand);
+		} else if (entry->len <= PAGE_SIZE / 2) {
+			zram_stat_dec(&zram->stats.good_compress);
+		}
+		zram_entry_put(zram, entry);
+
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		zram_clear_flag(zram, index, ZRAM_IDLE);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram->table[index].bdev_block = blk;
+		atomic_inc(&zram->stats.pages_wb);
+		write_unlock(&zram->tb_lock);
+		blk = 0;
+		count++;
+	}
+
+	if (blk)
+		zram_bdev_free_block(zram, blk);
+	__free_page(page);
+
+	return count;
 }
 
 /*
@@ -446,7 +1107,8 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 		break;
 
 	case WRITE:
-		zram_write(zram, bio);
+		if (zram_write_async(zram, bio))
+			zram_write(zram, bio);
 		break;
 	}
 
@@ -460,34 +1122,30 @@ void zram_reset_device(struct zram *zram)
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+	/* Wait for asynchronous writes still compressing */
+	flush_workqueue(zram->wq);
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free various per-device buffers */
+	zram_comp_strm_destroy(zram);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+		struct zram_entry *entry = zram->table[index].entry;
 
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
+		if (!entry || zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
+		zram_entry_put(zram, entry);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	zram_dedup_fini(zram);
+	zram_reset_backing_dev(zram);
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -511,19 +1169,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
+	ret = zram_comp_strm_create(zram);
+	if (ret)
 		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
 	zram->table = vzalloc(num_pages * sizeof(*zram->table));
@@ -535,12 +1183,18 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	ret = zram_dedup_init(zram, num_pages);
+	if (ret) {
+		pr_err("Error allocating zram dedup hash\n");
+		goto fail;
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool(GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -566,7 +1220,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->tb_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->tb_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -577,14 +1233,41 @@ static const struct block_device_operations zram_devops = {
 
 static int create_device(struct zram *zram, int device_id)
 {
-	int ret = 0;
+	int i, ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	rwlock_init(&zram->tb_lock);
+	zram->comp = zram_comp_default();
+	zram->dedup_enable = 1;
+
+	spin_lock_init(&zram->wr_lock);
+	bio_list_init(&zram->wr_bios);
+	zram->writers = kcalloc(nr_cpu_ids, sizeof(*zram->writers),
+				GFP_KERNEL);
+	if (!zram->writers) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < nr_cpu_ids; i++) {
+		INIT_WORK(&zram->writers[i].work, zram_writer_func);
+		zram->writers[i].zram = zram;
+	}
+
+	/* Workers may have to make progress for swap-out under pressure */
+	zram->wq = alloc_workqueue("zram", WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	if (!zram->wq) {
+		pr_err("Error allocating workqueue for device %d\n",
+			device_id);
+		kfree(zram->writers);
+		ret = -ENOMEM;
+		goto out;
+	}
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
+		destroy_workqueue(zram->wq);
+		kfree(zram->writers);
 		pr_err("Error allocating disk queue for device %d\n",
 			device_id);
 		ret = -ENOMEM;
@@ -598,6 +1281,8 @@ static int create_device(struct zram *zram, int device_id)
 	zram->disk = alloc_disk(1);
 	if (!zram->disk) {
 		blk_cleanup_queue(zram->queue);
+		destroy_workqueue(zram->wq);
+		kfree(zram->writers);
 		pr_warning("Error allocating disk structure for device %d\n",
 			device_id);
 		ret = -ENOMEM;
@@ -651,6 +1336,12 @@ static void destroy_device(struct zram *zram)
 
 	if (zram->queue)
 		blk_cleanup_queue(zram->queue);
+
+	destroy_workqueue(zram->wq);
+	kfree(zram->writers);
+
+	/* A backing device may be set on a device never initialized */
+	zram_reset_backing_dev(zram);
 }
 
 static int __init zram_init(void)
@@ -710,9 +1401,10 @@ static void __exit zram_exit(void)
 	for (i = 0; i < num_devices; i++) {
 		zram = &devices[i];
 
-		destroy_device(zram);
+		/* Flushes the workqueue destroy_device() frees */
 		if (zram->init_done)
 			zram_reset_device(zram);
+		destroy_device(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
@@ -17,8 +17,12 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/rbtree.h>
+#include <linux/bio.h>
+#include <linux/workqueue.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,18 +30,6 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
@@ -51,8 +43,8 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -71,19 +63,53 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page not accessed since last marked idle through sysfs */
+	ZRAM_IDLE,
+
+	/* Page lives on the backing device, see table.bdev_block */
+	ZRAM_WB,
+
+	/* Page is being written to the backing device */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
+/*
+ * A stored object. Shared by all table slots holding the same data
+ * when deduplication is enabled.
+ */
+struct zram_entry {
+	struct rb_node rb_node;	/* in zram->hash, empty if not hashed */
+	u32 checksum;
+	u16 len;		/* object size */
+	unsigned long refcount;	/* protected by the hash bucket lock */
+	unsigned long handle;	/* zsmalloc handle */
+};
+
+/* Dedup index bucket */
+struct zram_hash {
+	spinlock_t lock;
+	struct rb_root rb_root;
+};
+
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
+	union {
+		struct zram_entry *entry;	/* NULL if not stored */
+		unsigned long bdev_block;	/* if ZRAM_WB, never 0 */
+	};
 	u8 flags;
 } __attribute__((aligned(4)));
 
+/* Selects which pages zram_writeback() moves to the backing device */
+enum zram_wb_mode {
+	ZRAM_WB_HUGE,	/* incompressible pages */
+	ZRAM_WB_IDLE,	/* pages still marked idle */
+};
+
 struct zram_stats {
 	u64 compr_size;		/* compressed size of pages stored */
 	u64 num_reads;		/* failed + successful */
@@ -92,20 +118,82 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	u64 async_writes;	/* write bios split across workers */
+	u64 dedup_hits;		/* no. of pages stored by sharing */
+	u64 dup_data_size;	/* compressed bytes saved by sharing */
+	u64 bd_reads;		/* pages read from backing device */
+	u64 bd_writes;		/* pages written to backing device */
+	u64 bd_read_time;	/* total backing device read time (us) */
+	u64 bd_write_time;	/* total backing device write time (us) */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+	atomic_t pages_wb;	/* no. of pages on backing device */
+};
+
+/*
+ * Compression backend. A device uses a single backend for its whole
+ * lifetime; it can only be changed through sysfs while the device is
+ * not initialized. All callbacks work on exactly one PAGE_SIZE page.
+ */
+struct zram_compressor {
+	const char *name;
+	/* per-stream private state (working memory, crypto tfm, ...) */
+	void *(*create)(void);
+	void (*destroy)(void *private);
+	/* return 0 on success, dst must hold 2 * PAGE_SIZE bytes */
+	int (*compress)(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *private);
+	int (*decompress)(const unsigned char *src, size_t src_len,
+			unsigned char *dst, void *private);
+	/* decompress() uses 'private', so readers must grab a stream */
+	int decompress_needs_strm;
+};
+
+/*
+ * Compression stream: the backend private state and the destination
+ * buffer a page is compressed into before being copied to its final
+ * location. Each possible CPU owns one stream so that concurrent
+ * writers compress in parallel. The mutex only matters when a writer
+ * gets migrated after picking its stream.
+ */
+struct zram_comp_strm {
+	void *private;
+	void *buffer;
+	struct mutex lock;
+};
+
+/* One of the workers draining the queue of small write bios */
+struct zram_writer {
+	struct work_struct work;
+	struct zram *zram;
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	const struct zram_compressor *comp;
+	struct zram_comp_strm __percpu *comp_strm;
 	struct table *table;
+	struct zram_hash *hash;
+	size_t hash_size;
+	int dedup_enable;
+	/*
+	 * Write bios of at least this many pages are compressed in
+	 * parallel by the workers of 'wq'. Smaller ones (e.g. single
+	 * page swap-out) are queued on 'wr_bios' and spread over up to
+	 * one writer per online CPU. 0 keeps all writes in the
+	 * submitter's context.
+	 */
+	unsigned int async_min_pages;
+	struct workqueue_struct *wq;
+	spinlock_t wr_lock;	/* protect wr_bios and counters below */
+	struct bio_list wr_bios;
+	unsigned int wr_nr_bios;	/* bios on wr_bios */
+	unsigned int wr_nr_active;	/* writers[] queued or running */
+	struct zram_writer *writers;	/* nr_cpu_ids entries */
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	rwlock_t tb_lock;	/* protect table entries */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -117,6 +205,16 @@ struct zram {
 	 */
 	u64 disksize;	/* bytes */
 
+	/*
+	 * Optional block device receiving written back pages, one
+	 * PAGE_SIZE block per page. Block 0 is never used so that a
+	 * written back table entry is never 0.
+	 */
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned long *bitmap;
+	unsigned long nr_bdev_blocks;
+
 	struct zram_stats stats;
 };
 
@@ -129,4 +227,24 @@ extern struct attribute_group zram_disk_attr_group;
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
 
+extern int zram_set_backing_dev(struct zram *zram, const char *file_name);
+extern void zram_reset_backing_dev(struct zram *zram);
+extern void zram_mark_idle(struct zram *zram);
+extern int zram_writeback(struct zram *zram, enum zram_wb_mode mode);
+
+extern u32 zram_dedup_checksum(const unsigned char *mem, size_t len);
+extern struct zram_entry *zram_dedup_find(struct zram *zram,
+			const unsigned char *mem, size_t len, u32 checksum);
+extern void zram_dedup_insert(struct zram *zram, struct zram_entry *entry,
+			u32 checksum);
+extern unsigned long zram_dedup_put(struct zram *zram,
+			struct zram_entry *entry);
+extern int zram_dedup_init(struct zram *zram, size_t num_pages);
+extern void zram_dedup_fini(struct zram *zram);
+
+extern const struct zram_compressor *zram_comp_default(void);
+extern const struct zram_compressor *zram_comp_find(const char *name);
+extern ssize_t zram_comp_available_show(const struct zram_compressor *cur,
+			char *buf);
+
 #endif
@@ -0,0 +1,673 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2011  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * zsmalloc is a size-class allocator for compressed pages. Unlike
+ * xvmalloc it packs objects of equal size into groups of pages
+ * ("zspages") and lets them straddle page boundaries, so the tail of
+ * a page is not wasted. Objects are addressed through handles, which
+ * allows zs_compact() to migrate objects out of sparsely used zspages
+ * and hand whole pages back to the system after a burst of frees.
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bit_spinlock.h>
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/list_sort.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/* Handles are shared by all pools; created with the first pool */
+static struct kmem_cache *zs_handle_cachep;
+static unsigned int zs_handle_cache_users;
+static DEFINE_MUTEX(zs_handle_cache_lock);
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the number of pages per zspage (1..ZS_MAX_PAGES_PER_ZSPAGE)
+ * which wastes the smallest fraction of the zspage for this class.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int waste = zspage_size % class_size;
+		int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+			struct zspage *zspage)
+{
+	unsigned int inuse = zspage->inuse;
+	unsigned int max = class->objs_per_zspage;
+
+	if (!inuse)
+		return ZS_EMPTY;
+	if (inuse == max)
+		return ZS_FULL;
+	if (inuse * ZS_ALMOST_FULL_DEN >= max * ZS_ALMOST_FULL_NUM)
+		return ZS_ALMOST_FULL;
+
+	return ZS_ALMOST_EMPTY;
+}
+
+/*
+ * Move a zspage to the list matching its current usage and return the
+ * new group. Empty zspages are left off all lists for the caller to
+ * free. Called with class->lock held.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+			struct zspage *zspage)
+{
+	enum fullness_group newfg;
+
+	newfg = get_fullness_group(class, zspage);
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	if (zspage->fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_del(&zspage->list);
+	if (newfg < _ZS_NR_FULLNESS_GROUPS)
+		list_add(&zspage->list, &class->fullness_list[newfg]);
+	zspage->fullness = newfg;
+
+	return newfg;
+}
+
+/* Prefer filling up busy zspages so sparse ones can drain */
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	int i;
+
+	for (i = ZS_ALMOST_FULL; i <= ZS_ALMOST_EMPTY; i++) {
+		if (!list_empty(&class->fullness_list[i]))
+			return list_first_entry(&class->fullness_list[i],
+						struct zspage, list);
+	}
+
+	return NULL;
+}
+
+static void free_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		if (zspage->pages[i])
+			__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+			struct size_class *class)
+{
+	int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage) + class->objs_per_zspage *
+			sizeof(zspage->slots[0]), pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(pool->flags);
+		if (!zspage->pages[i]) {
+			free_zspage(pool, class, zspage);
+			return NULL;
+		}
+	}
+
+	/* Chain all slots on the free list */
+	for (i = 0; i < class->objs_per_zspage; i++)
+		zspage->slots[i] = ((i + 1) << ZS_SLOT_SHIFT) | ZS_SLOT_FREE;
+
+	zspage->class_idx = class->index;
+	zspage->first_free = 0;
+	zspage->fullness = ZS_EMPTY;
+
+	return zspage;
+}
+
+static unsigned int obj_malloc(struct zspage *zspage,
+			struct zs_handle *handle)
+{
+	unsigned int idx = zspage->first_free;
+
+	zspage->first_free = zspage->slots[idx] >> ZS_SLOT_SHIFT;
+	zspage->slots[idx] = (unsigned long)handle;
+	zspage->inuse++;
+
+	return idx;
+}
+
+static void obj_free(struct zspage *zspage, unsigned int idx)
+{
+	zspage->slots[idx] = (zspage->first_free << ZS_SLOT_SHIFT) |
+				ZS_SLOT_FREE;
+	zspage->first_free = idx;
+	zspage->inuse--;
+}
+
+/*
+ * Copy 'len' bytes between a linear buffer and the object at byte
+ * offset 'off' of a zspage, crossing into the next page if needed.
+ */
+static void zs_copy_obj(struct zspage *zspage, unsigned long off,
+			char *buf, unsigned int len, int to_obj)
+{
+	while (len) {
+		unsigned int pidx = off >> PAGE_SHIFT;
+		unsigned int poff = off & ~PAGE_MASK;
+		unsigned int chunk = min_t(unsigned int, len,
+					PAGE_SIZE - poff);
+		char *addr;
+
+		addr = kmap_atomic(zspage->pages[pidx], KM_USER0);
+		if (to_obj)
+			memcpy(addr + poff, buf, chunk);
+		else
+			memcpy(buf, addr + poff, chunk);
+		kunmap_atomic(addr, KM_USER0);
+
+		off += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+}
+
+/* Copy one object between two zspages of the same class */
+static void zs_migrate_obj(struct size_class *class,
+			struct zspage *dst, unsigned int d_idx,
+			struct zspage *src, unsigned int s_idx)
+{
+	unsigned long s_off = (unsigned long)s_idx * class->size;
+	unsigned long d_off = (unsigned long)d_idx * class->size;
+	unsigned int len = class->size;
+
+	while (len) {
+		unsigned int s_poff = s_off & ~PAGE_MASK;
+		unsigned int d_poff = d_off & ~PAGE_MASK;
+		unsigned int chunk;
+		char *s_addr, *d_addr;
+
+		chunk = min_t(unsigned int, len, PAGE_SIZE - s_poff);
+		chunk = min_t(unsigned int, chunk, PAGE_SIZE - d_poff);
+
+		s_addr = kmap_atomic(src->pages[s_off >> PAGE_SHIFT],
+					KM_USER0);
+		d_addr = kmap_atomic(dst->pages[d_off >> PAGE_SHIFT],
+					KM_USER1);
+		memcpy(d_addr + d_poff, s_addr + s_poff, chunk);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		s_off += chunk;
+		d_off += chunk;
+		len -= chunk;
+	}
+}
+
+static int zs_handle_cache_get(void)
+{
+	int ret = 0;
+
+	mutex_lock(&zs_handle_cache_lock);
+	if (!zs_handle_cache_users) {
+		zs_handle_cachep = kmem_cache_create("zs_handle",
+					sizeof(struct zs_handle),
+					__alignof__(struct zs_handle), 0, NULL);
+		if (!zs_handle_cachep)
+			ret = -ENOMEM;
+	}
+	if (!ret)
+		zs_handle_cache_users++;
+	mutex_unlock(&zs_handle_cache_lock);
+
+	return ret;
+}
+
+static void zs_handle_cache_put(void)
+{
+	mutex_lock(&zs_handle_cache_lock);
+	if (!--zs_handle_cache_users) {
+		kmem_cache_destroy(zs_handle_cachep);
+		zs_handle_cachep = NULL;
+	}
+	mutex_unlock(&zs_handle_cache_lock);
+}
+
+static void zs_free_map_areas(struct zs_pool *pool)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(pool->map_area, cpu)->buf);
+	free_percpu(pool->map_area);
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @flags: allocation flags used to allocate pool pages
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(gfp_t flags)
+{
+	int i, cpu;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int fg;
+		struct size_class *class = &pool->size_class[i];
+
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->index = i;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+					PAGE_SIZE / class->size;
+		spin_lock_init(&class->lock);
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+	}
+
+	pool->flags = flags;
+	atomic_long_set(&pool->pages_allocated, 0);
+	atomic_long_set(&pool->pages_compacted, 0);
+
+	pool->map_area = alloc_percpu(struct zs_map_area);
+	if (!pool->map_area)
+		goto out_pool;
+
+	for_each_possible_cpu(cpu) {
+		struct zs_map_area *area = per_cpu_ptr(pool->map_area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto out_areas;
+	}
+
+	if (zs_handle_cache_get())
+		goto out_areas;
+
+	return pool;
+
+out_areas:
+	zs_free_map_areas(pool);
+out_pool:
+	kfree(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int fg;
+		struct size_class *class = &pool->size_class[i];
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			struct zspage *zspage, *tmp;
+
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list) {
+				pr_info("Freeing non-empty class: %d, "
+					"fullness: %d\n", class->size, fg);
+				list_del(&zspage->list);
+				free_zspage(pool, class, zspage);
+			}
+		}
+	}
+
+	zs_free_map_areas(pool);
+	zs_handle_cache_put();
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * On success, a handle to the allocated object is returned, which
+ * must be passed to zs_map_object() to get at the data. Returns 0
+ * if the size is out of range or memory could not be allocated.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	unsigned int idx;
+	struct zspage *zspage;
+	struct zs_handle *handle;
+	struct size_class *class;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = kmem_cache_alloc(zs_handle_cachep,
+				pool->flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+	handle->flags = 0;
+
+	class = &pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cachep, handle);
+			return 0;
+		}
+
+		atomic_long_add(class->pages_per_zspage,
+				&pool->pages_allocated);
+		spin_lock(&class->lock);
+		class->zspages++;
+	}
+
+	idx = obj_malloc(zspage, handle);
+	handle->zspage = zspage;
+	handle->idx = idx;
+	class->objs_inuse++;
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long obj)
+{
+	struct zspage *zspage;
+	struct size_class *class;
+	struct zs_handle *handle = (struct zs_handle *)obj;
+
+	if (unlikely(!handle))
+		return;
+
+	/* Pinning the object keeps compaction from moving it under us */
+	bit_spin_lock(ZS_HANDLE_PIN_BIT, &handle->flags);
+	zspage = handle->zspage;
+	class = &pool->size_class[zspage->class_idx];
+
+	spin_lock(&class->lock);
+	obj_free(zspage, handle->idx);
+	class->objs_inuse--;
+	if (fix_fullness_group(class, zspage) == ZS_EMPTY) {
+		class->zspages--;
+		atomic_long_sub(class->pages_per_zspage,
+				&pool->pages_allocated);
+		free_zspage(pool, class, zspage);
+	}
+	spin_unlock(&class->lock);
+	bit_spin_unlock(ZS_HANDLE_PIN_BIT, &handle->flags);
+
+	kmem_cache_free(zs_handle_cachep, handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: how the mapping is going to be used
+ *
+ * The object stays pinned, and preemption disabled, until the
+ * matching zs_unmap_object(). Only one object can be mapped at a
+ * time on a given cpu.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long obj,
+			enum zs_mapmode mm)
+{
+	unsigned long off;
+	struct zspage *zspage;
+	struct size_class *class;
+	struct zs_map_area *area;
+	struct zs_handle *handle = (struct zs_handle *)obj;
+
+	BUG_ON(!handle);
+
+	bit_spin_lock(ZS_HANDLE_PIN_BIT, &handle->flags);
+	zspage = handle->zspage;
+	class = &pool->size_class[zspage->class_idx];
+	off = (unsigned long)handle->idx * class->size;
+
+	area = this_cpu_ptr(pool->map_area);
+	area->mm = mm;
+
+	if ((off & ~PAGE_MASK) + class->size <= PAGE_SIZE) {
+		/* this object is contained entirely within a page */
+		area->vm_addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT],
+					KM_USER1);
+		return area->vm_addr + (off & ~PAGE_MASK);
+	}
+
+	/* this object spans two pages, bounce it */
+	area->vm_addr = NULL;
+	if (mm != ZS_MM_WO)
+		zs_copy_obj(zspage, off, area->buf, class->size, 0);
+
+	return area->buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_map_area *area;
+	struct zs_handle *handle = (struct zs_handle *)obj;
+
+	area = this_cpu_ptr(pool->map_area);
+	if (area->vm_addr) {
+		kunmap_atomic(area->vm_addr, KM_USER1);
+	} else if (area->mm != ZS_MM_RO) {
+		struct zspage *zspage = handle->zspage;
+		struct size_class *class;
+
+		class = &pool->size_class[zspage->class_idx];
+		zs_copy_obj(zspage, (unsigned long)handle->idx * class->size,
+				area->buf, class->size, 1);
+	}
+
+	bit_spin_unlock(ZS_HANDLE_PIN_BIT, &handle->flags);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+static int zspage_cmp_inuse(void *priv, struct list_head *a,
+			struct list_head *b)
+{
+	return (int)list_entry(a, struct zspage, list)->inuse -
+		(int)list_entry(b, struct zspage, list)->inuse;
+}
+
+/*
+ * The almost empty zspages of the class are taken off their list once
+ * and sorted by use: sources are drained from the head of that list,
+ * the least used first, into almost full zspages or else into the tail,
+ * the most used. Concurrent frees still move or free the ones left on
+ * it, and zs_malloc() cannot see them until the pass is over.
+ */
+static unsigned long zs_compact_class(struct zs_pool *pool,
+			struct size_class *class)
+{
+	LIST_HEAD(candidates);
+	struct zspage *src, *dst;
+	unsigned long freed = 0;
+
+	spin_lock(&class->lock);
+	list_splice_init(&class->fullness_list[ZS_ALMOST_EMPTY], &candidates);
+	list_sort(NULL, &candidates, zspage_cmp_inuse);
+
+	while (!list_empty(&candidates)) {
+		unsigned int idx;
+		int pinned = 0;
+
+		src = list_first_entry(&candidates, struct zspage, list);
+		if (!list_empty(&class->fullness_list[ZS_ALMOST_FULL]))
+			dst = list_first_entry(
+					&class->fullness_list[ZS_ALMOST_FULL],
+					struct zspage, list);
+		else if (!list_is_singular(&candidates))
+			dst = list_entry(candidates.prev, struct zspage, list);
+		else
+			break;
+
+		for (idx = 0; idx < class->objs_per_zspage; idx++) {
+			unsigned long slot = src->slots[idx];
+			struct zs_handle *handle;
+			unsigned int d_idx;
+
+			if (!src->inuse ||
+			    dst->first_free == class->objs_per_zspage)
+				break;
+			if (slot & ZS_SLOT_FREE)
+				continue;
+
+			/* Mapped or being freed right now, leave it be */
+			handle = (struct zs_handle *)slot;
+			if (!bit_spin_trylock(ZS_HANDLE_PIN_BIT,
+					&handle->flags)) {
+				pinned = 1;
+				continue;
+			}
+
+			d_idx = obj_malloc(dst, handle);
+			zs_migrate_obj(class, dst, d_idx, src, idx);
+			handle->zspage = dst;
+			handle->idx = d_idx;
+			obj_free(src, idx);
+
+			bit_spin_unlock(ZS_HANDLE_PIN_BIT, &handle->flags);
+		}
+
+		fix_fullness_group(class, dst);
+		if (fix_fullness_group(class, src) == ZS_EMPTY) {
+			class->zspages--;
+			atomic_long_sub(class->pages_per_zspage,
+					&pool->pages_allocated);
+			free_zspage(pool, class, src);
+			freed += class->pages_per_zspage;
+		} else if (pinned) {
+			break;
+		}
+
+		spin_unlock(&class->lock);
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	list_splice(&candidates, &class->fullness_list[ZS_ALMOST_EMPTY]);
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - migrate objects out of sparsely used zspages
+ * @pool: pool to compact
+ *
+ * Within each size class, objects are moved from the least used
+ * zspages into the most used ones until no two partially used zspages
+ * remain (or the remaining objects are pinned). Emptied zspages are
+ * freed. Returns the number of pages given back to the system.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+		freed += zs_compact_class(pool, &pool->size_class[i]);
+
+	atomic_long_add(freed, &pool->pages_compacted);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+/* Bytes occupied by allocated objects, including class rounding */
+u64 zs_get_used_size_bytes(struct zs_pool *pool)
+{
+	int i;
+	u64 used = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		used += (u64)class->objs_inuse * class->size;
+		spin_unlock(&class->lock);
+	}
+
+	return used;
+}
+EXPORT_SYMBOL_GPL(zs_get_used_size_bytes);
+
+unsigned long zs_get_pages_compacted(struct zs_pool *pool)
+{
+	return atomic_long_read(&pool->pages_compacted);
+}
+EXPORT_SYMBOL_GPL(zs_get_pages_compacted);
@@ -0,0 +1,47 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2011  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_H_
+#define _ZS_MALLOC_H_
+
+#include <linux/types.h>
+
+/*
+ * How an object is going to be accessed between zs_map_object() and
+ * zs_unmap_object(). Objects spanning two pages are bounced through
+ * a per-cpu buffer, so this lets us skip the needless copy.
+ */
+enum zs_mapmode {
+	ZS_MM_RW,	/* normal read-write mapping */
+	ZS_MM_RO,	/* read-only (no copy-out at unmap time) */
+	ZS_MM_WO,	/* write-only (no copy-in at map time) */
+};
+
+struct zs_pool;
+
+struct zs_pool *zs_create_pool(gfp_t flags);
+void zs_destroy_pool(struct zs_pool *pool);
+
+unsigned long zs_malloc(struct zs_pool *pool, size_t size);
+void zs_free(struct zs_pool *pool, unsigned long handle);
+
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm);
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle);
+
+unsigned long zs_compact(struct zs_pool *pool);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool);
+u64 zs_get_used_size_bytes(struct zs_pool *pool);
+unsigned long zs_get_pages_compacted(struct zs_pool *pool);
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2011  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/* User configurable params */
+
+/*
+ * A "zspage" is a group of up to ZS_MAX_PAGES_PER_ZSPAGE 0-order pages
+ * holding objects of a single size class. Objects are laid out back
+ * to back and may straddle the boundary between two of its pages.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are separated by ZS_SIZE_CLASS_DELTA bytes. Smaller
+ * values reduce internal fragmentation at the cost of more classes
+ * (and so more partially filled zspages).
+ */
+#define ZS_SIZE_CLASS_DELTA	16
+#define ZS_SIZE_CLASSES	((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+				ZS_SIZE_CLASS_DELTA + 1)
+
+/* A zspage is "almost full" once 3/4 of its objects are in use */
+#define ZS_ALMOST_FULL_NUM	3
+#define ZS_ALMOST_FULL_DEN	4
+
+/* End of user params */
+
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+};
+
+/*
+ * Each object slot of a zspage holds either a back-pointer to the
+ * zs_handle owning it, or, for free slots, the index of the next free
+ * slot shifted left by one and tagged with ZS_SLOT_FREE. Handles come
+ * from a slab cache, so their low bit is always clear.
+ */
+#define ZS_SLOT_FREE		1UL
+#define ZS_SLOT_SHIFT		1
+
+struct zspage {
+	struct list_head list;		/* fullness group of its class */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	u16 class_idx;
+	u16 inuse;			/* no. of allocated objects */
+	u16 first_free;			/* == objs_per_zspage when full */
+	u8 fullness;
+	unsigned long slots[0];
+};
+
+/*
+ * The value returned by zs_malloc() points to one of these. The extra
+ * indirection lets compaction move objects without the user noticing.
+ * ZS_HANDLE_PIN_BIT of 'flags' is held while the object is mapped or
+ * being freed; compaction skips pinned objects.
+ */
+#define ZS_HANDLE_PIN_BIT	0
+
+struct zs_handle {
+	unsigned long flags;
+	struct zspage *zspage;
+	unsigned int idx;
+};
+
+struct size_class {
+	spinlock_t lock;
+	unsigned int size;
+	unsigned int index;
+	unsigned int pages_per_zspage;
+	unsigned int objs_per_zspage;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+
+	/* stats, protected by lock */
+	unsigned long zspages;
+	unsigned long objs_inuse;
+};
+
+/* Per-cpu state of the (single) object currently mapped on a cpu */
+struct zs_map_area {
+	char *buf;		/* bounce buffer for spanning objects */
+	char *vm_addr;		/* kmap_atomic address, NULL if spanning */
+	enum zs_mapmode mm;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+	struct zs_map_area __percpu *map_area;
+	gfp_t flags;		/* allocation flags used for zspages */
+
+	atomic_long_t pages_allocated;
+	atomic_long_t pages_compacted;
+};
+
+#endif
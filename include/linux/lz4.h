@@ -0,0 +1,42 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Public Kernel Interface
+ *  A compact implementation of the LZ4 block format
+ *
+ *  Copyright (C) 2011-2012, Yann Collet.
+ *  BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ *  The block format is documented at:
+ *  http://code.google.com/p/lz4/
+ */
+
+#define LZ4_HASH_LOG		12
+#define LZ4_MEM_COMPRESS	((1 << LZ4_HASH_LOG) * sizeof(u32))
+
+/* Largest possible output for an input of x bytes */
+#define lz4_compressbound(x)	((x) + ((x) / 255) + 16)
+
+/*
+ * This requires 'wrkmem' of size LZ4_MEM_COMPRESS and 'dst' of at
+ * least lz4_compressbound(src_len) bytes.
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		 unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * Safe decompression with overrun testing. On entry *dst_len is the
+ * size of 'dst', on success it is set to the number of bytes produced.
+ */
+int lz4_decompress_unknownoutputsize(const unsigned char *src,
+		size_t src_len, unsigned char *dst, size_t *dst_len);
+
+/*
+ * Return values (< 0 = Error)
+ */
+#define LZ4_E_OK		0
+#define LZ4_E_INPUT_OVERRUN	(-1)
+#define LZ4_E_OUTPUT_OVERRUN	(-2)
+#define LZ4_E_LOOKBEHIND_OVERRUN	(-3)
+
+#endif
@@ -68,6 +68,35 @@ extern unsigned long badness(struct task_struct *p, struct mem_cgroup *mem,
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+/* Candidate tracking for the Android low memory killer */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_adj_add(struct task_struct *p);
+extern void lowmem_adj_del(struct task_struct *p);
+extern void lowmem_adj_replace(struct task_struct *old,
+			       struct task_struct *p);
+extern void lowmem_adj_update(struct task_struct *task);
+extern void lowmem_vmpressure(gfp_t gfp_mask, unsigned long scanned,
+			      unsigned long reclaimed);
+#else
+static inline void lowmem_adj_add(struct task_struct *p)
+{
+}
+static inline void lowmem_adj_del(struct task_struct *p)
+{
+}
+static inline void lowmem_adj_replace(struct task_struct *old,
+				      struct task_struct *p)
+{
+}
+static inline void lowmem_adj_update(struct task_struct *task)
+{
+}
+static inline void lowmem_vmpressure(gfp_t gfp_mask, unsigned long scanned,
+				     unsigned long reclaimed)
+{
+}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
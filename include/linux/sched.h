@@ -80,6 +80,7 @@ struct sched_param {
 #include <linux/seccomp.h>
 #include <linux/rcupdate.h>
 #include <linux/rculist.h>
+#include <linux/list_nulls.h>
 #include <linux/rtmutex.h>
 
 #include <linux/time.h>
@@ -140,7 +141,12 @@ extern unsigned long nr_running(void);
 extern unsigned long nr_uninterruptible(void);
 extern unsigned long nr_iowait(void);
 extern unsigned long avg_nr_running(void);
+extern unsigned int avg_cpu_nr_running(unsigned int cpu);
 extern unsigned long nr_iowait_cpu(int cpu);
+extern unsigned long nr_running_cpu(int cpu);
+extern unsigned long cpu_task_load(int cpu);
+#define TASK_LOAD_SHIFT		10
+#define TASK_LOAD_SCALE		(1 << TASK_LOAD_SHIFT)
 extern unsigned long this_cpu_load(void);
 
 
@@ -1153,6 +1159,10 @@ struct sched_entity {
 
 	u64			nr_migrations;
 
+	/* decayed runnable share of a task, see update_task_load() */
+	u64			task_load_stamp;
+	unsigned int		task_load;
+
 #ifdef CONFIG_SCHEDSTATS
 	struct sched_statistics statistics;
 #endif
@@ -1250,6 +1260,9 @@ struct task_struct {
 #endif
 
 	struct list_head tasks;
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct hlist_nulls_node lowmem_adj_node;
+#endif
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 #endif
@@ -1731,6 +1744,14 @@ extern int task_free_unregister(struct notifier_block *n);
 extern int task_fork_register(struct notifier_block *n);
 extern int task_fork_unregister(struct notifier_block *n);
 
+/* sched_load_register() events, the data argument is the cpu number */
+#define SCHED_LOAD_TICK		0	/* scheduler tick on that cpu */
+#define SCHED_LOAD_ENQUEUE	1	/* nr_running went up, rq locked */
+#define SCHED_LOAD_DEQUEUE	2	/* nr_running went down, rq locked */
+
+extern int sched_load_register(struct notifier_block *n);
+extern int sched_load_unregister(struct notifier_block *n);
+
 /*
  * Per process flags
  */
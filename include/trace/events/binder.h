@@ -0,0 +1,89 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+
+#if !defined(_TRACE_BINDER_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_BINDER_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(binder_transaction,
+	    TP_PROTO(int debug_id, int reply, int from_proc, int from_thread,
+		     int to_proc, int to_thread, unsigned int code,
+		     unsigned int flags),
+	    TP_ARGS(debug_id, reply, from_proc, from_thread, to_proc,
+		    to_thread, code, flags),
+
+	    TP_STRUCT__entry(
+		    __field(int,          debug_id    )
+		    __field(int,          reply       )
+		    __field(int,          from_proc   )
+		    __field(int,          from_thread )
+		    __field(int,          to_proc     )
+		    __field(int,          to_thread   )
+		    __field(unsigned int, code        )
+		    __field(unsigned int, flags       )
+	    ),
+
+	    TP_fast_assign(
+		    __entry->debug_id = debug_id;
+		    __entry->reply = reply;
+		    __entry->from_proc = from_proc;
+		    __entry->from_thread = from_thread;
+		    __entry->to_proc = to_proc;
+		    __entry->to_thread = to_thread;
+		    __entry->code = code;
+		    __entry->flags = flags;
+	    ),
+
+	    TP_printk("transaction=%d reply=%d from=%d:%d to=%d:%d code=0x%x "
+		      "flags=0x%x",
+		      __entry->debug_id, __entry->reply, __entry->from_proc,
+		      __entry->from_thread, __entry->to_proc,
+		      __entry->to_thread, __entry->code, __entry->flags)
+);
+
+DECLARE_EVENT_CLASS(binder_transaction_latency,
+	    TP_PROTO(int debug_id, int proc, int thread, u64 latency_ns),
+	    TP_ARGS(debug_id, proc, thread, latency_ns),
+
+	    TP_STRUCT__entry(
+		    __field(int, debug_id   )
+		    __field(int, proc       )
+		    __field(int, thread     )
+		    __field(u64, latency_ns )
+	    ),
+
+	    TP_fast_assign(
+		    __entry->debug_id = debug_id;
+		    __entry->proc = proc;
+		    __entry->thread = thread;
+		    __entry->latency_ns = latency_ns;
+	    ),
+
+	    TP_printk("transaction=%d by=%d:%d latency=%llu ns",
+		      __entry->debug_id, __entry->proc, __entry->thread,
+		      (unsigned long long)__entry->latency_ns)
+);
+
+/* submit to the receiving thread leaving its wait */
+DEFINE_EVENT(binder_transaction_latency, binder_transaction_wake,
+	    TP_PROTO(int debug_id, int proc, int thread, u64 latency_ns),
+	    TP_ARGS(debug_id, proc, thread, latency_ns)
+);
+
+/* submit to the transaction being copied out to the receiving thread */
+DEFINE_EVENT(binder_transaction_latency, binder_transaction_read,
+	    TP_PROTO(int debug_id, int proc, int thread, u64 latency_ns),
+	    TP_ARGS(debug_id, proc, thread, latency_ns)
+);
+
+/* read of a sync transaction to its reply being submitted */
+DEFINE_EVENT(binder_transaction_latency, binder_transaction_reply,
+	    TP_PROTO(int debug_id, int proc, int thread, u64 latency_ns),
+	    TP_ARGS(debug_id, proc, thread, latency_ns)
+);
+
+#endif /* _TRACE_BINDER_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -82,6 +82,38 @@ DEFINE_EVENT(loadeval, cpufreq_interactive_notyet,
 	    TP_ARGS(cpu_id, load, curfreq, targfreq)
 );
 
+/*
+ * sample_us: span of the load sample the decision was taken on,
+ * set_us: from the decision until the driver had set the speed.
+ */
+TRACE_EVENT(cpufreq_interactive_latency,
+	    TP_PROTO(u32 cpu_id, unsigned long targfreq,
+		     unsigned long actualfreq, u64 sample_us, u64 set_us),
+	    TP_ARGS(cpu_id, targfreq, actualfreq, sample_us, set_us),
+
+	    TP_STRUCT__entry(
+		    __field(          u32, cpu_id     )
+		    __field(unsigned long, targfreq   )
+		    __field(unsigned long, actualfreq )
+		    __field(          u64, sample_us  )
+		    __field(          u64, set_us     )
+	    ),
+
+	    TP_fast_assign(
+		    __entry->cpu_id = cpu_id;
+		    __entry->targfreq = targfreq;
+		    __entry->actualfreq = actualfreq;
+		    __entry->sample_us = sample_us;
+		    __entry->set_us = set_us;
+	    ),
+
+	    TP_printk("cpu=%u targ=%lu actual=%lu sample_us=%llu set_us=%llu",
+		      __entry->cpu_id, __entry->targfreq,
+		      __entry->actualfreq,
+		      (unsigned long long)__entry->sample_us,
+		      (unsigned long long)__entry->set_us)
+);
+
 TRACE_EVENT(cpufreq_interactive_boost,
 	    TP_PROTO(unsigned long freq),
 	    TP_ARGS(freq),
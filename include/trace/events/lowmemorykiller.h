@@ -0,0 +1,69 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+
+#if !defined(_TRACE_LOWMEMORYKILLER_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_LOWMEMORYKILLER_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(lowmem_select,
+	    TP_PROTO(int min_adj, int scanned, pid_t pid, int oom_adj,
+		     int tasksize, u64 latency_ns),
+	    TP_ARGS(min_adj, scanned, pid, oom_adj, tasksize, latency_ns),
+
+	    TP_STRUCT__entry(
+		    __field(int,   min_adj    )
+		    __field(int,   scanned    )
+		    __field(pid_t, pid        )
+		    __field(int,   oom_adj    )
+		    __field(int,   tasksize   )
+		    __field(u64,   latency_ns )
+	    ),
+
+	    TP_fast_assign(
+		    __entry->min_adj = min_adj;
+		    __entry->scanned = scanned;
+		    __entry->pid = pid;
+		    __entry->oom_adj = oom_adj;
+		    __entry->tasksize = tasksize;
+		    __entry->latency_ns = latency_ns;
+	    ),
+
+	    TP_printk("min_adj=%d scanned=%d pid=%d adj=%d size=%d "
+		      "latency=%llu ns",
+		      __entry->min_adj, __entry->scanned, __entry->pid,
+		      __entry->oom_adj, __entry->tasksize,
+		      (unsigned long long)__entry->latency_ns)
+);
+
+TRACE_EVENT(lowmem_pressure,
+	    TP_PROTO(int level, unsigned long pressure, unsigned long scanned,
+		     unsigned long reclaimed, unsigned long alloc_rate),
+	    TP_ARGS(level, pressure, scanned, reclaimed, alloc_rate),
+
+	    TP_STRUCT__entry(
+		    __field(int,           level      )
+		    __field(unsigned long, pressure   )
+		    __field(unsigned long, scanned    )
+		    __field(unsigned long, reclaimed  )
+		    __field(unsigned long, alloc_rate )
+	    ),
+
+	    TP_fast_assign(
+		    __entry->level = level;
+		    __entry->pressure = pressure;
+		    __entry->scanned = scanned;
+		    __entry->reclaimed = reclaimed;
+		    __entry->alloc_rate = alloc_rate;
+	    ),
+
+	    TP_printk("level=%d pressure=%lu%% scanned=%lu reclaimed=%lu "
+		      "alloc_rate=%lu pages/s",
+		      __entry->level, __entry->pressure, __entry->scanned,
+		      __entry->reclaimed, __entry->alloc_rate)
+);
+
+#endif /* _TRACE_LOWMEMORYKILLER_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
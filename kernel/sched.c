@@ -470,6 +470,9 @@ struct rq {
 	unsigned int ave_nr_running;
 	seqcount_t ave_seqcnt;
 
+	/* sum of the task_load of the cfs tasks queued here */
+	unsigned long task_load;
+
 	/* capture load from *all* tasks on this cpu: */
 	struct load_weight load;
 	unsigned long nr_load_updates;
@@ -1776,6 +1779,28 @@ static inline unsigned int do_avg_nr_running(struct rq *rq)
 	return ave_nr_running;
 }
 
+static ATOMIC_NOTIFIER_HEAD(sched_load_notifier);
+
+/*
+ * Let cpu load governors follow the runqueues from the scheduler itself
+ * rather than polling them. Callbacks get the event type and the cpu
+ * number, see SCHED_LOAD_* in <linux/sched.h>. The tick event comes from
+ * hard irq context; enqueue and dequeue come with that cpu's runqueue lock
+ * held, so their callbacks must neither take runqueue locks nor wake up
+ * tasks.
+ */
+int sched_load_register(struct notifier_block *n)
+{
+	return atomic_notifier_chain_register(&sched_load_notifier, n);
+}
+EXPORT_SYMBOL(sched_load_register);
+
+int sched_load_unregister(struct notifier_block *n)
+{
+	return atomic_notifier_chain_unregister(&sched_load_notifier, n);
+}
+EXPORT_SYMBOL(sched_load_unregister);
+
 static void inc_nr_running(struct rq *rq)
 {
 	write_seqcount_begin(&rq->ave_seqcnt);
@@ -1783,6 +1808,9 @@ static void inc_nr_running(struct rq *rq)
 	rq->nr_last_stamp = rq->clock_task;
 	rq->nr_running++;
 	write_seqcount_end(&rq->ave_seqcnt);
+
+	atomic_notifier_call_chain(&sched_load_notifier, SCHED_LOAD_ENQUEUE,
+				   (void *)(long)cpu_of(rq));
 }
 
 static void dec_nr_running(struct rq *rq)
@@ -1792,6 +1820,9 @@ static void dec_nr_running(struct rq *rq)
 	rq->nr_last_stamp = rq->clock_task;
 	rq->nr_running--;
 	write_seqcount_end(&rq->ave_seqcnt);
+
+	atomic_notifier_call_chain(&sched_load_notifier, SCHED_LOAD_DEQUEUE,
+				   (void *)(long)cpu_of(rq));
 }
 
 static void set_load_weight(struct task_struct *p)
@@ -2650,6 +2681,8 @@ static void __sched_fork(struct task_struct *p)
 	p->se.prev_sum_exec_runtime	= 0;
 	p->se.nr_migrations		= 0;
 	p->se.vruntime			= 0;
+	p->se.task_load_stamp		= 0;
+	p->se.task_load			= 0;
 
 #ifdef CONFIG_SCHEDSTATS
 	memset(&p->se.statistics, 0, sizeof(p->se.statistics));
@@ -3096,29 +3129,38 @@ unsigned long nr_iowait(void)
 	return sum;
 }
 
-unsigned long avg_nr_running(void)
+/*
+ * Time-averaged number of runnable tasks on one cpu, in FSHIFT fixed
+ * point.
+ */
+unsigned int avg_cpu_nr_running(unsigned int cpu)
 {
-	unsigned long i, sum = 0;
+	struct rq *q = cpu_rq(cpu);
 	unsigned int seqcnt, ave_nr_running;
 
-	for_each_online_cpu(i) {
-		struct rq *q = cpu_rq(i);
+	/*
+	 * Update average to avoid reading stalled value if there were
+	 * no run-queue changes for a long time. On the other hand if
+	 * the changes are happening right now, just read current value
+	 * directly.
+	 */
+	seqcnt = read_seqcount_begin(&q->ave_seqcnt);
+	ave_nr_running = do_avg_nr_running(q);
+	if (read_seqcount_retry(&q->ave_seqcnt, seqcnt)) {
+		read_seqcount_begin(&q->ave_seqcnt);
+		ave_nr_running = q->ave_nr_running;
+	}
 
-		/*
-		 * Update average to avoid reading stalled value if there were
-		 * no run-queue changes for a long time. On the other hand if
-		 * the changes are happening right now, just read current value
-		 * directly.
-		 */
-		seqcnt = read_seqcount_begin(&q->ave_seqcnt);
-		ave_nr_running = do_avg_nr_running(q);
-		if (read_seqcount_retry(&q->ave_seqcnt, seqcnt)) {
-			read_seqcount_begin(&q->ave_seqcnt);
-			ave_nr_running = q->ave_nr_running;
-		}
+	return ave_nr_running;
+}
+EXPORT_SYMBOL(avg_cpu_nr_running);
 
-		sum += ave_nr_running;
-	}
+unsigned long avg_nr_running(void)
+{
+	unsigned long i, sum = 0;
+
+	for_each_online_cpu(i)
+		sum += avg_cpu_nr_running(i);
 
 	return sum;
 }
@@ -3129,6 +3171,22 @@ unsigned long nr_iowait_cpu(int cpu)
 	return atomic_read(&this->nr_iowait);
 }
 
+unsigned long nr_running_cpu(int cpu)
+{
+	return cpu_rq(cpu)->nr_running;
+}
+EXPORT_SYMBOL(nr_running_cpu);
+
+/*
+ * Load the tasks queued on a cpu bring along, TASK_LOAD_SCALE for each
+ * task that has recently been runnable all the time, wherever it ran.
+ */
+unsigned long cpu_task_load(int cpu)
+{
+	return cpu_rq(cpu)->task_load;
+}
+EXPORT_SYMBOL(cpu_task_load);
+
 unsigned long this_cpu_load(void)
 {
 	struct rq *this = this_rq();
@@ -4093,6 +4151,9 @@ void scheduler_tick(void)
 	curr->sched_class->task_tick(rq, curr, 0);
 	raw_spin_unlock(&rq->lock);
 
+	atomic_notifier_call_chain(&sched_load_notifier, SCHED_LOAD_TICK,
+				   (void *)(long)cpu);
+
 	perf_event_task_tick();
 
 #ifdef CONFIG_SMP
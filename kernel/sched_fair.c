@@ -1315,6 +1315,75 @@ static inline void hrtick_update(struct rq *rq)
 }
 #endif
 
+/*
+ * Per-task load: the share of recent time a task has been runnable, in
+ * TASK_LOAD_SCALE units, decayed by y per ~1ms period with y^32 = 1/2.
+ * rq->task_load sums it over the tasks queued on the cpu, and since a
+ * migration is a dequeue here and an enqueue there, a task carries its
+ * load along to the destination cpu, where cpufreq governors can read it
+ * with cpu_task_load() before any busy time has been seen there.
+ *
+ * Only the running task is refreshed on the tick, waiting ones are
+ * brought up to date when they are dequeued.
+ */
+#define TASK_LOAD_PERIOD_SHIFT	20
+#define TASK_LOAD_HALFLIFE	32
+
+/* 2^32 * y^n */
+static const u32 task_load_decay[TASK_LOAD_HALFLIFE] = {
+	0xffffffff, 0xfa83b2db, 0xf5257d15, 0xefe4b99c,
+	0xeac0c6e8, 0xe5b906e7, 0xe0ccdeec, 0xdbfbb798,
+	0xd744fccb, 0xd2a81d92, 0xce248c15, 0xc9b9bd86,
+	0xc5672a11, 0xc12c4cca, 0xbd08a39f, 0xb8fbaf47,
+	0xb504f334, 0xb123f582, 0xad583eea, 0xa9a15ab5,
+	0xa5fed6aa, 0xa2704303, 0x9ef53261, 0x9b8d39ba,
+	0x9837f052, 0x94f4efa9, 0x91c3d374, 0x8ea4398b,
+	0x8b95c1e4, 0x88980e81, 0x85aac368, 0x82cd8699,
+};
+
+static unsigned int decay_task_load(unsigned int load, u64 periods)
+{
+	unsigned int n;
+
+	if (periods >= TASK_LOAD_HALFLIFE * (TASK_LOAD_SHIFT + 1))
+		return 0;
+
+	n = periods;
+	load >>= n / TASK_LOAD_HALFLIFE;
+	return ((u64)load * task_load_decay[n % TASK_LOAD_HALFLIFE]) >> 32;
+}
+
+/*
+ * Age the load of @se up to now, @runnable telling whether it has been
+ * queued since the last update. Returns the change to the load.
+ */
+static int update_task_load(struct rq *rq, struct sched_entity *se,
+			    int runnable)
+{
+	unsigned int old = se->task_load;
+	s64 delta = rq->clock_task - se->task_load_stamp;
+	u64 periods;
+
+	/* cpu clocks are not in sync, a migrated task may be ahead */
+	if (delta < 0) {
+		se->task_load_stamp = rq->clock_task;
+		return 0;
+	}
+
+	periods = (u64)delta >> TASK_LOAD_PERIOD_SHIFT;
+	if (!periods)
+		return 0;
+
+	se->task_load_stamp += periods << TASK_LOAD_PERIOD_SHIFT;
+	if (runnable)
+		se->task_load = TASK_LOAD_SCALE -
+			decay_task_load(TASK_LOAD_SCALE - old, periods);
+	else
+		se->task_load = decay_task_load(old, periods);
+
+	return se->task_load - old;
+}
+
 /*
  * The enqueue_task method is called before nr_running is
  * increased. Here we update the fair scheduling stats and
@@ -1326,6 +1395,9 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 	struct cfs_rq *cfs_rq;
 	struct sched_entity *se = &p->se;
 
+	update_task_load(rq, se, 0);
+	rq->task_load += se->task_load;
+
 	for_each_sched_entity(se) {
 		if (se->on_rq)
 			break;
@@ -1354,6 +1426,9 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 	struct cfs_rq *cfs_rq;
 	struct sched_entity *se = &p->se;
 
+	rq->task_load += update_task_load(rq, se, 1);
+	rq->task_load -= se->task_load;
+
 	for_each_sched_entity(se) {
 		cfs_rq = cfs_rq_of(se);
 		dequeue_entity(cfs_rq, se, flags);
@@ -1371,6 +1446,10 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 		update_cfs_shares(cfs_rq);
 	}
 
+	/* each task takes back exactly what it contributed */
+	if (!rq->cfs.nr_running && WARN_ON_ONCE(rq->task_load))
+		rq->task_load = 0;
+
 	hrtick_update(rq);
 }
 
@@ -4079,6 +4158,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 	struct cfs_rq *cfs_rq;
 	struct sched_entity *se = &curr->se;
 
+	rq->task_load += update_task_load(rq, se, 1);
+
 	for_each_sched_entity(se) {
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
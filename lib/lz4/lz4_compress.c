@@ -0,0 +1,123 @@
+/*
+ *  LZ4 Compressor
+ *
+ *  Copyright (C) 2011-2012, Yann Collet.
+ *  BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ *  Greedy single-pass compressor producing the LZ4 block format, with
+ *  a 4K entry hash table of positions relative to the start of input.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		 unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 * const table = wrkmem;
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst;
+	unsigned char *token;
+	size_t len;
+
+	if (src_len < MINLENGTH)
+		goto last_literals;
+
+	memset(table, 0, LZ4_MEM_COMPRESS);
+	table[LZ4_HASH(LZ4_READ32(ip))] = 0;
+	ip++;
+
+	while (ip < mflimit) {
+		const unsigned char *ref;
+		u32 h = LZ4_HASH(LZ4_READ32(ip));
+
+		ref = src + table[h];
+		table[h] = ip - src;
+
+		if (ref >= ip || ip - ref > MAX_DISTANCE ||
+		    LZ4_READ32(ref) != LZ4_READ32(ip)) {
+			ip++;
+			continue;
+		}
+
+		/* extend the match backwards over pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		/* literal run */
+		len = ip - anchor;
+		token = op++;
+		if (len >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, len - RUN_MASK);
+		} else
+			*token = len << ML_BITS;
+		memcpy(op, anchor, len);
+		op += len;
+
+		/* offset */
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		/* match length */
+		anchor = ip;
+		ip += MINMATCH;
+		ref += MINMATCH;
+		while (ip < matchlimit && *ip == *ref) {
+			ip++;
+			ref++;
+		}
+
+		len = ip - anchor - MINMATCH;
+		if (len >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_put_length(op, len - ML_MASK);
+		} else
+			*token |= len;
+
+		anchor = ip;
+
+		/* keep the table warm for the next match search */
+		if (ip < mflimit)
+			table[LZ4_HASH(LZ4_READ32(ip - 2))] = ip - 2 - src;
+	}
+
+last_literals:
+	len = iend - anchor;
+	token = op++;
+	if (len >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, len - RUN_MASK);
+	} else
+		*token = len << ML_BITS;
+	memcpy(op, anchor, len);
+	op += len;
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
@@ -0,0 +1,112 @@
+/*
+ *  LZ4 Decompressor
+ *
+ *  Copyright (C) 2011-2012, Yann Collet.
+ *  BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ *  Every length and offset read from the stream is checked against
+ *  both buffers, so corrupted input can not overrun either of them.
+ */
+
+#ifndef STATIC
+#include <linux/module.h>
+#include <linux/kernel.h>
+#endif
+#include <linux/string.h>
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src,
+		size_t src_len, unsigned char *dst, size_t *dst_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char * const iend = src + src_len;
+	unsigned char *op = dst;
+	unsigned char * const oend = dst + *dst_len;
+
+	while (ip < iend) {
+		const unsigned char *ref;
+		unsigned int token;
+		size_t len, offset;
+		unsigned char s;
+
+		token = *ip++;
+
+		/* literal run */
+		len = token >> ML_BITS;
+		if (len == RUN_MASK) {
+			do {
+				if (unlikely(ip >= iend))
+					goto input_overrun;
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+
+		if (unlikely(len > (size_t)(iend - ip)))
+			goto input_overrun;
+		if (unlikely(len > (size_t)(oend - op)))
+			goto output_overrun;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* the last sequence carries literals only */
+		if (ip == iend)
+			break;
+
+		if (unlikely(iend - ip < 2))
+			goto input_overrun;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(!offset || offset > (size_t)(op - dst)))
+			goto lookbehind_overrun;
+		ref = op - offset;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK) {
+			do {
+				if (unlikely(ip >= iend))
+					goto input_overrun;
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+		len += MINMATCH;
+
+		if (unlikely(len > (size_t)(oend - op)))
+			goto output_overrun;
+
+		if (offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else {
+			/* overlapping copy replicates the last offset bytes */
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+
+input_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_INPUT_OVERRUN;
+
+output_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_OUTPUT_OVERRUN;
+
+lookbehind_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_LOOKBEHIND_OVERRUN;
+}
+#ifndef STATIC
+EXPORT_SYMBOL_GPL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ *  lz4defs.h -- block format constants shared by compressor and
+ *  decompressor
+ *
+ *  Copyright (C) 2011-2012, Yann Collet.
+ *  BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ */
+
+#define MINMATCH	4
+#define COPYLENGTH	8
+#define LASTLITERALS	5
+#define MFLIMIT		(COPYLENGTH + MINMATCH)
+#define MINLENGTH	(MFLIMIT + 1)
+
+#define MAX_DISTANCE	((1 << 16) - 1)
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define LZ4_READ32(p)	get_unaligned((const u32 *)(p))
+#define LZ4_HASH(v)	(((v) * 2654435761U) >> (32 - LZ4_HASH_LOG))
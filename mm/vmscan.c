@@ -1941,6 +1941,11 @@ restart:
 	if (inactive_anon_is_low(zone, sc))
 		shrink_active_list(SWAP_CLUSTER_MAX, zone, sc, priority, 0);
 
+	/* let the low memory killer see how well reclaim is doing */
+	if (scanning_global_lru(sc))
+		lowmem_vmpressure(sc->gfp_mask, sc->nr_scanned - nr_scanned,
+				  nr_reclaimed);
+
 	/* reclaim/compaction might need reclaim to continue */
 	if (should_continue_reclaim(zone, nr_reclaimed,
 					sc->nr_scanned - nr_scanned, sc))
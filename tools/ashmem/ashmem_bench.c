@@ -0,0 +1,311 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -g -o ashmem_bench ashmem_bench.c -lpthread */
+
+/*
+ * ashmem pin/unpin latency under concurrency and reclaim
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+/*
+ * Runs 1..N threads, each repeatedly dirtying a few pages of an ashmem
+ * region, unpinning them and pinning them back the way a cache of
+ * decoded images would, and reports the aggregate ioctl rate, the median
+ * and 99th percentile ioctl latency and how often a pin found its pages
+ * purged, for every N.
+ *
+ * By default every thread has an area of its own. With -S they all work
+ * on separate pages of one shared area instead, which is what the
+ * per-area locking cannot help with. With -p another thread purges all
+ * unpinned pages every so many milliseconds through
+ * ASHMEM_PURGE_ALL_CACHES, standing in for the shrinker under memory
+ * pressure; that needs CAP_SYS_ADMIN.
+ *
+ * Typical usage:
+ *	ashmem_bench -t 8 -s 2
+ *	ashmem_bench -t 8 -s 2 -p 10
+ *	ashmem_bench -t 8 -s 2 -p 10 -S
+ */
+
+#include <fcntl.h>
+#include <linux/types.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../include/linux/ashmem.h"
+
+#define HIST_US		20000	/* 1us latency buckets, plus one overflow */
+#define MAX_CHUNK	8	/* most pages unpinned at once */
+
+struct worker {
+	pthread_t thread;
+	int fd;
+	unsigned char *map;
+	unsigned int first_page;
+	unsigned int seed;
+	unsigned long ops, pins, purged;
+	unsigned int *hist;
+	int failed;
+};
+
+static int duration = 1;
+static unsigned int nr_pages = 64, purge_ms;
+static long page_size;
+static volatile int stop;
+static pthread_barrier_t start_barrier;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int timed_ioctl(struct worker *w, unsigned long cmd,
+		       struct ashmem_pin *pin)
+{
+	double t0, us;
+	int ret;
+
+	t0 = now();
+	ret = ioctl(w->fd, cmd, pin);
+	us = (now() - t0) * 1e6;
+	w->hist[us < HIST_US ? (unsigned int)us : HIST_US]++;
+	w->ops++;
+	return ret;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	struct ashmem_pin pin;
+	unsigned int page, len, i;
+	int ret;
+
+	pthread_barrier_wait(&start_barrier);
+
+	while (!stop) {
+		len = 1 + rand_r(&w->seed) % MAX_CHUNK;
+		page = rand_r(&w->seed) % (nr_pages - len + 1);
+
+		for (i = 0; i < len; i++)
+			w->map[(page + i) * page_size] = 1;
+
+		pin.offset = (w->first_page + page) * page_size;
+		pin.len = len * page_size;
+		if (timed_ioctl(w, ASHMEM_UNPIN, &pin) < 0) {
+			w->failed = 1;
+			break;
+		}
+		ret = timed_ioctl(w, ASHMEM_PIN, &pin);
+		if (ret < 0) {
+			w->failed = 1;
+			break;
+		}
+		w->pins++;
+		if (ret == ASHMEM_WAS_PURGED)
+			w->purged++;
+	}
+
+	if (w->failed)
+		perror("ASHMEM_PIN/UNPIN");
+	return NULL;
+}
+
+static void *purger_fn(void *arg)
+{
+	int fd = *(int *)arg;
+
+	pthread_barrier_wait(&start_barrier);
+
+	while (!stop) {
+		if (ioctl(fd, ASHMEM_PURGE_ALL_CACHES) < 0) {
+			perror("ASHMEM_PURGE_ALL_CACHES");
+			exit(1);
+		}
+		usleep(purge_ms * 1000);
+	}
+
+	return NULL;
+}
+
+static int area_create(unsigned int pages, unsigned char **map)
+{
+	size_t size = (size_t)pages * page_size;
+	int fd;
+
+	fd = open("/dev/ashmem", O_RDWR);
+	if (fd < 0) {
+		perror("/dev/ashmem");
+		return -1;
+	}
+	if (ioctl(fd, ASHMEM_SET_NAME, "ashmem_bench") < 0 ||
+	    ioctl(fd, ASHMEM_SET_SIZE, size) < 0) {
+		perror("ashmem setup");
+		close(fd);
+		return -1;
+	}
+	*map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (*map == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static unsigned int percentile(const unsigned int *hist, unsigned long total,
+			       double pct)
+{
+	unsigned long sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_US; i++) {
+		sum += hist[i];
+		if (sum >= total * pct)
+			break;
+	}
+	return i;
+}
+
+static int run(int nr_threads, int shared)
+{
+	struct worker *w;
+	unsigned int *hist;
+	unsigned long ops = 0, pins = 0, purged = 0;
+	unsigned char *map = NULL;
+	pthread_t purger;
+	int fd = -1;
+	int i, j, ret = 0;
+	double t0, t1;
+
+	w = calloc(nr_threads, sizeof(*w));
+	hist = calloc(HIST_US + 1, sizeof(*hist));
+	if (!w || !hist)
+		return -1;
+
+	if (shared) {
+		fd = area_create(nr_pages * nr_threads, &map);
+		if (fd < 0)
+			return -1;
+	}
+	for (i = 0; i < nr_threads; i++) {
+		w[i].hist = calloc(HIST_US + 1, sizeof(*w[i].hist));
+		if (!w[i].hist)
+			return -1;
+		if (shared) {
+			w[i].fd = fd;
+			w[i].first_page = i * nr_pages;
+			w[i].map = map + (size_t)w[i].first_page * page_size;
+		} else {
+			w[i].fd = area_create(nr_pages, &w[i].map);
+			if (w[i].fd < 0)
+				return -1;
+		}
+		w[i].seed = i + 1;
+	}
+
+	stop = 0;
+	pthread_barrier_init(&start_barrier, NULL,
+			     nr_threads + 1 + !!purge_ms);
+	for (i = 0; i < nr_threads; i++)
+		pthread_create(&w[i].thread, NULL, worker_fn, &w[i]);
+	if (purge_ms)
+		pthread_create(&purger, NULL, purger_fn, &w[0].fd);
+
+	pthread_barrier_wait(&start_barrier);
+	t0 = now();
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(w[i].thread, NULL);
+		ops += w[i].ops;
+		pins += w[i].pins;
+		purged += w[i].purged;
+		for (j = 0; j <= HIST_US; j++)
+			hist[j] += w[i].hist[j];
+		if (w[i].failed)
+			ret = -1;
+	}
+	t1 = now();
+	if (purge_ms)
+		pthread_join(purger, NULL);
+
+	for (i = 0; i < nr_threads; i++) {
+		if (!shared) {
+			munmap(w[i].map, (size_t)nr_pages * page_size);
+			close(w[i].fd);
+		}
+		free(w[i].hist);
+	}
+	if (shared) {
+		munmap(map, (size_t)nr_pages * nr_threads * page_size);
+		close(fd);
+	}
+
+	printf("%7d %12.0f %9u %9u %9.2f\n", nr_threads, ops / (t1 - t0),
+	       percentile(hist, ops, 0.50), percentile(hist, ops, 0.99),
+	       pins ? 100.0 * purged / pins : 0.0);
+
+	pthread_barrier_destroy(&start_barrier);
+	free(hist);
+	free(w);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t max_threads] [-s seconds] [-n pages_per_thread]"
+		" [-p purge_interval_ms] [-S]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int shared = 0;
+	int opt, n;
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	while ((opt = getopt(argc, argv, "t:s:n:p:S")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			duration = atoi(optarg);
+			break;
+		case 'n':
+			nr_pages = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			purge_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			shared = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (max_threads < 1 || duration < 1 || nr_pages < MAX_CHUNK)
+		usage(argv[0]);
+
+	printf("threads     ioctls/s   p50(us)   p99(us)   purged%%\n");
+	for (n = 1; n <= max_threads; n++)
+		if (run(n, shared))
+			return 1;
+
+	return 0;
+}
@@ -0,0 +1,115 @@
+#!/bin/sh
+#
+# BFQ foreground cgroup read latency test
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation.
+#
+# Runs a background writer doing buffered writes with periodic fdatasync()
+# in one bfqio cgroup and a small random direct reader, standing in for an
+# app being launched, in another, first with the reader's cgroup marked as
+# foreground (bfqio.foreground) and then without, and reports the reader's
+# completion latencies and the writer's bandwidth for both.
+#
+# The device holding the test directory must use the bfq scheduler with
+# low_latency enabled; pass its name with -b to have the script set that
+# up. Needs fio (with --minimal, i.e. terse version 3, output) and root.
+#
+# Typical usage:
+#	fg_latency.sh -d /data/local/tmp -b mmcblk0
+#	fg_latency.sh -d /mnt/test -s 30 -c /dev/bfqio
+#
+
+DIR=
+BLOCKDEV=
+CGROUP=/dev/bfqio
+SECONDS_PER_RUN=20
+READ_SIZE=256m
+WRITE_SIZE=1g
+
+usage() {
+	echo "usage: $0 -d test_dir [-b block_device] [-c bfqio_mount]" \
+	     "[-s seconds]" >&2
+	exit 1
+}
+
+while getopts d:b:c:s: opt; do
+	case $opt in
+	d) DIR=$OPTARG ;;
+	b) BLOCKDEV=$OPTARG ;;
+	c) CGROUP=$OPTARG ;;
+	s) SECONDS_PER_RUN=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+[ -n "$DIR" ] && [ -d "$DIR" ] || usage
+command -v fio >/dev/null || { echo "fio not found" >&2; exit 1; }
+
+if [ -n "$BLOCKDEV" ]; then
+	echo bfq > /sys/block/$BLOCKDEV/queue/scheduler || exit 1
+	echo 1 > /sys/block/$BLOCKDEV/queue/iosched/low_latency || exit 1
+fi
+
+if [ ! -f $CGROUP/bfqio.foreground ]; then
+	mkdir -p $CGROUP
+	mount -t cgroup -o bfqio none $CGROUP || exit 1
+fi
+mkdir -p $CGROUP/fg $CGROUP/bg
+
+# lay out the file the reader reads from
+fio --name=layout --filename=$DIR/fg_latency.read --size=$READ_SIZE \
+    --rw=write --bs=1m --minimal >/dev/null || exit 1
+
+# run_in_cgroup <cgroup> <fio arguments...>: fio's terse output on stdout
+run_in_cgroup() {
+	group=$1
+	shift
+	sh -c "echo \$\$ > $CGROUP/$group/tasks && exec fio --minimal \"\$@\"" \
+	    fio "$@"
+}
+
+# percentile <terse line> <pct>: read completion latency percentile, usec
+percentile() {
+	echo "$1" | awk -F';' -v pct="$2" '{
+		for (i = 18; i <= 37; i++) {
+			split($i, kv, "%=");
+			if (kv[1] + 0 == pct + 0) {
+				print kv[2];
+				exit;
+			}
+		}
+	}'
+}
+
+echo "foreground   read_iops  mean(us)   p50(us)   p99(us)  write_KB/s"
+for fg in 1 0; do
+	echo $fg > $CGROUP/fg/bfqio.foreground
+	sync
+	echo 3 > /proc/sys/vm/drop_caches
+
+	run_in_cgroup bg --name=bgsync --filename=$DIR/fg_latency.write \
+	    --size=$WRITE_SIZE --rw=write --bs=128k --fdatasync=64 \
+	    --time_based --runtime=$((SECONDS_PER_RUN + 5)) \
+	    > $DIR/fg_latency.bg &
+	bg_pid=$!
+	sleep 2
+
+	fg_out=$(run_in_cgroup fg --name=launch --filename=$DIR/fg_latency.read \
+	    --size=$READ_SIZE --rw=randread --bs=4k --direct=1 \
+	    --time_based --runtime=$SECONDS_PER_RUN)
+	wait $bg_pid
+	bg_out=$(cat $DIR/fg_latency.bg)
+
+	iops=$(echo "$fg_out" | cut -d';' -f8)
+	mean=$(echo "$fg_out" | cut -d';' -f16)
+	p50=$(percentile "$fg_out" 50)
+	p99=$(percentile "$fg_out" 99)
+	wbw=$(echo "$bg_out" | cut -d';' -f48)
+	printf "%10d %11s %9.0f %9s %9s %11s\n" $fg "$iops" "$mean" \
+	    "$p50" "$p99" "$wbw"
+done
+
+echo 0 > $CGROUP/fg/bfqio.foreground
+rm -f $DIR/fg_latency.read $DIR/fg_latency.write $DIR/fg_latency.bg
@@ -0,0 +1,595 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -g -I../../drivers/staging/android -o binder_stress binder_stress.c -lpthread */
+
+/*
+ * binder transaction throughput and latency under concurrency
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+/*
+ * Runs 1..N clients, each doing back to back synchronous transactions
+ * against a server that echoes the payload, and reports the aggregate
+ * call rate and the median and 99th percentile round trip time for
+ * every N. Every client and every server opens /dev/binder itself, so
+ * each one is a binder_proc of its own and independent pairs only
+ * share what the driver shares between processes.
+ *
+ * By default each client gets a private single threaded server. With
+ * -S all clients talk to one server process running N looper threads,
+ * which exercises the per-process locking instead.
+ *
+ * Handles are passed around through a tiny service registry, so the
+ * program has to become the context manager: stop servicemanager (or
+ * use a test kernel) and run it as the user that owned the context
+ * manager before, if any.
+ *
+ * Typical usage:
+ *	binder_stress -t 8 -s 2
+ *	binder_stress -t 8 -s 2 -S -b 256
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "binder.h"
+
+#define MAP_SIZE	(128 * 1024)
+#define MAX_PAYLOAD	4096
+#define MAX_SLOTS	256
+#define HIST_US		20000	/* 1us latency buckets, plus one overflow */
+#define PARSE_ERROR	(~0U)
+
+enum {
+	CODE_PUBLISH = 1,
+	CODE_LOOKUP,
+	CODE_PING,
+	CODE_QUIT,
+};
+
+struct endpoint {
+	int fd;
+	void *map;
+};
+
+struct cmdbuf {
+	uint8_t data[512];
+	size_t len;
+};
+
+struct publish_msg {
+	uint32_t slot;
+	struct flat_binder_object obj;
+};
+
+struct server {
+	struct endpoint ep;
+	pthread_t thread[64];
+	int nr_threads;
+};
+
+struct client {
+	pthread_t thread;
+	struct endpoint ep;
+	uint32_t handle;
+	unsigned long calls;
+	unsigned int *hist;
+	int failed;
+};
+
+static int duration = 1;
+static size_t payload = 16;
+static volatile int stop;
+static pthread_barrier_t start_barrier;
+
+static void put32(struct cmdbuf *cb, uint32_t v)
+{
+	memcpy(cb->data + cb->len, &v, sizeof(v));
+	cb->len += sizeof(v);
+}
+
+static void putmem(struct cmdbuf *cb, const void *p, size_t n)
+{
+	memcpy(cb->data + cb->len, p, n);
+	cb->len += n;
+}
+
+static void putptr(struct cmdbuf *cb, const void *p)
+{
+	putmem(cb, &p, sizeof(p));
+}
+
+static void put_txn(struct cmdbuf *cb, uint32_t bc, uint32_t handle,
+		    uint32_t code, uint32_t flags, const void *data,
+		    size_t size, const size_t *offs, size_t offs_size)
+{
+	struct binder_transaction_data tr;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.flags = flags;
+	tr.data_size = size;
+	tr.offsets_size = offs_size;
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offs;
+	put32(cb, bc);
+	putmem(cb, &tr, sizeof(tr));
+}
+
+/* Writes out cb, then reads into rbuf unless rsize is 0 */
+static int binder_io(int fd, struct cmdbuf *cb, void *rbuf, size_t rsize,
+		     size_t *rlen)
+{
+	struct binder_write_read bwr;
+	int ret;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_buffer = (unsigned long)cb->data;
+	bwr.write_size = cb->len;
+	bwr.read_buffer = (unsigned long)rbuf;
+	bwr.read_size = rsize;
+	do {
+		ret = ioctl(fd, BINDER_WRITE_READ, &bwr);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		perror("BINDER_WRITE_READ");
+		return -1;
+	}
+	cb->len = 0;
+	if (rlen)
+		*rlen = bwr.read_consumed;
+	return 0;
+}
+
+/*
+ * Walks the returns in rbuf, queueing the acknowledgements the driver
+ * expects in cb. Returns BR_TRANSACTION or BR_REPLY with *tr filled in,
+ * an error return, 0 if there was nothing of interest or PARSE_ERROR.
+ */
+static unsigned int parse(const void *rbuf, size_t len, struct cmdbuf *cb,
+		 struct binder_transaction_data *tr)
+{
+	const uint8_t *p = rbuf, *end = p + len;
+	unsigned int ret = 0;
+
+	while (p < end) {
+		uint32_t cmd;
+		void *ptrs[2];
+
+		memcpy(&cmd, p, sizeof(cmd));
+		p += sizeof(cmd);
+		switch (cmd) {
+		case BR_NOOP:
+		case BR_OK:
+		case BR_TRANSACTION_COMPLETE:
+		case BR_SPAWN_LOOPER:
+			break;
+		case BR_INCREFS:
+		case BR_ACQUIRE:
+			memcpy(ptrs, p, sizeof(ptrs));
+			p += sizeof(ptrs);
+			put32(cb, cmd == BR_INCREFS ?
+			      BC_INCREFS_DONE : BC_ACQUIRE_DONE);
+			putmem(cb, ptrs, sizeof(ptrs));
+			break;
+		case BR_RELEASE:
+		case BR_DECREFS:
+			p += sizeof(ptrs);
+			break;
+		case BR_DEAD_BINDER:
+		case BR_CLEAR_DEATH_NOTIFICATION_DONE:
+			p += sizeof(void *);
+			break;
+		case BR_TRANSACTION:
+		case BR_REPLY:
+			memcpy(tr, p, sizeof(*tr));
+			p += sizeof(*tr);
+			ret = cmd;
+			break;
+		case BR_DEAD_REPLY:
+		case BR_FAILED_REPLY:
+		case BR_ERROR:
+			return cmd;
+		default:
+			fprintf(stderr, "unexpected binder return %#x\n", cmd);
+			return PARSE_ERROR;
+		}
+	}
+	return ret;
+}
+
+/* Sends a sync transaction; the caller frees the reply buffer */
+static int call(struct endpoint *ep, uint32_t handle, uint32_t code,
+		const void *data, size_t size, const size_t *offs,
+		size_t offs_size, struct binder_transaction_data *reply)
+{
+	struct cmdbuf cb = { .len = 0 };
+	uint32_t rbuf[128];
+	size_t len;
+	unsigned int ret;
+
+	put_txn(&cb, BC_TRANSACTION, handle, code, 0, data, size,
+		offs, offs_size);
+	for (;;) {
+		if (binder_io(ep->fd, &cb, rbuf, sizeof(rbuf), &len))
+			return -1;
+		ret = parse(rbuf, len, &cb, reply);
+		if (ret == BR_REPLY)
+			return cb.len ? binder_io(ep->fd, &cb, NULL, 0, NULL) : 0;
+		if (ret != 0) {
+			fprintf(stderr, "transaction %u to %u failed: %#x\n",
+				code, handle, ret);
+			return -1;
+		}
+	}
+}
+
+static int free_buffer(struct endpoint *ep, const void *buffer)
+{
+	struct cmdbuf cb = { .len = 0 };
+
+	put32(&cb, BC_FREE_BUFFER);
+	putptr(&cb, buffer);
+	return binder_io(ep->fd, &cb, NULL, 0, NULL);
+}
+
+static int ep_open(struct endpoint *ep)
+{
+	ep->fd = open("/dev/binder", O_RDWR);
+	if (ep->fd < 0) {
+		perror("/dev/binder");
+		return -1;
+	}
+	ep->map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, ep->fd, 0);
+	if (ep->map == MAP_FAILED) {
+		perror("mmap");
+		close(ep->fd);
+		return -1;
+	}
+	return 0;
+}
+
+static void ep_close(struct endpoint *ep)
+{
+	munmap(ep->map, MAP_SIZE);
+	close(ep->fd);
+}
+
+/* The context manager: publish stores a handle in a slot, lookup returns it */
+static void *registry_fn(void *arg)
+{
+	struct endpoint *ep = arg;
+	struct cmdbuf cb = { .len = 0 };
+	struct binder_transaction_data tr;
+	struct flat_binder_object reply_obj;
+	static const size_t reply_off;
+	uint32_t slots[MAX_SLOTS] = { 0 };
+	uint32_t rbuf[128];
+	size_t len;
+	unsigned int ret;
+
+	put32(&cb, BC_ENTER_LOOPER);
+	for (;;) {
+		const uint8_t *data;
+		uint32_t slot;
+
+		if (binder_io(ep->fd, &cb, rbuf, sizeof(rbuf), &len))
+			break;
+		ret = parse(rbuf, len, &cb, &tr);
+		if (ret == PARSE_ERROR)
+			break;
+		if (ret != BR_TRANSACTION)
+			continue;
+
+		data = tr.data.ptr.buffer;
+		slot = MAX_SLOTS;
+		if (tr.data_size >= sizeof(slot))
+			memcpy(&slot, data, sizeof(slot));
+		if (tr.code == CODE_PUBLISH && slot < MAX_SLOTS &&
+		    tr.data_size >= sizeof(struct publish_msg)) {
+			struct flat_binder_object obj;
+
+			memcpy(&obj, data + offsetof(struct publish_msg, obj),
+			       sizeof(obj));
+			if (slots[slot]) {
+				put32(&cb, BC_RELEASE);
+				put32(&cb, slots[slot]);
+			}
+			slots[slot] = obj.handle;
+			/* keep it past BC_FREE_BUFFER */
+			put32(&cb, BC_ACQUIRE);
+			put32(&cb, obj.handle);
+		}
+		put32(&cb, BC_FREE_BUFFER);
+		putptr(&cb, tr.data.ptr.buffer);
+		if (tr.code == CODE_LOOKUP && slot < MAX_SLOTS && slots[slot]) {
+			memset(&reply_obj, 0, sizeof(reply_obj));
+			reply_obj.type = BINDER_TYPE_HANDLE;
+			reply_obj.handle = slots[slot];
+			put_txn(&cb, BC_REPLY, 0, 0, 0, &reply_obj,
+				sizeof(reply_obj), &reply_off,
+				sizeof(reply_off));
+		} else
+			put_txn(&cb, BC_REPLY, 0, 0, 0, NULL, 0, NULL, 0);
+	}
+	return NULL;
+}
+
+static void *server_fn(void *arg)
+{
+	struct endpoint *ep = arg;
+	struct cmdbuf cb = { .len = 0 };
+	struct binder_transaction_data tr;
+	static __thread uint8_t reply[MAX_PAYLOAD];
+	uint32_t rbuf[128];
+	size_t len;
+	unsigned int ret;
+
+	put32(&cb, BC_ENTER_LOOPER);
+	for (;;) {
+		if (binder_io(ep->fd, &cb, rbuf, sizeof(rbuf), &len))
+			break;
+		ret = parse(rbuf, len, &cb, &tr);
+		if (ret == PARSE_ERROR)
+			break;
+		if (ret != BR_TRANSACTION)
+			continue;
+
+		len = tr.data_size < MAX_PAYLOAD ? tr.data_size : MAX_PAYLOAD;
+		memcpy(reply, tr.data.ptr.buffer, len);
+		put32(&cb, BC_FREE_BUFFER);
+		putptr(&cb, tr.data.ptr.buffer);
+		if (tr.code == CODE_QUIT) {
+			binder_io(ep->fd, &cb, NULL, 0, NULL);
+			break;
+		}
+		if (!(tr.flags & TF_ONE_WAY))
+			put_txn(&cb, BC_REPLY, 0, 0, 0, reply, len, NULL, 0);
+	}
+	return NULL;
+}
+
+static int server_start(struct server *srv, uint32_t slot, int nr_threads)
+{
+	struct publish_msg msg;
+	static const size_t off = offsetof(struct publish_msg, obj);
+	struct binder_transaction_data reply;
+	int i;
+
+	if (ep_open(&srv->ep))
+		return -1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.slot = slot;
+	msg.obj.type = BINDER_TYPE_BINDER;
+	msg.obj.binder = srv;
+	msg.obj.cookie = srv;
+	if (call(&srv->ep, 0, CODE_PUBLISH, &msg, sizeof(msg), &off,
+		 sizeof(off), &reply) ||
+	    free_buffer(&srv->ep, reply.data.ptr.buffer))
+		return -1;
+
+	srv->nr_threads = nr_threads;
+	for (i = 0; i < nr_threads; i++)
+		pthread_create(&srv->thread[i], NULL, server_fn, &srv->ep);
+	return 0;
+}
+
+static void server_stop(struct server *srv)
+{
+	int i;
+
+	for (i = 0; i < srv->nr_threads; i++)
+		pthread_join(srv->thread[i], NULL);
+	ep_close(&srv->ep);
+}
+
+static int client_connect(struct client *c, uint32_t slot)
+{
+	struct binder_transaction_data reply;
+	struct flat_binder_object obj;
+	struct cmdbuf cb = { .len = 0 };
+
+	if (ep_open(&c->ep))
+		return -1;
+	if (call(&c->ep, 0, CODE_LOOKUP, &slot, sizeof(slot), NULL, 0, &reply))
+		return -1;
+	if (reply.data_size < sizeof(obj)) {
+		fprintf(stderr, "slot %u not published\n", slot);
+		free_buffer(&c->ep, reply.data.ptr.buffer);
+		return -1;
+	}
+	memcpy(&obj, reply.data.ptr.buffer, sizeof(obj));
+	c->handle = obj.handle;
+	put32(&cb, BC_ACQUIRE);
+	put32(&cb, c->handle);
+	put32(&cb, BC_FREE_BUFFER);
+	putptr(&cb, reply.data.ptr.buffer);
+	return binder_io(c->ep.fd, &cb, NULL, 0, NULL);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *client_fn(void *arg)
+{
+	struct client *c = arg;
+	struct binder_transaction_data reply;
+	struct cmdbuf cb = { .len = 0 };
+	uint8_t data[MAX_PAYLOAD];
+	double t0, us;
+
+	memset(data, 0x5a, payload);
+	pthread_barrier_wait(&start_barrier);
+
+	while (!stop) {
+		t0 = now();
+		if (call(&c->ep, c->handle, CODE_PING, data, payload, NULL, 0,
+			 &reply)) {
+			c->failed = 1;
+			break;
+		}
+		us = (now() - t0) * 1e6;
+		c->hist[us < HIST_US ? (unsigned int)us : HIST_US]++;
+		c->calls++;
+		if (free_buffer(&c->ep, reply.data.ptr.buffer)) {
+			c->failed = 1;
+			break;
+		}
+	}
+
+	/* one oneway QUIT per client takes down one server thread */
+	put_txn(&cb, BC_TRANSACTION, c->handle, CODE_QUIT, TF_ONE_WAY,
+		NULL, 0, NULL, 0);
+	binder_io(c->ep.fd, &cb, NULL, 0, NULL);
+	return NULL;
+}
+
+static unsigned int percentile(const unsigned int *hist, unsigned long total,
+			       double pct)
+{
+	unsigned long sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_US; i++) {
+		sum += hist[i];
+		if (sum >= total * pct)
+			break;
+	}
+	return i;
+}
+
+static int run(int nr_clients, int shared)
+{
+	struct server *srv;
+	struct client *c;
+	unsigned int *hist;
+	unsigned long calls = 0;
+	int nr_servers = shared ? 1 : nr_clients;
+	int i, j, ret = 0;
+	double t0, t1;
+
+	srv = calloc(nr_servers, sizeof(*srv));
+	c = calloc(nr_clients, sizeof(*c));
+	hist = calloc(HIST_US + 1, sizeof(*hist));
+	if (!srv || !c || !hist)
+		return -1;
+
+	for (i = 0; i < nr_servers; i++)
+		if (server_start(&srv[i], i, shared ? nr_clients : 1))
+			return -1;
+	for (i = 0; i < nr_clients; i++) {
+		c[i].hist = calloc(HIST_US + 1, sizeof(*c[i].hist));
+		if (!c[i].hist || client_connect(&c[i], shared ? 0 : i))
+			return -1;
+	}
+
+	stop = 0;
+	pthread_barrier_init(&start_barrier, NULL, nr_clients + 1);
+	for (i = 0; i < nr_clients; i++)
+		pthread_create(&c[i].thread, NULL, client_fn, &c[i]);
+	pthread_barrier_wait(&start_barrier);
+	t0 = now();
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < nr_clients; i++) {
+		pthread_join(c[i].thread, NULL);
+		calls += c[i].calls;
+		for (j = 0; j <= HIST_US; j++)
+			hist[j] += c[i].hist[j];
+		if (c[i].failed)
+			ret = -1;
+	}
+	t1 = now();
+
+	for (i = 0; i < nr_servers; i++)
+		server_stop(&srv[i]);
+	for (i = 0; i < nr_clients; i++) {
+		ep_close(&c[i].ep);
+		free(c[i].hist);
+	}
+
+	printf("%7d %12.0f %9u %9u\n", nr_clients, calls / (t1 - t0),
+	       percentile(hist, calls, 0.50), percentile(hist, calls, 0.99));
+
+	pthread_barrier_destroy(&start_barrier);
+	free(hist);
+	free(c);
+	free(srv);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t max_clients] [-s seconds] [-b payload_bytes]"
+		" [-S]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int max_clients = sysconf(_SC_NPROCESSORS_ONLN);
+	struct endpoint registry;
+	pthread_t registry_thread;
+	int shared = 0;
+	int opt, n;
+
+	while ((opt = getopt(argc, argv, "t:s:b:S")) != -1) {
+		switch (opt) {
+		case 't':
+			max_clients = atoi(optarg);
+			break;
+		case 's':
+			duration = atoi(optarg);
+			break;
+		case 'b':
+			payload = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			shared = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (max_clients < 1 || max_clients > 64 || duration < 1 ||
+	    payload > MAX_PAYLOAD)
+		usage(argv[0]);
+
+	if (ep_open(&registry))
+		return 1;
+	if (ioctl(registry.fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		fprintf(stderr, "cannot become the context manager: %s\n"
+			"(is servicemanager running?)\n", strerror(errno));
+		return 1;
+	}
+	pthread_create(&registry_thread, NULL, registry_fn, &registry);
+
+	printf("clients      calls/s   p50(us)   p99(us)\n");
+	for (n = 1; n <= max_clients; n++)
+		if (run(n, shared))
+			return 1;
+
+	return 0;
+}
@@ -0,0 +1,712 @@
+/*
+ * Tegra3 hotplug / cpuquiet policy trace replay
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+/*
+ * Links the decision logic of arch/arm/mach-tegra/cpu-tegra3.c
+ * (cpu-tegra3-policy.c) and of the cpuquiet balanced governor
+ * (balanced_policy.c) into a host program, and drives it with a recorded
+ * load trace the way the kernel would: 10ms ticks, the cpufreq driven
+ * IDLE/UP/DOWN state machines and the delayed hotplug work. Cores come
+ * and go instantly, and the LP cluster is not modelled, so cpu0 stays
+ * online throughout.
+ *
+ * The trace has one sample per line, '#' starting a comment:
+ *
+ *	time_ms  nr_run  load0 load1 load2 load3
+ *
+ * nr_run is the runnable thread average (avg_nr_running() / FIXED_1)
+ * and loadN the busy percentage of cpuN over the last sample period.
+ * Each sample holds until the next one. The replay is open loop: load
+ * recorded on a cpu that is offline in the simulation is folded onto the
+ * online ones, and a cpu's frequency target is taken as proportional to
+ * its load.
+ *
+ * Reported are the core-seconds spent online, the number of transitions,
+ * and the latency to online: how long it took from more threads wanting
+ * to run than there were cores online until enough cores were.
+ *
+ * Typical usage:
+ *	make && ./hotplug_sim -p tegra3 trace.txt
+ *	./hotplug_sim -p balanced -r -b 50 trace.txt	(runnable threads)
+ *	./hotplug_sim -p mp -N 13,30,15,11,17,11,0,11 -v trace.txt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include "cpu-tegra3-policy.h"
+#include "balanced_policy.h"
+
+#define NR_CPUS		4
+#define TICK_MS		10		/* HZ=100 */
+
+struct sample {
+	unsigned long t;		/* ms */
+	double nr_run;
+	unsigned int load[NR_CPUS];	/* percent */
+};
+
+enum {
+	POLICY_TEGRA3,
+	POLICY_MP,
+	POLICY_BALANCED,
+};
+
+static struct sample *trace;
+static size_t nr_samples;
+
+/* tunables, named after their kernel counterparts */
+static int policy = POLICY_TEGRA3;
+static bool nr_run_mode;
+static bool verbose;
+static int balance_level = 60;
+static int mp_overhead = 10;
+static unsigned long max_freq = 1300000;	/* kHz */
+static unsigned long idle_top_freq = 475000;
+static unsigned long idle_bottom_freq = 475000;
+static long up_delay = -1;			/* ms, -1: policy default */
+static long down_delay = -1;
+static unsigned long sample_ms = 20;		/* governor sampling */
+static unsigned long up_time = 100, down_time = 200;	/* mp_policy */
+static unsigned int NwNs[8] = {13, 30, 15, 11, 17, 11, 0, 11};
+static unsigned int TwTs[8] = {140, 0, 140, 190, 140, 190, 0, 190};
+
+/* simulated machine */
+static unsigned long now;			/* ms */
+static bool online[NR_CPUS];
+static unsigned int nr_online;
+static unsigned int cpu_load[NR_CPUS];
+static unsigned long cpu_speed[NR_CPUS];
+static unsigned long avg_nr_run;
+static unsigned long last_change_time;
+static unsigned int nr_run_last;
+
+/* delayed hotplug work, -1 when not queued */
+static long work_at = -1;
+
+/* results */
+static unsigned long online_ms[NR_CPUS + 1];
+static unsigned int nr_up, nr_down;
+static long wait_start = -1;
+static unsigned int wait_online;
+static unsigned int nr_served, nr_unserved;
+static unsigned long lat_sum, lat_max;
+static unsigned long starved_ms;
+
+static void queue_work(unsigned long delay)
+{
+	if (work_at < 0)
+		work_at = now + delay;
+}
+
+static unsigned int count_slow_cpus(unsigned long speed_limit)
+{
+	unsigned int cnt = 0;
+	int i;
+
+	for (i = 0; i < NR_CPUS; i++)
+		if (online[i] && cpu_speed[i] <= speed_limit)
+			cnt++;
+	return cnt;
+}
+
+static unsigned int count_slow_loads(unsigned int limit)
+{
+	unsigned int cnt = 0;
+	int i;
+
+	for (i = 0; i < NR_CPUS; i++)
+		if (online[i] && cpu_load[i] <= limit)
+			cnt++;
+	return cnt;
+}
+
+/* no EDP limit: more cores never cost frequency */
+static bool edp_favor_up(unsigned int n __attribute__((unused)),
+			 int mp_overhead __attribute__((unused)))
+{
+	return true;
+}
+
+static bool edp_favor_down(unsigned int n __attribute__((unused)),
+			   int mp_overhead __attribute__((unused)))
+{
+	return false;
+}
+
+static unsigned long highest_speed(void)
+{
+	unsigned long rate = 0;
+	int i;
+
+	for (i = 0; i < NR_CPUS; i++)
+		if (online[i] && cpu_speed[i] > rate)
+			rate = cpu_speed[i];
+	return rate;
+}
+
+static unsigned int highest_load(void)
+{
+	unsigned int load = 0;
+	int i;
+
+	for (i = 0; i < NR_CPUS; i++)
+		if (online[i] && cpu_load[i] > load)
+			load = cpu_load[i];
+	return load;
+}
+
+static int slowest_cpu_n(void)
+{
+	unsigned long rate = ULONG_MAX;
+	int i, cpu = -1;
+
+	for (i = 1; i < NR_CPUS; i++)
+		if (online[i] && cpu_speed[i] < rate) {
+			cpu = i;
+			rate = cpu_speed[i];
+		}
+	return cpu;
+}
+
+static int next_offline_cpu(void)
+{
+	int i;
+
+	for (i = 1; i < NR_CPUS; i++)
+		if (!online[i])
+			return i;
+	return -1;
+}
+
+static void set_online(int cpu, bool up)
+{
+	if (cpu < 0)
+		return;
+
+	online[cpu] = up;
+	if (up) {
+		nr_online++;
+		nr_up++;
+	} else {
+		nr_online--;
+		nr_down++;
+	}
+	last_change_time = now;
+
+	if (verbose)
+		printf("%8lu ms  cpu%d %-4s online %u\n", now, cpu,
+		       up ? "up" : "down", nr_online);
+}
+
+/* Spread the recorded load over the cores online in the simulation */
+static void apply_sample(const struct sample *s)
+{
+	int map[NR_CPUS];
+	int i, j, n = 0;
+
+	for (i = 0; i < NR_CPUS; i++) {
+		cpu_load[i] = 0;
+		if (online[i])
+			map[n++] = i;
+	}
+	for (j = 0; j < NR_CPUS; j++) {
+		i = map[j % n];
+		cpu_load[i] += s->load[j];
+		if (cpu_load[i] > 100)
+			cpu_load[i] = 100;
+	}
+	for (i = 0; i < NR_CPUS; i++)
+		cpu_speed[i] = online[i] ? max_freq * cpu_load[i] / 100 : 0;
+
+	avg_nr_run = s->nr_run * FIXED_1;
+}
+
+static int tegra3_balance(void)
+{
+	struct tegra3_balance_params params = {
+		.balance_level = balance_level,
+		.mp_overhead = mp_overhead,
+		.idle_bottom_freq = idle_bottom_freq,
+		.nr_run = nr_run_mode,
+		.count_slow_cpus = count_slow_cpus,
+		.edp_favor_up = edp_favor_up,
+		.edp_favor_down = edp_favor_down,
+	};
+	struct tegra3_balance_sample sample = {
+		.highest_speed = highest_speed(),
+		.avg_nr_run = avg_nr_run,
+		.nr_cpus = nr_online,
+		.min_cpus = 0,
+		.max_cpus = NR_CPUS,
+	};
+
+	return tegra3_cpu_speed_balance(&params, &sample, &nr_run_last);
+}
+
+/*
+ * tegra_auto_hotplug_governor() and tegra_auto_hotplug_work_func(), for
+ * the G cluster
+ */
+static int hp_state = TEGRA_HP_IDLE;
+
+static void tegra3_governor(unsigned long cpu_freq)
+{
+	unsigned long top_freq = idle_bottom_freq;
+	unsigned long bottom_freq = idle_bottom_freq;
+	unsigned long down = nr_run_mode ? up_delay : down_delay;
+
+	switch (hp_state) {
+	case TEGRA_HP_IDLE:
+		if (cpu_freq > top_freq) {
+			hp_state = TEGRA_HP_UP;
+			queue_work(up_delay);
+		} else if (cpu_freq <= bottom_freq) {
+			hp_state = TEGRA_HP_DOWN;
+			queue_work(down);
+		}
+		break;
+	case TEGRA_HP_DOWN:
+		if (cpu_freq > top_freq) {
+			hp_state = TEGRA_HP_UP;
+			queue_work(up_delay);
+		} else if (cpu_freq > bottom_freq) {
+			hp_state = TEGRA_HP_IDLE;
+		}
+		break;
+	case TEGRA_HP_UP:
+		if (cpu_freq <= bottom_freq) {
+			hp_state = TEGRA_HP_DOWN;
+			queue_work(down);
+		} else if (cpu_freq <= top_freq) {
+			hp_state = TEGRA_HP_IDLE;
+		}
+		break;
+	}
+}
+
+static void tegra3_work(void)
+{
+	int cpu = -1;
+	bool up = false;
+
+	switch (hp_state) {
+	case TEGRA_HP_DOWN:
+		cpu = slowest_cpu_n();
+		/* only cpu0 left: the kernel moves to the LP cluster and stops */
+		if (cpu >= 0)
+			queue_work(nr_run_mode ? up_delay : down_delay);
+		break;
+	case TEGRA_HP_UP:
+		switch (tegra3_balance()) {
+		case TEGRA_CPU_SPEED_BALANCED:
+			cpu = next_offline_cpu();
+			up = true;
+			break;
+		case TEGRA_CPU_SPEED_SKEWED:
+			cpu = slowest_cpu_n();
+			break;
+		}
+		queue_work(up_delay);
+		break;
+	}
+
+	if (!up && now - last_change_time < (unsigned long)down_delay)
+		cpu = -1;
+
+	set_online(cpu, up);
+}
+
+/* gcpu_plug(), the mp_policy path */
+static void mp_governor(unsigned long cpu_freq)
+{
+	static struct tegra3_mp_state mp_state;
+	static unsigned long total_time, last_time;
+	static bool started;
+	int mp;
+
+	if (started)
+		total_time += now - last_time;
+	started = true;
+
+	mp = tegra3_mp_decision(&mp_state, NwNs, TwTs, now,
+				avg_nr_run * 10 / FIXED_1, nr_online);
+
+	switch (hp_state) {
+	case TEGRA_HP_IDLE:
+		if (cpu_freq > idle_bottom_freq)
+			hp_state = TEGRA_HP_UP;
+		else
+			hp_state = TEGRA_HP_DOWN;
+		total_time = 0;
+		break;
+	case TEGRA_HP_DOWN:
+		if (cpu_freq > idle_bottom_freq) {
+			hp_state = TEGRA_HP_UP;
+			total_time = 0;
+		}
+		break;
+	case TEGRA_HP_UP:
+		if (cpu_freq <= idle_bottom_freq) {
+			hp_state = TEGRA_HP_DOWN;
+			total_time = 0;
+		}
+		break;
+	}
+
+	if (hp_state == TEGRA_HP_UP) {
+		switch (tegra3_balance()) {
+		case TEGRA_CPU_SPEED_BALANCED:
+			if (total_time >= up_time && mp == TEGRA_HP_UP) {
+				set_online(next_offline_cpu(), true);
+				total_time = 0;
+			}
+			break;
+		case TEGRA_CPU_SPEED_SKEWED:
+			if (total_time >= down_time && mp == TEGRA_HP_DOWN) {
+				set_online(slowest_cpu_n(), false);
+				total_time = 0;
+			}
+			break;
+		case TEGRA_CPU_SPEED_BIASED:
+			if (total_time >= up_time)
+				total_time = 0;
+			break;
+		}
+	} else if (hp_state == TEGRA_HP_DOWN) {
+		if (total_time >= down_time && mp == TEGRA_HP_DOWN) {
+			set_online(slowest_cpu_n(), false);
+			total_time = 0;
+		}
+	}
+
+	last_time = now;
+}
+
+/* balanced_cpufreq_transition() and balanced_work_func() */
+static BALANCED_STATE balanced_state = IDLE;
+
+static void balanced_governor(unsigned long cpu_freq)
+{
+	static unsigned long last_freq;
+	unsigned long down = nr_run_mode ? up_delay : down_delay;
+
+	if (cpu_freq == last_freq)
+		return;
+	last_freq = cpu_freq;
+
+	switch (balanced_state) {
+	case IDLE:
+		if (cpu_freq >= idle_top_freq) {
+			balanced_state = UP;
+			queue_work(up_delay);
+		} else if (cpu_freq <= idle_bottom_freq) {
+			balanced_state = DOWN;
+			queue_work(down_delay);
+		}
+		break;
+	case DOWN:
+		if (cpu_freq >= idle_top_freq) {
+			balanced_state = UP;
+			queue_work(up_delay);
+		}
+		break;
+	case UP:
+		if (cpu_freq <= idle_bottom_freq) {
+			balanced_state = DOWN;
+			queue_work(down);
+		}
+		break;
+	}
+}
+
+static void balanced_work(void)
+{
+	struct balanced_params params = {
+		.balance_level = balance_level,
+		.down_delay = down_delay,
+		.nr_run = nr_run_mode,
+		.count_slow_cpus = count_slow_loads,
+	};
+	struct balanced_sample sample = {
+		.highest_load = highest_load(),
+		.avg_nr_run = avg_nr_run,
+		.nr_cpus = nr_online,
+		.max_cpus = NR_CPUS,
+		.now = now,
+		.last_change_time = last_change_time,
+	};
+	int change;
+
+	switch (balanced_state) {
+	case IDLE:
+		break;
+	case DOWN:
+		if (slowest_cpu_n() >= 0)
+			queue_work(nr_run_mode ? up_delay : down_delay);
+		break;
+	case UP:
+		queue_work(up_delay);
+		break;
+	}
+
+	change = balanced_decision(&params, balanced_state, &sample,
+				   &nr_run_last);
+	if (change > 0)
+		set_online(next_offline_cpu(), true);
+	else if (change < 0)
+		set_online(slowest_cpu_n(), false);
+}
+
+static void account(const struct sample *s)
+{
+	unsigned int wanted = s->nr_run + 0.5;
+
+	if (wanted < 1)
+		wanted = 1;
+	if (wanted > NR_CPUS)
+		wanted = NR_CPUS;
+
+	online_ms[nr_online] += TICK_MS;
+
+	if (wanted > nr_online) {
+		if (wait_start < 0) {
+			wait_start = now;
+			wait_online = nr_online;
+		}
+		starved_ms += (wanted - nr_online) * TICK_MS;
+	} else if (wait_start >= 0) {
+		if (nr_online > wait_online) {
+			unsigned long lat = now - wait_start;
+
+			nr_served++;
+			lat_sum += lat;
+			if (lat > lat_max)
+				lat_max = lat;
+		} else {
+			nr_unserved++;
+		}
+		wait_start = -1;
+	}
+}
+
+static void replay(void)
+{
+	unsigned long next_sample_t = 0;
+	size_t i = 0;
+
+	online[0] = true;
+	nr_online = 1;
+	nr_run_last = 1;
+	last_change_time = trace[0].t;
+
+	for (now = trace[0].t; now <= trace[nr_samples - 1].t;
+	     now += TICK_MS) {
+		while (i + 1 < nr_samples && trace[i + 1].t <= now)
+			i++;
+		apply_sample(&trace[i]);
+
+		if (work_at >= 0 && now >= (unsigned long)work_at) {
+			work_at = -1;
+			if (policy == POLICY_BALANCED)
+				balanced_work();
+			else
+				tegra3_work();
+			apply_sample(&trace[i]);
+		}
+
+		if (now >= next_sample_t) {
+			next_sample_t = now + sample_ms;
+			switch (policy) {
+			case POLICY_TEGRA3:
+				tegra3_governor(highest_speed());
+				break;
+			case POLICY_MP:
+				mp_governor(highest_speed());
+				break;
+			case POLICY_BALANCED:
+				balanced_governor(highest_speed());
+				break;
+			}
+			apply_sample(&trace[i]);
+		}
+
+		account(&trace[i]);
+	}
+}
+
+static void report(void)
+{
+	static const char * const names[] = { "tegra3", "mp", "balanced" };
+	unsigned long total = 0, core_ms = 0;
+	unsigned int n;
+
+	for (n = 1; n <= NR_CPUS; n++) {
+		total += online_ms[n];
+		core_ms += n * online_ms[n];
+	}
+	if (!total)
+		return;
+
+	printf("policy          %s%s\n", names[policy],
+	       nr_run_mode ? " (runnable threads)" : "");
+	printf("trace           %.3f s, %zu samples\n", total / 1e3,
+	       nr_samples);
+	printf("core-seconds    %.3f (%.2f cores on average)\n",
+	       core_ms / 1e3, (double)core_ms / total);
+	printf("residency      ");
+	for (n = 1; n <= NR_CPUS; n++)
+		printf(" %u:%5.1f%%", n, 100.0 * online_ms[n] / total);
+	printf("\n");
+	printf("transitions     %u up, %u down\n", nr_up, nr_down);
+	printf("online latency  %u served, avg %.1f ms, max %lu ms, "
+	       "%u unserved\n", nr_served,
+	       nr_served ? (double)lat_sum / nr_served : 0.0, lat_max,
+	       nr_unserved);
+	printf("starved         %.3f core-seconds\n", starved_ms / 1e3);
+}
+
+static int load_trace(FILE *f)
+{
+	char line[256];
+	size_t size = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		struct sample s;
+		char *p = strchr(line, '#');
+		int n;
+
+		if (p)
+			*p = '\0';
+		memset(&s, 0, sizeof(s));
+		n = sscanf(line, "%lu %lf %u %u %u %u", &s.t, &s.nr_run,
+			   &s.load[0], &s.load[1], &s.load[2], &s.load[3]);
+		if (n <= 0)
+			continue;
+		if (n < 2 || (nr_samples && s.t < trace[nr_samples - 1].t)) {
+			fprintf(stderr, "bad trace line: %s", line);
+			return -1;
+		}
+
+		if (nr_samples == size) {
+			size = size ? size * 2 : 1024;
+			trace = realloc(trace, size * sizeof(*trace));
+			if (!trace)
+				return -1;
+		}
+		trace[nr_samples++] = s;
+	}
+
+	return nr_samples ? 0 : -1;
+}
+
+static void parse_table(const char *arg, unsigned int *table)
+{
+	char *end;
+	int i;
+
+	for (i = 0; i < 8 && *arg; i++) {
+		table[i] = strtoul(arg, &end, 0);
+		arg = *end == ',' ? end + 1 : end;
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-p tegra3|mp|balanced] [-r] [-b balance_level]"
+		" [-u up_delay_ms] [-d down_delay_ms] [-f max_khz]"
+		" [-i idle_bottom_khz] [-I idle_top_khz] [-s sample_ms]"
+		" [-N NwNs] [-T TwTs] [-v] [trace]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f = stdin;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:rb:u:d:f:i:I:s:N:T:v")) != -1) {
+		switch (opt) {
+		case 'p':
+			if (!strcmp(optarg, "tegra3"))
+				policy = POLICY_TEGRA3;
+			else if (!strcmp(optarg, "mp"))
+				policy = POLICY_MP;
+			else if (!strcmp(optarg, "balanced"))
+				policy = POLICY_BALANCED;
+			else
+				usage(argv[0]);
+			break;
+		case 'r':
+			nr_run_mode = true;
+			break;
+		case 'b':
+			balance_level = atoi(optarg);
+			break;
+		case 'u':
+			up_delay = atol(optarg);
+			break;
+		case 'd':
+			down_delay = atol(optarg);
+			break;
+		case 'f':
+			max_freq = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			idle_bottom_freq = strtoul(optarg, NULL, 0);
+			break;
+		case 'I':
+			idle_top_freq = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			sample_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'N':
+			parse_table(optarg, NwNs);
+			break;
+		case 'T':
+			parse_table(optarg, TwTs);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	/* the kernel defaults, UP2Gn_DELAY_MS etc. */
+	if (up_delay < 0)
+		up_delay = policy != POLICY_BALANCED ? 100 :
+			   nr_run_mode ? 100 : 1000;
+	if (down_delay < 0)
+		down_delay = policy != POLICY_BALANCED ? 2000 :
+			     nr_run_mode ? 500 : 2000;
+
+	if (optind < argc) {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+	if (!sample_ms || load_trace(f)) {
+		fprintf(stderr, "no usable trace\n");
+		return 1;
+	}
+
+	replay();
+	report();
+
+	return 0;
+}
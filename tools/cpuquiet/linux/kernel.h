@@ -0,0 +1,11 @@
+#ifndef LINUX_KERNEL_H
+#define LINUX_KERNEL_H
+
+#include <limits.h>
+#include <stddef.h>
+
+#include <linux/types.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#endif /* LINUX_KERNEL_H */
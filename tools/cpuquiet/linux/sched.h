@@ -0,0 +1,7 @@
+#ifndef LINUX_SCHED_H
+#define LINUX_SCHED_H
+
+#define FSHIFT		11		/* nr of bits of precision */
+#define FIXED_1		(1 << FSHIFT)	/* 1.0 as fixed-point */
+
+#endif /* LINUX_SCHED_H */
@@ -0,0 +1,335 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -g -I../../drivers/staging/android -o logger_bench logger_bench.c -lpthread */
+
+/*
+ * logger write throughput under concurrency
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+/*
+ * Runs 1..N writer threads, each logging back to back entries the way
+ * liblog does (one writev of priority, tag and message) to one log
+ * device, and reports the aggregate entry rate and bandwidth for every
+ * N. Each writer opens the device itself, so they only share what the
+ * driver shares between files.
+ *
+ * With -r a reader drains the log like logcat while the writers run and
+ * the number of entries it got and the ones it lost to being lapped are
+ * reported as well. Use a log nobody else writes to, /dev/log/radio say,
+ * if those numbers are to mean anything. With -M the reader maps the
+ * log instead and parses whole batches of entries in place, using
+ * LOGGER_GET_POSITION to find them and to tell which it lost.
+ *
+ * Typical usage:
+ *	logger_bench -t 8 -s 2
+ *	logger_bench -t 8 -s 2 -d /dev/log/radio -m 200 -r
+ *	logger_bench -t 8 -s 2 -d /dev/log/radio -m 200 -M
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+#define LOG_PRIO_INFO	4
+
+struct worker {
+	pthread_t thread;
+	int fd;
+	unsigned long writes, bytes, reads;
+};
+
+static const char *device = "/dev/log/main";
+static const char tag[] = "logger_bench";
+static int duration = 1;
+static unsigned int msg_size = 64;
+static volatile int stop;
+static pthread_barrier_t start_barrier;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *writer_fn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned char prio = LOG_PRIO_INFO;
+	struct iovec vec[3];
+	char *msg;
+	ssize_t ret;
+
+	msg = malloc(msg_size);
+	if (!msg)
+		exit(1);
+	memset(msg, 'x', msg_size - 1);
+	msg[msg_size - 1] = '\0';
+
+	vec[0].iov_base = &prio;
+	vec[0].iov_len = 1;
+	vec[1].iov_base = (void *)tag;
+	vec[1].iov_len = sizeof(tag);
+	vec[2].iov_base = msg;
+	vec[2].iov_len = msg_size;
+
+	pthread_barrier_wait(&start_barrier);
+
+	while (!stop) {
+		ret = writev(w->fd, vec, 3);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("writev");
+			exit(1);
+		}
+		w->writes++;
+		w->bytes += ret;
+	}
+
+	free(msg);
+	return NULL;
+}
+
+/* Whatever was written but never read got lapped and is counted as lost */
+static void *reader_fn(void *arg)
+{
+	struct worker *r = arg;
+	char buf[LOGGER_ENTRY_MAX_LEN];
+	ssize_t ret;
+
+	pthread_barrier_wait(&start_barrier);
+
+	while (!stop) {
+		ret = read(r->fd, buf, sizeof(buf));
+		r->reads++;
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				usleep(1000);
+				continue;
+			}
+			perror("read");
+			exit(1);
+		}
+		r->writes++;
+		r->bytes += ret;
+	}
+
+	return NULL;
+}
+
+/* Entry length at position 'pos' of the mapped log, which may wrap */
+static uint32_t entry_len(const unsigned char *map, uint32_t size,
+			  uint32_t pos)
+{
+	struct logger_entry entry;
+	uint32_t off = pos & (size - 1);
+
+	if (off + 1 < size)
+		memcpy(&entry.len, map + off, 2);
+	else
+		entry.len = map[off] | map[0] << 8;
+	return sizeof(entry) + entry.len;
+}
+
+static void *mmap_reader_fn(void *arg)
+{
+	struct worker *r = arg;
+	struct logger_position lp;
+	unsigned char *map;
+	struct pollfd pfd = { .fd = r->fd, .events = POLLIN };
+	uint32_t pos, p;
+	unsigned long n;
+
+	if (ioctl(r->fd, LOGGER_GET_POSITION, &lp) < 0) {
+		perror("LOGGER_GET_POSITION");
+		exit(1);
+	}
+	map = mmap(NULL, lp.size, PROT_READ, MAP_SHARED, r->fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	pos = lp.head;
+
+	pthread_barrier_wait(&start_barrier);
+
+	while (!stop) {
+		if (ioctl(r->fd, LOGGER_GET_POSITION, &lp) < 0) {
+			perror("LOGGER_GET_POSITION");
+			exit(1);
+		}
+		r->reads++;
+		if ((int32_t)(pos - lp.head) < 0)
+			pos = lp.head;
+		if (pos == lp.commit) {
+			poll(&pfd, 1, 10);
+			r->reads++;
+			continue;
+		}
+
+		/* walk the batch; a real reader would parse as it goes */
+		n = 0;
+		for (p = pos; (int32_t)(p - lp.commit) < 0;
+		     p += entry_len(map, lp.size, p))
+			n++;
+
+		/* anything behind the new head may have been overwritten */
+		if (ioctl(r->fd, LOGGER_GET_POSITION, &lp) < 0) {
+			perror("LOGGER_GET_POSITION");
+			exit(1);
+		}
+		if ((int32_t)(pos - lp.head) >= 0) {
+			r->writes += n;
+			r->bytes += p - pos;
+			pos = p;
+		}
+		r->reads++;
+	}
+
+	munmap(map, lp.size);
+	return NULL;
+}
+
+static int open_log(int flags)
+{
+	int fd = open(device, flags);
+
+	if (fd < 0) {
+		perror(device);
+		exit(1);
+	}
+	return fd;
+}
+
+enum { NO_READER, READ_READER, MMAP_READER };
+
+static void run(int nr_threads, int with_reader)
+{
+	struct worker *w, reader;
+	unsigned long writes = 0, bytes = 0;
+	double t0, t1;
+	int i;
+
+	w = calloc(nr_threads, sizeof(*w));
+	if (!w)
+		exit(1);
+
+	memset(&reader, 0, sizeof(reader));
+	if (with_reader) {
+		/* start from an empty log so everything read is ours */
+		int fd = open_log(O_WRONLY);
+
+		if (ioctl(fd, LOGGER_FLUSH_LOG) < 0)
+			perror("LOGGER_FLUSH_LOG");
+		close(fd);
+		reader.fd = open_log(O_RDONLY | O_NONBLOCK);
+	}
+
+	stop = 0;
+	pthread_barrier_init(&start_barrier, NULL,
+			     nr_threads + 1 + !!with_reader);
+	for (i = 0; i < nr_threads; i++) {
+		w[i].fd = open_log(O_WRONLY);
+		pthread_create(&w[i].thread, NULL, writer_fn, &w[i]);
+	}
+	if (with_reader)
+		pthread_create(&reader.thread, NULL,
+			       with_reader == MMAP_READER ?
+			       mmap_reader_fn : reader_fn, &reader);
+
+	pthread_barrier_wait(&start_barrier);
+	t0 = now();
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(w[i].thread, NULL);
+		writes += w[i].writes;
+		bytes += w[i].bytes;
+		close(w[i].fd);
+	}
+	t1 = now();
+
+	printf("%7d %12.0f %9.2f", nr_threads, writes / (t1 - t0),
+	       bytes / (t1 - t0) / (1 << 20));
+	if (with_reader) {
+		pthread_join(reader.thread, NULL);
+		close(reader.fd);
+		printf(" %12lu %12lu %12lu", reader.writes,
+		       writes > reader.writes ? writes - reader.writes : 0,
+		       reader.reads);
+	}
+	printf("\n");
+
+	pthread_barrier_destroy(&start_barrier);
+	free(w);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t max_threads] [-s seconds] [-d device]"
+		" [-m message_size] [-r | -M]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int with_reader = NO_READER;
+	int opt, n;
+
+	while ((opt = getopt(argc, argv, "t:s:d:m:rM")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			duration = atoi(optarg);
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		case 'm':
+			msg_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			with_reader = READ_READER;
+			break;
+		case 'M':
+			with_reader = MMAP_READER;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (max_threads < 1 || duration < 1 || !msg_size ||
+	    msg_size > LOGGER_ENTRY_MAX_PAYLOAD - sizeof(tag) - 1)
+		usage(argv[0]);
+
+	if (with_reader)
+		printf("threads     writes/s      MB/s         read"
+		       "         lost     syscalls\n");
+	else
+		printf("threads     writes/s      MB/s\n");
+	for (n = 1; n <= max_threads; n++)
+		run(n, with_reader);
+
+	return 0;
+}
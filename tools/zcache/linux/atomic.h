@@ -0,0 +1,19 @@
+#ifndef LINUX_ATOMIC_H
+#define LINUX_ATOMIC_H
+
+typedef struct {
+	int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i)		{ (i) }
+
+#define atomic_read(v)		__atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_set(v, i)	__atomic_store_n(&(v)->counter, (i), \
+					__ATOMIC_RELAXED)
+#define atomic_add_return(i, v)	__atomic_add_fetch(&(v)->counter, (i), \
+					__ATOMIC_SEQ_CST)
+#define atomic_inc_return(v)	atomic_add_return(1, v)
+#define atomic_inc(v)		((void)atomic_add_return(1, v))
+#define atomic_dec(v)		((void)atomic_add_return(-1, v))
+
+#endif /* LINUX_ATOMIC_H */
@@ -0,0 +1,2 @@
+#include <linux/kernel.h>
+#include "../../../include/linux/hash.h"
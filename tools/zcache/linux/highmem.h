@@ -0,0 +1,10 @@
+#ifndef LINUX_HIGHMEM_H
+#define LINUX_HIGHMEM_H
+
+#include <linux/list.h>
+#include <linux/rbtree.h>
+
+/* tmem never looks inside a page, that is left to the pamops */
+struct page;
+
+#endif /* LINUX_HIGHMEM_H */
@@ -0,0 +1,43 @@
+#ifndef LINUX_KERNEL_H
+#define LINUX_KERNEL_H
+
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/types.h>
+
+#define BITS_PER_LONG (__SIZEOF_LONG__ * 8)
+
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define container_of(ptr, type, member) ({			\
+	const typeof(((type *)0)->member) *__mptr = (ptr);	\
+	(type *)((char *)__mptr - offsetof(type, member)); })
+
+#define ACCESS_ONCE(x) (*(volatile typeof(x) *)&(x))
+
+#define barrier()	__asm__ __volatile__("" : : : "memory")
+#define cpu_relax()	barrier()
+#define smp_mb()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb()	__atomic_thread_fence(__ATOMIC_RELEASE)
+
+#define BUG()			assert(0)
+#define BUG_ON(cond)		assert(!(cond))
+#define WARN_ON(cond)		({					\
+	int __ret = !!(cond);						\
+	if (__ret)							\
+		fprintf(stderr, "WARN_ON(%s) at %s:%d\n", #cond,	\
+			__FILE__, __LINE__);				\
+	__ret; })
+
+#define EXPORT_SYMBOL(sym)
+
+#endif /* LINUX_KERNEL_H */
@@ -0,0 +1 @@
+#include "../../../include/linux/rbtree.h"
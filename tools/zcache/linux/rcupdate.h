@@ -0,0 +1,28 @@
+#ifndef LINUX_RCUPDATE_H
+#define LINUX_RCUPDATE_H
+
+#include <linux/kernel.h>
+
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+/*
+ * Quiescent state based RCU: read-side sections cost nothing, instead
+ * every registered thread calls rcu_quiescent_state() whenever it holds
+ * no references, i.e. between two tmem operations. See rcu.c.
+ */
+#define rcu_read_lock()		do { } while (0)
+#define rcu_read_unlock()	do { } while (0)
+#define rcu_dereference_raw(p)	__atomic_load_n(&(p), __ATOMIC_CONSUME)
+
+extern void call_rcu(struct rcu_head *head,
+		void (*func)(struct rcu_head *head));
+extern void rcu_register_thread(void);
+extern void rcu_unregister_thread(void);
+extern void rcu_quiescent_state(void);
+/* runs every pending callback, no other thread may be registered */
+extern void rcu_barrier(void);
+
+#endif /* LINUX_RCUPDATE_H */
@@ -0,0 +1,39 @@
+#ifndef LINUX_SEQLOCK_H
+#define LINUX_SEQLOCK_H
+
+#include <linux/kernel.h>
+
+typedef struct seqcount {
+	unsigned sequence;
+} seqcount_t;
+
+#define seqcount_init(x)	((x)->sequence = 0)
+
+static inline unsigned read_seqcount_begin(const seqcount_t *s)
+{
+	unsigned ret;
+
+	while ((ret = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 1)
+		cpu_relax();
+	return ret;
+}
+
+static inline int read_seqcount_retry(const seqcount_t *s, unsigned start)
+{
+	smp_rmb();
+	return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != start;
+}
+
+static inline void write_seqcount_begin(seqcount_t *s)
+{
+	__atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+	smp_wmb();
+}
+
+static inline void write_seqcount_end(seqcount_t *s)
+{
+	smp_wmb();
+	__atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+}
+
+#endif /* LINUX_SEQLOCK_H */
@@ -0,0 +1,13 @@
+#ifndef LINUX_TYPES_H
+#define LINUX_TYPES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t u8;
+
+#endif /* LINUX_TYPES_H */
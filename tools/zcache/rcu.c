@@ -0,0 +1,131 @@
+/*
+ * Minimal quiescent state based RCU for running tmem in userspace.
+ *
+ * Callbacks queued by a thread are handed to a grace period once enough
+ * have accumulated, by advancing the global grace period counter. They
+ * run once every online thread has passed a quiescent state after that,
+ * which is detected without blocking on later quiescent states of the
+ * queuing thread.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+
+#include <linux/rcupdate.h>
+
+#define RCU_MAX_THREADS	256
+#define RCU_BATCH	256
+
+static unsigned long rcu_gp_seq = 1;
+/* last grace period seen quiescent, 0 for unused, ULONG_MAX offline */
+static unsigned long rcu_thread_qs[RCU_MAX_THREADS];
+static int rcu_nr_threads;
+
+static pthread_mutex_t rcu_orphan_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rcu_head *rcu_orphans;
+
+static __thread int rcu_id = -1;
+static __thread struct rcu_head *rcu_pending, *rcu_waiting;
+static __thread unsigned long rcu_waiting_seq;
+static __thread unsigned int rcu_nr_pending;
+
+static void rcu_run(struct rcu_head *head)
+{
+	struct rcu_head *next;
+
+	for (; head; head = next) {
+		next = head->next;
+		head->func(head);
+	}
+}
+
+static struct rcu_head *rcu_splice(struct rcu_head *list,
+				struct rcu_head *tail_list)
+{
+	struct rcu_head *head = list;
+
+	if (!list)
+		return tail_list;
+	while (list->next)
+		list = list->next;
+	list->next = tail_list;
+	return head;
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+	head->func = func;
+	head->next = rcu_pending;
+	rcu_pending = head;
+	rcu_nr_pending++;
+}
+
+void rcu_register_thread(void)
+{
+	rcu_id = __atomic_fetch_add(&rcu_nr_threads, 1, __ATOMIC_SEQ_CST);
+	assert(rcu_id < RCU_MAX_THREADS);
+	__atomic_store_n(&rcu_thread_qs[rcu_id],
+			__atomic_load_n(&rcu_gp_seq, __ATOMIC_SEQ_CST),
+			__ATOMIC_SEQ_CST);
+}
+
+void rcu_unregister_thread(void)
+{
+	__atomic_store_n(&rcu_thread_qs[rcu_id], ULONG_MAX, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&rcu_orphan_lock);
+	rcu_orphans = rcu_splice(rcu_pending, rcu_orphans);
+	rcu_orphans = rcu_splice(rcu_waiting, rcu_orphans);
+	pthread_mutex_unlock(&rcu_orphan_lock);
+	rcu_pending = rcu_waiting = NULL;
+	rcu_nr_pending = 0;
+}
+
+static int rcu_gp_done(unsigned long seq)
+{
+	int i, n = __atomic_load_n(&rcu_nr_threads, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < n; i++) {
+		unsigned long qs;
+
+		qs = __atomic_load_n(&rcu_thread_qs[i], __ATOMIC_ACQUIRE);
+		if (qs && qs < seq)
+			return 0;
+	}
+	return 1;
+}
+
+void rcu_quiescent_state(void)
+{
+	unsigned long seq = __atomic_load_n(&rcu_gp_seq, __ATOMIC_ACQUIRE);
+
+	__atomic_store_n(&rcu_thread_qs[rcu_id], seq, __ATOMIC_RELEASE);
+
+	if (rcu_waiting && rcu_gp_done(rcu_waiting_seq)) {
+		rcu_run(rcu_waiting);
+		rcu_waiting = NULL;
+	}
+	if (!rcu_waiting && rcu_nr_pending >= RCU_BATCH) {
+		rcu_waiting = rcu_pending;
+		rcu_pending = NULL;
+		rcu_nr_pending = 0;
+		rcu_waiting_seq = __atomic_add_fetch(&rcu_gp_seq, 1,
+						__ATOMIC_SEQ_CST);
+	}
+}
+
+void rcu_barrier(void)
+{
+	rcu_run(rcu_waiting);
+	rcu_run(rcu_pending);
+	rcu_waiting = rcu_pending = NULL;
+	rcu_nr_pending = 0;
+
+	pthread_mutex_lock(&rcu_orphan_lock);
+	rcu_run(rcu_orphans);
+	rcu_orphans = NULL;
+	pthread_mutex_unlock(&rcu_orphan_lock);
+
+	/* everybody is offline, recycle their slots */
+	memset(rcu_thread_qs, 0, sizeof(rcu_thread_qs));
+	__atomic_store_n(&rcu_nr_threads, 0, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,274 @@
+/*
+ * tmem get/put throughput benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+/*
+ * Links drivers/staging/zcache/tmem.c against userspace stand-ins for
+ * the kernel primitives it uses and hammers one pool with a cleancache
+ * like mix of puts, gets and flushes from 1..N threads. This measures
+ * the scalability of tmem's own locking; compression is left out, each
+ * pampd just records the handle it was created for. Every successful get
+ * checks that handle, and after each run the pool is destroyed and all
+ * objects, objnodes and pampds must have been returned.
+ *
+ * Typical usage:
+ *	make && ./tmem_bench -t 8 -s 2
+ *	./tmem_bench -t 8 -p		(persistent pool, frontswap like)
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/rcupdate.h>
+#include "tmem.h"
+
+struct page {
+	struct tmem_oid oid;
+	uint32_t index;
+};
+
+struct bench_pampd {
+	struct tmem_oid oid;
+	uint32_t index;
+};
+
+struct worker {
+	pthread_t thread;
+	struct tmem_pool *pool;
+	unsigned int seed;
+	unsigned long ops, gets, hits;
+};
+
+static int duration = 1;
+static unsigned int nr_objs = 4096, nr_pages = 64, get_pct = 50;
+static volatile int stop;
+static pthread_barrier_t start_barrier;
+
+static long nr_obj, nr_objnode, nr_pampd, nr_bad;
+
+static void count(long *v, long d)
+{
+	__atomic_add_fetch(v, d, __ATOMIC_RELAXED);
+}
+
+static struct tmem_obj *bench_obj_alloc(struct tmem_pool *pool)
+{
+	count(&nr_obj, 1);
+	return malloc(sizeof(struct tmem_obj));
+}
+
+static void bench_obj_free(struct tmem_obj *obj, struct tmem_pool *pool)
+{
+	count(&nr_obj, -1);
+	free(obj);
+}
+
+static struct tmem_objnode *bench_objnode_alloc(struct tmem_pool *pool)
+{
+	count(&nr_objnode, 1);
+	return malloc(sizeof(struct tmem_objnode));
+}
+
+static void bench_objnode_free(struct tmem_objnode *objnode,
+				struct tmem_pool *pool)
+{
+	count(&nr_objnode, -1);
+	free(objnode);
+}
+
+static struct tmem_hostops bench_hostops = {
+	.obj_alloc = bench_obj_alloc,
+	.obj_free = bench_obj_free,
+	.objnode_alloc = bench_objnode_alloc,
+	.objnode_free = bench_objnode_free,
+};
+
+static void *bench_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
+				uint32_t index, struct page *page)
+{
+	struct bench_pampd *pampd = malloc(sizeof(*pampd));
+
+	if (pampd) {
+		pampd->oid = *oid;
+		pampd->index = index;
+		count(&nr_pampd, 1);
+	}
+	return pampd;
+}
+
+static int bench_pampd_get_data(struct page *page, void *pampd,
+				struct tmem_pool *pool)
+{
+	struct bench_pampd *p = pampd;
+
+	if (tmem_oid_compare(&p->oid, &page->oid) || p->index != page->index)
+		count(&nr_bad, 1);
+	return 0;
+}
+
+static void bench_pampd_free(void *pampd, struct tmem_pool *pool)
+{
+	count(&nr_pampd, -1);
+	free(pampd);
+}
+
+static struct tmem_pamops bench_pamops = {
+	.create = bench_pampd_create,
+	.get_data = bench_pampd_get_data,
+	.free = bench_pampd_free,
+};
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	struct page page;
+	unsigned int r;
+
+	memset(&page, 0, sizeof(page));
+	rcu_register_thread();
+	pthread_barrier_wait(&start_barrier);
+
+	while (!stop) {
+		r = rand_r(&w->seed);
+		page.oid.oid[0] = r % nr_objs;
+		page.index = (r / nr_objs) % nr_pages;
+
+		r = rand_r(&w->seed) % 100;
+		if (r < get_pct) {
+			w->gets++;
+			if (tmem_get(w->pool, &page.oid, page.index, &page) == 0)
+				w->hits++;
+		} else if (r < 90) {
+			tmem_put(w->pool, &page.oid, page.index, &page);
+		} else if (r < 99) {
+			tmem_flush_page(w->pool, &page.oid, page.index);
+		} else {
+			tmem_flush_object(w->pool, &page.oid);
+		}
+		w->ops++;
+
+		rcu_quiescent_state();
+	}
+
+	rcu_unregister_thread();
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run(int nr_threads, uint32_t flags)
+{
+	struct tmem_pool *pool;
+	struct worker *w;
+	unsigned long ops = 0, gets = 0, hits = 0;
+	double t0, t1;
+	int i;
+
+	pool = calloc(1, sizeof(*pool));
+	w = calloc(nr_threads, sizeof(*w));
+	if (!pool || !w)
+		return -1;
+	tmem_new_pool(pool, flags);
+
+	stop = 0;
+	pthread_barrier_init(&start_barrier, NULL, nr_threads + 1);
+	for (i = 0; i < nr_threads; i++) {
+		w[i].pool = pool;
+		w[i].seed = i + 1;
+		pthread_create(&w[i].thread, NULL, worker_fn, &w[i]);
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	t0 = now();
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(w[i].thread, NULL);
+		ops += w[i].ops;
+		gets += w[i].gets;
+		hits += w[i].hits;
+	}
+	t1 = now();
+
+	tmem_destroy_pool(pool);
+	rcu_barrier();
+
+	printf("%7d %12.3f %9.1f\n", nr_threads, ops / (t1 - t0) / 1e6,
+		gets ? 100.0 * hits / gets : 0.0);
+
+	pthread_barrier_destroy(&start_barrier);
+	free(w);
+	free(pool);
+
+	if (nr_bad || nr_obj || nr_objnode || nr_pampd) {
+		fprintf(stderr, "bad gets %ld, leaked objs %ld objnodes %ld "
+			"pampds %ld\n", nr_bad, nr_obj, nr_objnode, nr_pampd);
+		return -1;
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t max_threads] [-s seconds] [-o objects]"
+		" [-n pages_per_object] [-g get_percent] [-p]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t flags = 0;
+	int opt, n;
+
+	while ((opt = getopt(argc, argv, "t:s:o:n:g:p")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			duration = atoi(optarg);
+			break;
+		case 'o':
+			nr_objs = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nr_pages = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			get_pct = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			flags |= TMEM_POOL_PERSIST;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (max_threads < 1 || duration < 1 || !nr_objs || !nr_pages ||
+	    get_pct > 90)
+		usage(argv[0]);
+
+	tmem_register_hostops(&bench_hostops);
+	tmem_register_pamops(&bench_pamops);
+
+	printf("threads   Mops/s     hit%%\n");
+	for (n = 1; n <= max_threads; n++)
+		if (run(n, flags))
+			return 1;
+
+	return 0;
+}
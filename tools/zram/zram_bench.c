@@ -0,0 +1,208 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -g -o zram_bench zram_bench.c -lpthread */
+
+/*
+ * zram write throughput benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+/*
+ * Spawns 1..N writer threads, each streaming pages into its own slice
+ * of a zram block device with O_DIRECT, and reports the aggregate
+ * write bandwidth for every thread count. Page contents are filled
+ * with a mix of repeated and pseudo-random words so that they compress
+ * roughly like anonymous memory does (about 2:1 with LZO).
+ *
+ * -b sets the number of pages per write(); large writes reach zram as
+ * multi-page bios and are split across workers once async_min_pages is
+ * set, while -b 1 issues single page bios like swap-out does, which
+ * are queued to the workers instead (async_writes grows either way).
+ *
+ * Typical usage:
+ *	echo $((256 << 20)) > /sys/block/zram0/disksize
+ *	zram_bench -d /dev/zram0 -t 4 -s 64
+ *	echo 8 > /sys/block/zram0/async_min_pages
+ *	zram_bench -d /dev/zram0 -t 1 -s 64 -b 32
+ *	zram_bench -d /dev/zram0 -t 4 -s 64 -b 1
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PAGE_SZ		4096
+
+struct writer {
+	pthread_t thread;
+	int fd;
+	off_t start;
+	size_t bytes;
+	size_t chunk;
+	unsigned int seed;
+	int err;
+};
+
+static pthread_barrier_t start_barrier;
+
+static void fill_page(unsigned char *buf, unsigned int *seed)
+{
+	unsigned int *word = (unsigned int *)buf;
+	size_t i;
+
+	for (i = 0; i < PAGE_SZ / sizeof(*word); i++) {
+		/* every other run of 8 words is random, the rest repeats */
+		if ((i / 8) & 1)
+			word[i] = rand_r(seed);
+		else
+			word[i] = i / 8;
+	}
+}
+
+static void *writer_fn(void *arg)
+{
+	struct writer *w = arg;
+	unsigned char *buf;
+	size_t done, off;
+	ssize_t len;
+
+	if (posix_memalign((void **)&buf, PAGE_SZ, w->chunk)) {
+		w->err = ENOMEM;
+		pthread_barrier_wait(&start_barrier);
+		return NULL;
+	}
+
+	pthread_barrier_wait(&start_barrier);
+
+	for (done = 0; done < w->bytes; done += len) {
+		len = w->chunk;
+		if ((size_t)len > w->bytes - done)
+			len = w->bytes - done;
+		for (off = 0; off < (size_t)len; off += PAGE_SZ)
+			fill_page(buf + off, &w->seed);
+		if (pwrite(w->fd, buf, len, w->start + done) != len) {
+			w->err = errno;
+			break;
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run(const char *dev, int nr_threads, size_t mb_per_thread,
+		size_t pages_per_write)
+{
+	struct writer *w;
+	double t0, t1;
+	size_t total;
+	int fd, i, ret = 0;
+
+	fd = open(dev, O_WRONLY | O_DIRECT);
+	if (fd < 0) {
+		perror(dev);
+		return -1;
+	}
+
+	w = calloc(nr_threads, sizeof(*w));
+	if (!w) {
+		close(fd);
+		return -1;
+	}
+
+	pthread_barrier_init(&start_barrier, NULL, nr_threads + 1);
+
+	for (i = 0; i < nr_threads; i++) {
+		w[i].fd = fd;
+		w[i].bytes = mb_per_thread << 20;
+		w[i].chunk = pages_per_write * PAGE_SZ;
+		w[i].start = (off_t)i * w[i].bytes;
+		w[i].seed = i + 1;
+		pthread_create(&w[i].thread, NULL, writer_fn, &w[i]);
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	t0 = now();
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(w[i].thread, NULL);
+	t1 = now();
+
+	total = 0;
+	for (i = 0; i < nr_threads; i++) {
+		if (w[i].err) {
+			fprintf(stderr, "writer %d: %s\n", i,
+				strerror(w[i].err));
+			ret = -1;
+		}
+		total += w[i].bytes;
+	}
+
+	if (!ret)
+		printf("%7d %12.1f %10.3f\n", nr_threads,
+			total / (t1 - t0) / (1 << 20), t1 - t0);
+
+	pthread_barrier_destroy(&start_barrier);
+	free(w);
+	close(fd);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d device] [-t max_threads] [-s MB_per_thread]"
+		" [-b pages_per_write]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = "/dev/zram0";
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t mb = 32, pages = 1;
+	int opt, n;
+
+	while ((opt = getopt(argc, argv, "d:t:s:b:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			pages = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (max_threads < 1 || !mb || !pages)
+		usage(argv[0]);
+
+	printf("threads         MB/s    seconds\n");
+	for (n = 1; n <= max_threads; n++)
+		if (run(dev, n, mb, pages))
+			return 1;
+
+	return 0;
+}